@@ -0,0 +1,53 @@
+// arena.c
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+static __thread char arena_buf[ARENA_SIZE] __attribute__((aligned(16)));
+static __thread size_t arena_used = 0;
+static size_t high_water = 0;
+
+void* arena_alloc(size_t size) {
+    size_t start = (arena_used + 15) & ~(size_t)15;
+    if (size > ARENA_SIZE - start || start > ARENA_SIZE) return NULL;
+    arena_used = start + size;
+
+    size_t seen = __atomic_load_n(&high_water, __ATOMIC_RELAXED);
+    while (arena_used > seen &&
+           !__atomic_compare_exchange_n(&high_water, &seen, arena_used, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    return arena_buf + start;
+}
+
+char* arena_printf(size_t* len, const char* fmt, ...) {
+    // Format straight into the free space, then claim what was used
+    size_t start = (arena_used + 15) & ~(size_t)15;
+    if (start >= ARENA_SIZE) return NULL;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(arena_buf + start, ARENA_SIZE - start, fmt, ap);
+    va_end(ap);
+    if (n < 0 || (size_t)n >= ARENA_SIZE - start) return NULL;
+
+    char* out = arena_alloc(n + 1);
+    if (len) *len = n;
+    return out;
+}
+
+void arena_reset(void) {
+    arena_used = 0;
+}
+
+size_t arena_mark(void) {
+    return arena_used;
+}
+
+void arena_rewind(size_t mark) {
+    if (mark < arena_used) arena_used = mark;
+}
+
+size_t arena_high_water(void) {
+    return __atomic_load_n(&high_water, __ATOMIC_RELAXED);
+}
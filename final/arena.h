@@ -0,0 +1,31 @@
+// arena.h
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_SIZE (16 * 1024)     // Scratch space per thread
+
+// Per-thread bump allocator for scratch formatting. The space lives in
+// thread-local storage, so using it never touches the heap. Everything
+// handed out is released together by arena_reset(), which each client
+// thread calls before every command.
+
+// size bytes, 16-byte aligned, or NULL once the arena is full.
+void* arena_alloc(size_t size);
+
+// printf into the arena. Sets *len when len is not NULL. Returns NULL if
+// the result doesn't fit.
+char* arena_printf(size_t* len, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+void arena_reset(void);
+
+// Release only what was allocated after arena_mark(), for code that may
+// run on a thread that doesn't reset per command
+size_t arena_mark(void);
+void arena_rewind(size_t mark);
+
+// Most any thread's arena has held since start
+size_t arena_high_water(void);
+
+#endif /* ARENA_H */
@@ -1,96 +1,89 @@
-
 // chatclient.c
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <pthread.h>
-#include <arpa/inet.h>
-#include <sys/socket.h>
-#include <sys/stat.h>
+#include <poll.h>
+#include <errno.h>
+
+#include "libchatclient.h"
 
 #define BUFFER_SIZE 4096
-#define MAX_USERNAME 17
-#define MAX_FILENAME 256
-#define MAX_FILE_SIZE 3 * 1024 * 1024 // 3MB
 
-int sockfd;
-volatile int running = 1;
+static int progress_shown = 0;  // A progress line is open, without its newline
+static int heard = 0;           // The server has said something
 
-// Server'dan gelen mesajları dinleyen thread
-void* receive_handler(void* arg) {
+// Server'dan gelen satırlar ve transfer çıktısı
+static void show_line(ChatClient* c, const CcLine* line, void* arg) {
+    (void)c;
     (void)arg;
-    char buffer[BUFFER_SIZE];
-    while (running) {
-        memset(buffer, 0, sizeof(buffer));
-        int bytes = recv(sockfd, buffer, sizeof(buffer) - 1, 0);
-        if (bytes <= 0) break;
-
-        if (strstr(buffer, "[ERROR]"))
-            printf("\033[0;31m%s\033[0m", buffer); // kırmızı
-        else if (strstr(buffer, "[INFO]"))
-            printf("\033[0;32m%s\033[0m", buffer); // yeşil
-        else
-            printf("%s", buffer);
-
-        printf(">> ");
+    heard = 1;
+    if (line->kind == CC_PROGRESS) {
+        printf("\r\033[0;32m%s\033[0m", line->text);
+        progress_shown = 1;
         fflush(stdout);
-
-    }
-    running = 0;
-    return NULL;
-}
-
-// Dosya gönderme
-void send_file(const char* filename, const char* receiver) {
-    FILE* fp = fopen(filename, "rb");
-    if (!fp) {
-        printf("\033[0;31m[ERROR] Cannot open file '%s'.\033[0m\n", filename);
         return;
     }
-
-    struct stat st;
-    if (stat(filename, &st) < 0) {
-        printf("\033[0;31m[ERROR] File stat failed.\033[0m\n");
-        fclose(fp);
-        return;
+    if (progress_shown) {
+        printf("\n");
+        progress_shown = 0;
     }
 
-    if (st.st_size > MAX_FILE_SIZE) {
-        printf("\033[0;31m[ERROR] File exceeds 3MB limit.\033[0m\n");
-        fclose(fp);
-        return;
-    }
+    int failed = line->kind == CC_ERROR ||
+                 (line->kind == CC_TRANSFER_DONE && line->done < line->total);
+    int ok = line->kind == CC_INFO || line->kind == CC_TRANSFER_DONE;
+    if (failed)
+        printf("\033[0;31m%s\033[0m\n", line->text); // kırmızı
+    else if (ok)
+        printf("\033[0;32m%s\033[0m\n", line->text); // yeşil
+    else
+        printf("%s\n", line->text);
+
+    printf(">> ");
+    fflush(stdout);
+}
 
-    // Uzantı kontrolü
-    const char* allowed[] = {".txt", ".pdf", ".png", ".jpg"};
-    int valid = 0;
-    for (int i = 0; i < 4; i++) {
-        if (strstr(filename, allowed[i])) {
-            valid = 1;
-            break;
+// One line typed by the user. Returns 0 once they asked to leave.
+static int handle_input(ChatClient* c, char* input) {
+    if (strncmp(input, "/sendfiles ", 11) == 0) {
+        char* saveptr;
+        char* pattern = strtok_r(input + 11, " ", &saveptr);
+        char* target = strtok_r(NULL, " ", &saveptr);
+
+        if (!pattern || !target) {
+            printf("\033[0;31m[ERROR] Usage: /sendfiles <pattern> <user|#room>\033[0m\n");
+        } else if (!cc_send_files(c, pattern, target)) {
+            printf("\033[0;31m[ERROR] Cannot start the upload.\033[0m\n");
         }
     }
-    if (!valid) {
-        printf("\033[0;31m[ERROR] Unsupported file type.\033[0m\n");
-        fclose(fp);
-        return;
+    else if (strncmp(input, "/sendfile", 9) == 0) {
+        char* filename = strtok(input + 9, " ");
+        char* target = strtok(NULL, "\0");
+
+        if (!filename || !target) {
+            printf("\033[0;31m[ERROR] Usage: /sendfile <filename> <user|#room>\033[0m\n");
+        } else if (!cc_send_file(c, filename, target)) {
+            printf("\033[0;31m[ERROR] Cannot start the upload.\033[0m\n");
+        }
     }
-
-    // Server'a header gönder
-    char header[BUFFER_SIZE];
-    snprintf(header, sizeof(header), "/sendfile %s %ld %s\n", filename, st.st_size, receiver);
-    send(sockfd, header, strlen(header), 0);
-
-    // İçeriği gönder
-    char filebuf[BUFFER_SIZE];
-    size_t n;
-    while ((n = fread(filebuf, 1, sizeof(filebuf), fp)) > 0) {
-        send(sockfd, filebuf, n, 0);
+    else if (strncmp(input, "/getfile ", 9) == 0) {
+        char* saveptr;
+        char* id = strtok_r(input + 9, " ", &saveptr);
+        char* outname = strtok_r(NULL, " ", &saveptr);
+
+        if (!id || atol(id) <= 0) {
+            printf("\033[0;31m[ERROR] Usage: /getfile <id> [outfile]\033[0m\n");
+        } else if (!cc_get_file(c, atol(id), outname)) {
+            printf("\033[0;31m[ERROR] Cannot start the download.\033[0m\n");
+        }
     }
-
-    fclose(fp);
-    printf("\033[0;32m[INFO] File '%s' sent to %s.\033[0m\n", filename, receiver);
+    else if (strncmp(input, "/exit", 5) == 0) {
+        return 0;
+    }
+    else {
+        cc_send(c, input);
+    }
+    return 1;
 }
 
 int main(int argc, char* argv[]) {
@@ -99,77 +92,88 @@ int main(int argc, char* argv[]) {
         return EXIT_FAILURE;
     }
 
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) {
-        perror("socket error");
-        return EXIT_FAILURE;
-    }
-
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(atoi(argv[2]));
-    inet_pton(AF_INET, argv[1], &server_addr.sin_addr);
+    // Kullanıcı adı. stdin is read unbuffered: the main loop read()s it
+    // directly, so stdio must not take lines past the name.
+    setvbuf(stdin, NULL, _IONBF, 0);
+    char username[BUFFER_SIZE];
+    printf("Enter username (max 16 chars, alphanumeric): ");
+    if (!fgets(username, sizeof(username), stdin)) return EXIT_FAILURE;
+    username[strcspn(username, "\n")] = 0;
+    username[CC_MAX_USERNAME - 1] = '\0';
 
-    if (connect(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+    ChatClient* c = cc_open(argv[1], atoi(argv[2]), username);
+    if (!c) {
         perror("connect error");
         return EXIT_FAILURE;
     }
+    cc_on_line(c, show_line, NULL);
 
-    // Kullanıcı adı
-    char username[MAX_USERNAME];
-    printf("Enter username (max 16 chars, alphanumeric): ");
-    fgets(username, MAX_USERNAME, stdin);
-    username[strcspn(username, "\n")] = 0;
-    send(sockfd, username, strlen(username), 0);
-
-    char response[BUFFER_SIZE] = {0};
-    recv(sockfd, response, sizeof(response), 0);
-
-    if (strstr(response, "[ERROR]")) {
-        printf("\033[0;31m%s\033[0m", response);
-        close(sockfd);
+    // Nothing is typed until the server has taken the name
+    while (cc_state(c) == CC_CONNECTING || cc_state(c) == CC_LOGIN) {
+        cc_poll(c, -1);
+    }
+    if (cc_state(c) != CC_READY) {
+        // A refused name was already shown by show_line
+        if (!heard) fprintf(stderr, "connect error: %s\n", cc_error(c));
+        cc_close(c);
         return EXIT_FAILURE;
     }
 
-    printf("\033[0;32m%s\033[0m", response);
-
-    pthread_t recv_thread;
-    pthread_create(&recv_thread, NULL, receive_handler, NULL);
-
-    // Ana giriş döngüsü
-    while (running) {
-        char input[BUFFER_SIZE];
-        printf(">> ");
-        fflush(stdout);
-
-        if (!fgets(input, BUFFER_SIZE, stdin)) break;
-        input[strcspn(input, "\n")] = 0;
-
-        if (strncmp(input, "/sendfile", 9) == 0) {
-            char* filename = strtok(input + 10, " ");
-            char* target = strtok(NULL, "\0");
-
-            if (!filename || !target) {
-                printf("\033[0;31m[ERROR] Usage: /sendfile <filename> <user>\033[0m\n");
-                continue;
-            }
-
-            send_file(filename, target);
-        }
-        else if (strncmp(input, "/exit", 5) == 0) {
-            send(sockfd, "/exit\n", 6, 0);
-            running = 0;
+    // Ana döngü: klavye, sunucu ve transferler tek poll() üzerinde
+    char input[BUFFER_SIZE];
+    size_t input_len = 0;
+    int typing = 1;
+    while (typing && cc_state(c) != CC_CLOSED) {
+        struct pollfd fds[1 + CC_POLLFDS];
+        fds[0].fd = STDIN_FILENO;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        int n = 1 + cc_pollfds(c, fds + 1);
+        if (poll(fds, n, -1) < 0) {
+            if (errno == EINTR) continue;
             break;
         }
-        else {
-            strcat(input, "\n");
-            send(sockfd, input, strlen(input), 0);
+        cc_process(c, fds + 1);
+
+        if (fds[0].revents & (POLLIN | POLLHUP)) {
+            ssize_t got = read(STDIN_FILENO, input + input_len, sizeof(input) - 1 - input_len);
+            if (got <= 0) break;
+            input_len += got;
+
+            // Whole lines only; a line that fills the buffer goes as it is
+            char* start = input;
+            char* nl;
+            while (typing && (nl = memchr(start, '\n', input + input_len - start)) != NULL) {
+                *nl = '\0';
+                typing = handle_input(c, start);
+                start = nl + 1;
+            }
+            if (start == input && input_len == sizeof(input) - 1) {
+                input[input_len] = '\0';
+                typing = handle_input(c, input);
+                start = input + input_len;
+            }
+            input_len -= start - input;
+            memmove(input, start, input_len);
+            if (typing) {
+                printf(">> ");
+                fflush(stdout);
+            }
         }
     }
 
-    close(sockfd);
-    pthread_cancel(recv_thread);
-    pthread_join(recv_thread, NULL);
+    // Transfers need the session, so they finish before /exit goes out;
+    // the server hangs up on it
+    if (cc_transfers(c) > 0) {
+        printf("\n[CLIENT] Waiting for %d transfer(s) to finish...\n", cc_transfers(c));
+    }
+    while (cc_transfers(c) > 0) {
+        cc_poll(c, 200);
+    }
+    if (!typing && cc_send(c, "/exit") == 0) {
+        while (cc_poll(c, 200) == 0) {}
+    }
+    cc_close(c);
     printf("\n[CLIENT] Connection closed.\n");
     return EXIT_SUCCESS;
 }
@@ -11,77 +11,87 @@
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
-#include <semaphore.h>
+#include <sys/random.h>
 #include <errno.h>
 #include <time.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "chatserver.h"
+#include "netio.h"
+#include "history.h"
+#include "msglog.h"
+#include "search.h"
+#include "mailbox.h"
+#include "peer.h"
+#include "filestore.h"
+#include "transfer.h"
+#include "pipeline.h"
+#include "overload.h"
+#include "handoff.h"
+#include "rooms.h"
+#include "shard.h"
+#include "presence.h"
+#include "filter.h"
+#include "pool.h"
+#include "arena.h"
+#include "trace.h"
+#include "journal.h"
 
-#define MAX_CLIENTS 50
-#define MAX_USERNAME 17
-#define MAX_ROOMNAME 33
-#define MAX_ROOMS 50
-#define BUFFER_SIZE 4096
-#define MAX_FILE_SIZE 3 * 1024 * 1024
-#define MAX_UPLOAD_QUEUE 20  // Increased queue size
-#define MAX_CONCURRENT_UPLOADS 5  // Max concurrent uploads
-#define ROOM_NAME_LEN 32
-
+Client* clients[MAX_CLIENTS];
+int client_count = 0;
 
+pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-typedef enum { STATE_COMMAND, STATE_RECEIVING_FILE } ClientState;
+Client* get_client_by_name(const char* name);
+int username_exists(const char* name);
 
-typedef struct {
-    int sockfd;
-    char username[MAX_USERNAME];
-    char room[MAX_ROOMNAME];
-    ClientState state;               // <-- NEW
-    long remaining_file_bytes;      // <-- NEW
-    //FileTransfer* current_file;     // <-- NEW
-} Client;
+// Upload processing: validate -> hash -> transform -> persist -> notify
+Pipeline* upload_pipeline = NULL;
 
+// Client and FileTransfer objects are recycled instead of going back to the heap
+static Pool client_pool, transfer_pool;
 
-// File transfer struct
-typedef struct {
-    char sender[MAX_USERNAME];
-    char receiver[MAX_USERNAME];
-    char filename[256];
-    int filesize;
-    char* filedata;
-    time_t enqueued_time;
-} FileTransfer;
+Client* client_alloc(void) {
+    return pool_get(&client_pool);
+}
 
-Client* clients[MAX_CLIENTS];
-int client_count = 0;
+void client_free(Client* cli) {
+    pool_put(&client_pool, cli);
+}
 
-pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t file_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
-sem_t upload_slots;
-sem_t processing_slots;  // New semaphore for concurrent processing limit
+FileTransfer* file_transfer_alloc(void) {
+    return pool_get(&transfer_pool);
+}
 
-Client* get_client_by_name(const char* name);
-int room_user_count(const char* room_name);
-void leave_room(Client* cli);
+void file_transfer_free(FileTransfer* ft) {
+    pool_put(&transfer_pool, ft);
+}
 
-// Queue
-FileTransfer* upload_queue[MAX_UPLOAD_QUEUE];
-int upload_front = 0, upload_rear = 0, upload_size = 0;
-int active_uploads = 0;  // Track active uploads
+// Opened once and flushed per line; reopening for every event cost a
+// heap allocation each time
+static FILE* logf = NULL;
 
 void log_event(const char* message) {
     pthread_mutex_lock(&log_mutex);
-    FILE* logf = fopen("log.txt", "a");
+    if (!logf) logf = fopen("log.txt", "a");
     if (!logf) {
         perror("Log error");
         pthread_mutex_unlock(&log_mutex);
         return;
     }
 
+    // ctime() re-reads the TZ setting on every call, which allocates;
+    // localtime_r() only does that once
     time_t now = time(NULL);
-    char* timestr = ctime(&now);
-    timestr[strcspn(timestr, "\n")] = 0; // remove newline
+    struct tm tm_now;
+    char timestr[32];
+    localtime_r(&now, &tm_now);
+    strftime(timestr, sizeof(timestr), "%a %b %e %H:%M:%S %Y", &tm_now);
 
     fprintf(logf, "%s - %s\n", timestr, message);
-    fclose(logf);
+    fflush(logf);
 
     printf("%s - %s\n", timestr, message);
 
@@ -92,12 +102,13 @@ void log_event(const char* message) {
 void sigint_handler(int sig) {
     (void)sig; // Unused 
     log_event("[SHUTDOWN] SIGINT received. Disconnecting all clients.");
+    journal_flush();
     pthread_mutex_lock(&clients_mutex);
     for (int i = 0; i < MAX_CLIENTS; i++) {
         if (clients[i]) {
-            send(clients[i]->sockfd, "Server shutting down.\n", 23, 0);
+            send(clients[i]->sockfd, "Server shutting down.\n", 22, 0);
             close(clients[i]->sockfd);
-            free(clients[i]);
+            client_free(clients[i]);
             clients[i] = NULL;
         }
     }
@@ -123,27 +134,87 @@ int valid_room(const char* room) {
     return 1;
 }
 
-void add_client(Client* cl) {
+// A file goes to a user, or to "#room" when the sender is in that room
+int valid_receiver(const char* sender, const char* receiver) {
+    if (receiver[0] != '#') return valid_username(receiver);
+    return valid_room(receiver + 1) && client_in_room(sender, receiver + 1);
+}
+
+// The user holding a session key, while that login lasts. Transfer
+// connections carry the key instead of a name. Returns 0 and fills user
+// (MAX_USERNAME bytes), or -1.
+int session_user(const char* key, char* user) {
+    if (strlen(key) != SESSION_KEY_LEN) return -1;
+    int found = -1;
+    pthread_mutex_lock(&clients_mutex);
+    for (int i = 0; i < MAX_CLIENTS && found < 0; ++i) {
+        if (!clients[i]) continue;
+        unsigned char diff = 0;
+        for (int k = 0; k < SESSION_KEY_LEN; k++) {
+            diff |= (unsigned char)(key[k] ^ clients[i]->session_key[k]);
+        }
+        if (diff == 0) {
+            strcpy(user, clients[i]->username);
+            found = 0;
+        }
+    }
+    pthread_mutex_unlock(&clients_mutex);
+    return found;
+}
+
+int client_in_room(const char* name, const char* room) {
+    int found = 0;
     pthread_mutex_lock(&clients_mutex);
     for (int i = 0; i < MAX_CLIENTS; ++i) {
-        if (!clients[i]) {
-            clients[i] = cl;
-            client_count++;
+        if (clients[i] && strcmp(clients[i]->username, name) == 0) {
+            found = room_is_member(clients[i], room);
             break;
         }
     }
     pthread_mutex_unlock(&clients_mutex);
+    return found;
+}
+
+// Returns 0, -1 if the name is taken or -2 if the table is full. The name
+// check and the insert happen under one lock so two logins can't both pass.
+int add_client(Client* cl) {
+    int rc = -2;
+    pthread_mutex_lock(&clients_mutex);
+    if (username_exists(cl->username)) {
+        rc = -1;
+    } else {
+        for (int i = 0; i < MAX_CLIENTS; ++i) {
+            if (!clients[i]) {
+                clients[i] = cl;
+                cl->slot = i;
+                shard_attach(i, cl->sockfd);
+                presence_online(cl);
+                client_count++;
+                rc = 0;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&clients_mutex);
+    return rc;
 }
 
 void remove_client(int sockfd) {
     pthread_mutex_lock(&clients_mutex);
     for (int i = 0; i < MAX_CLIENTS; ++i) {
         if (clients[i] && clients[i]->sockfd == sockfd) {
+            char names[MAX_JOINED_ROOMS][MAX_ROOMNAME];
+            int nrooms = room_list(clients[i], names, MAX_JOINED_ROOMS);
+            for (int r = 0; r < nrooms; r++) room_leave(clients[i], names[r]);
+            presence_offline(clients[i]);
+
             char logbuf[128];
             snprintf(logbuf, sizeof(logbuf), "[DISCONNECT] %s disconnected.", clients[i]->username);
             log_event(logbuf);
+            journal_event(JEV_LOGOUT, clients[i]->username, NULL, 0);
+            shard_detach(i);
             close(clients[i]->sockfd);
-            free(clients[i]);
+            client_free(clients[i]);
             clients[i] = NULL;
             client_count--;
             break;
@@ -152,46 +223,175 @@ void remove_client(int sockfd) {
     pthread_mutex_unlock(&clients_mutex);
 }
 
+// Room traffic is handed to the writer shards; the sender's own thread
+// only copies the message once
 void broadcast_room(const char* room, const char* message, const char* sender) {
+    pthread_mutex_lock(&clients_mutex);
+    trace_point(TRACE_LOCK);
+    Room* r = room_find(room);
+    if (r) {
+        int skip = -1;
+        for (int w = 0; w < ROOM_MEMBER_WORDS && skip < 0; w++) {
+            uint64_t bits = r->members[w];
+            while (bits) {
+                Client* c = clients[w * 64 + __builtin_ctzll(bits)];
+                bits &= bits - 1;
+                if (c && strcmp(c->username, sender) == 0) {
+                    skip = c->slot;
+                    break;
+                }
+            }
+        }
+        r->posts++;
+        trace_point(TRACE_FANOUT_START);
+        shard_broadcast(r->members, skip, message, strlen(message));
+        trace_point(TRACE_FANOUT_END);
+    }
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+// Sequence, store and deliver a room message. Runs on the node owning the room.
+void room_post(const char* room, const char* sender, const char* msg) {
+    size_t mark = arena_mark();
+    size_t body_len, len;
+    char* body = arena_printf(&body_len, "[%s]: %s\n", sender, msg);
+    if (!body) return;
+
+    // Persist first so the message carries its room sequence number
+    unsigned long long seq = msglog_append(room, body, body_len);
+    char* fullmsg = seq > 0 ? arena_printf(&len, "[#%llu] %s", seq, body) : NULL;
+    if (!fullmsg) {
+        fullmsg = body;
+        len = body_len;
+    }
+    broadcast_room(room, fullmsg, sender);
+    history_append(room, fullmsg, len);
+    search_submit(room, sender, msg);
+    peer_fanout(room, sender, fullmsg, len);
+    arena_rewind(mark);
+}
+
+// A message sequenced by the room's owner on another node
+void room_deliver_remote(const char* room, const char* sender, const char* fullmsg) {
+    broadcast_room(room, fullmsg, sender);
+    history_append(room, fullmsg, strlen(fullmsg));
+}
+
+// Tell a user something if they are online; nothing is stored otherwise
+static void notify_online(const char* name, const char* message) {
     pthread_mutex_lock(&clients_mutex);
     for (int i = 0; i < MAX_CLIENTS; ++i) {
-        if (clients[i] && strcmp(clients[i]->room, room) == 0 &&
-            strcmp(clients[i]->username, sender) != 0) {
-            send(clients[i]->sockfd, message, strlen(message), 0);
+        if (clients[i] && strcmp(clients[i]->username, name) == 0) {
+            shard_post(i, message, strlen(message));
+            break;
         }
     }
     pthread_mutex_unlock(&clients_mutex);
 }
 
-void send_private(const char* target, const char* message, const char* sender) {
+// Deliver to an online user, otherwise store in their mailbox. Returns 1 if
+// delivered, 0 if stored for the next login, MAILBOX_UNKNOWN if no such user
+// ever logged in, -1 if it could not be stored.
+int send_private(const char* target, const char* message, const char* sender) {
     (void)sender;
     pthread_mutex_lock(&clients_mutex);
     for (int i = 0; i < MAX_CLIENTS; ++i) {
         if (clients[i] && strcmp(clients[i]->username, target) == 0) {
-            send(clients[i]->sockfd, message, strlen(message), 0);
+            shard_post(i, message, strlen(message));
             pthread_mutex_unlock(&clients_mutex);
-            return;
+            return 1;
         }
     }
+
+    // Still holding clients_mutex, so the user can't log in between the
+    // check above and the store
+    int rc = MAILBOX_UNKNOWN;
+    if (valid_username(target)) {
+        char stored[BUFFER_SIZE + 16];
+        time_t now = time(NULL);
+        struct tm tm_now;
+        localtime_r(&now, &tm_now);
+        snprintf(stored, sizeof(stored), "[%02d:%02d] %s", tm_now.tm_hour, tm_now.tm_min, message);
+        rc = mailbox_put(target, stored, strlen(stored));
+    }
     pthread_mutex_unlock(&clients_mutex);
+    return rc;
 }
 
-// Calculate estimated wait time based on queue position and active uploads
-int calculate_wait_time(int queue_position) {
-    // Estimate 3 seconds per file (2s processing + 1s overhead)
-    int files_ahead = queue_position + active_uploads - MAX_CONCURRENT_UPLOADS;
-    if (files_ahead <= 0) return 0;
-    
-    // Each slot processes files, so divide by concurrent slots
-    return (files_ahead * 3) / MAX_CONCURRENT_UPLOADS;
+// Queue a received file for processing. Returns 0, or -1 if the queue is full.
+int enqueue_upload(FileTransfer* ft) {
+    return pipeline_submit(upload_pipeline, ft);
+}
+
+// /rooms output, built with bounds checks: one line per active room
+typedef struct {
+    const Client* cli;
+    char out[BUFFER_SIZE];
+    size_t len;
+    int count;
+} RoomsReply;
+
+static int append_room_line(Room* room, void* arg) {
+    RoomsReply* reply = arg;
+    const char* mark = strcmp(reply->cli->room, room->name) == 0 ? ">" :
+                       room_is_member(reply->cli, room->name) ? "*" : " ";
+    int w = snprintf(reply->out + reply->len, sizeof(reply->out) - reply->len,
+                     " %s %s (%d)\n", mark, room->name, room->count);
+    if (w < 0 || reply->len + w + 6 >= sizeof(reply->out)) {
+        reply->len += snprintf(reply->out + reply->len, sizeof(reply->out) - reply->len, " ...\n");
+        return 1;
+    }
+    reply->len += w;
+    reply->count++;
+    return 0;
+}
+
+// Commands are newline-framed, so a client can pipeline several in one
+// write. Bytes past the first newline wait in pending for the next call;
+// a line that fills the buffer without one is taken as it is. Returns the
+// bytes consumed, or <= 0 once the connection is gone.
+static int next_command(int fd, char* pending, size_t* pending_len, char* line, size_t size) {
+    while (1) {
+        char* nl = memchr(pending, '\n', *pending_len);
+        if (nl || *pending_len == size - 1) {
+            size_t n = nl ? (size_t)(nl - pending) : *pending_len;
+            size_t used = nl ? n + 1 : n;
+            memcpy(line, pending, n);
+            line[n] = '\0';
+            *pending_len -= used;
+            memmove(pending, pending + used, *pending_len);
+            return used;
+        }
+        int bytes = recv(fd, pending + *pending_len, size - 1 - *pending_len, 0);
+        if (bytes <= 0) return bytes;
+        *pending_len += bytes;
+    }
+}
+
+// Skip the body of a /sendfile that won't be stored, so its bytes are not
+// read as commands. Returns 0, or -1 once the connection is gone.
+static int discard_body(int fd, char* pending, size_t* pending_len, long size) {
+    long n = (long)*pending_len < size ? (long)*pending_len : size;
+    *pending_len -= n;
+    memmove(pending, pending + n, *pending_len);
+    size -= n;
+
+    char sink[BUFFER_SIZE];
+    while (size > 0) {
+        ssize_t got = recv(fd, sink, size < (long)sizeof(sink) ? size : (long)sizeof(sink), 0);
+        if (got <= 0) return -1;
+        size -= got;
+    }
+    return 0;
 }
 
 void* handle_client(void* arg) {
     char buffer[BUFFER_SIZE];
+    char unread[BUFFER_SIZE];
+    size_t unread_len = 0;
     Client* cli = (Client*)arg;
     char username_copy[MAX_USERNAME];
-    
-    add_client(cli);
+    int sync_credit = 0;                // The last command earned a free /sync
 
     pthread_mutex_lock(&clients_mutex);
     strncpy(username_copy, cli->username, MAX_USERNAME - 1);
@@ -201,93 +401,299 @@ void* handle_client(void* arg) {
     char logbuf[512];
     snprintf(logbuf, sizeof(logbuf), "[LOGIN] user '%s' connected", username_copy);
     log_event(logbuf);
+    journal_event(JEV_LOGIN, username_copy, NULL, 0);
+
+    mailbox_register(username_copy);
+    int pending = mailbox_deliver(cli->slot, username_copy);
+    if (pending > 0) {
+        snprintf(logbuf, sizeof(logbuf), "[MAILBOX] delivered %d stored message(s) to '%s'", pending, username_copy);
+        log_event(logbuf);
+    }
 
     while (1) {
         memset(buffer, 0, BUFFER_SIZE);
-        int bytes = recv(cli->sockfd, buffer, BUFFER_SIZE - 1, 0);
+        int bytes = next_command(cli->sockfd, unread, &unread_len, buffer, BUFFER_SIZE);
         if (bytes <= 0) break;
+        trace_recv();
+        trace_end();
+        arena_reset();
 
         buffer[strcspn(buffer, "\n")] = 0;
 
         char* cmd = strtok(buffer, " \n");
+        if (!cmd) continue;
+
+        // Control commands always pass; everything else spends a token.
+        // One /sync after each other command is free, since pipelining
+        // clients follow every request with one; more than that pay.
+        int is_sync = strcmp(cmd, "/sync") == 0;
+        int free_cmd = strcmp(cmd, "/exit") == 0 || strcmp(cmd, "/leave") == 0 || (is_sync && sync_credit);
+        sync_credit = !is_sync;
+        if (!free_cmd && !ratelimit_user(&cli->bucket)) {
+            shard_send(cli->slot, "[ERROR] Rate limit exceeded, slow down.\n", 40);
+            continue;
+        }
+
         if (strncmp(cmd, "/join", 5) == 0) {
             char* room_name = strtok(NULL, " \n");
-            if (room_name) {
-                char old_room[ROOM_NAME_LEN];
+            char* seq_arg = strtok(NULL, " \n");  // Last seen seq when reconnecting
+            if (room_name && !valid_room(room_name)) {
+                // Room names end up in file paths and peer frames
+                shard_send(cli->slot, "[ERROR] Invalid room name.\n", 27);
+            } else if (room_name) {
+                // Joining adds a room; the others are kept. The new one
+                // becomes the current room.
                 pthread_mutex_lock(&clients_mutex);
-                strncpy(old_room, cli->room, ROOM_NAME_LEN);
-
-                if (strcmp(old_room, room_name) != 0) {
-                    if (strlen(old_room) > 0) {
-                        leave_room(cli);
-                    }
-
-                    strncpy(cli->room, room_name, ROOM_NAME_LEN);
+                int joined;
+                if (!room_is_member(cli, room_name) && room_joined_count(cli) >= MAX_JOINED_ROOMS) {
+                    joined = -2;
+                } else {
+                    joined = room_join(cli, room_name);
+                }
+                if (joined >= 0) {
+                    strncpy(cli->room, room_name, MAX_ROOMNAME - 1);
+                    cli->room[MAX_ROOMNAME - 1] = '\0';
+                }
+                pthread_mutex_unlock(&clients_mutex);
 
-                    char logbuf[BUFFER_SIZE];
+                if (joined == -2) {
+                    shard_send(cli->slot, "[ERROR] Too many rooms, /leave one first.\n", 42);
+                    continue;
+                } else if (joined < 0) {
+                    shard_send(cli->slot, "[ERROR] Room table full.\n", 25);
+                    continue;
+                } else if (joined == 1) {
                     snprintf(logbuf, sizeof(logbuf),
-                        "[ROOM] user '%s' joined room '%s'", cli->username, cli->room);
+                        "[ROOM] user '%s' joined room '%s'", username_copy, room_name);
                     log_event(logbuf);
+                    journal_event(JEV_JOIN, username_copy, room_name, 0);
+                    peer_room_update(room_name);
                 }
-                pthread_mutex_unlock(&clients_mutex);
 
-                char msg[BUFFER_SIZE];
-                snprintf(msg, sizeof(msg), "[INFO] You joined room '%s'\n", cli->room);
-                send(cli->sockfd, msg, strlen(msg), 0);
+                // The log is on the room's owner; when that is another node,
+                // its last seq and the missed messages come from there
+                PeerLog remote;
+                unsigned long long after = seq_arg ? strtoull(seq_arg, NULL, 10) : ULLONG_MAX;
+                int fetched = peer_fetch_log(room_name, after, &remote) > 0;
+
+                size_t len;
+                char* msg = arena_printf(&len, "[INFO] You joined room '%s' (seq %llu)\n", room_name,
+                                         fetched ? remote.last_seq : msglog_last_seq(room_name));
+                if (msg) shard_send(cli->slot, msg, len);
+
+                // Delta resync: only what was posted after the client's last seen seq
+                if (seq_arg) {
+                    long missed;
+                    if (fetched) {
+                        missed = shard_send(cli->slot, remote.text, remote.len) < 0 ? -1 : remote.count;
+                    } else {
+                        missed = msglog_replay(cli->slot, room_name, after);
+                    }
+                    msg = arena_printf(&len, "[INFO] Resynced %ld missed message(s).\n", missed < 0 ? 0 : missed);
+                    if (msg) shard_send(cli->slot, msg, len);
+                }
+                peer_log_free(&remote);
             } else {
-                send(cli->sockfd, "[ERROR] Usage: /join <roomname>\n", 33, 0);
+                shard_send(cli->slot, "[ERROR] Usage: /join <roomname> [last_seq]\n", 43);
             }
         }
 
         else if (strncmp(buffer, "/rooms", 6) == 0) {
+            RoomsReply reply = { cli, {0}, 0, 0 };
+            reply.len = snprintf(reply.out, sizeof(reply.out), "[ROOMS] Available rooms (* joined, > current):\n");
             pthread_mutex_lock(&clients_mutex);
-            char rooms_list[BUFFER_SIZE] = "[ROOMS] Available rooms:\n";
-            for (int i = 0; i < MAX_CLIENTS; i++) {
-                if (clients[i] && strlen(clients[i]->room) > 0) {
-                    strcat(rooms_list, clients[i]->room);
-                    strcat(rooms_list, "\n");
-                }
+            room_foreach(append_room_line, &reply);
+            pthread_mutex_unlock(&clients_mutex);
+            if (reply.count == 0) {
+                reply.len = snprintf(reply.out, sizeof(reply.out), "[ROOMS] No active rooms.\n");
+            }
+            shard_send(cli->slot, reply.out, reply.len);
+        }
+
+        else if (strcmp(cmd, "/who") == 0) {
+            char* room_arg = strtok(NULL, " \n");
+            if (room_arg && room_arg[0] == '#') room_arg++;
+            size_t len = 0;
+            pthread_mutex_lock(&clients_mutex);
+            char* reply = presence_who(room_arg, &len);
+            pthread_mutex_unlock(&clients_mutex);
+            if (!reply) {
+                shard_send(cli->slot, "[ERROR] No such room.\n", 22);
+                continue;
             }
+            shard_send(cli->slot, reply, len);
+        }
+
+        else if (strcmp(cmd, "/away") == 0 || strcmp(cmd, "/back") == 0) {
+            int away = strcmp(cmd, "/away") == 0;
+            pthread_mutex_lock(&clients_mutex);
+            presence_set_away(cli, away);
             pthread_mutex_unlock(&clients_mutex);
-            send(cli->sockfd, rooms_list, strlen(rooms_list), 0);
+            if (away) shard_send(cli->slot, "[INFO] You are now away.\n", 25);
+            else shard_send(cli->slot, "[INFO] Welcome back.\n", 21);
+        }
+
+        else if (strcmp(cmd, "/presence") == 0) {
+            char* arg = strtok(NULL, " \n");
+            if (!arg || (strcmp(arg, "on") != 0 && strcmp(arg, "off") != 0)) {
+                shard_send(cli->slot, "[ERROR] Usage: /presence on|off\n", 32);
+                continue;
+            }
+            int on = strcmp(arg, "on") == 0;
+            pthread_mutex_lock(&clients_mutex);
+            presence_subscribe(cli, on);
+            pthread_mutex_unlock(&clients_mutex);
+            if (on) shard_send(cli->slot, "[INFO] Presence updates on.\n", 28);
+            else shard_send(cli->slot, "[INFO] Presence updates off.\n", 29);
         }
 
         else if (strncmp(buffer, "/leave", 6) == 0) {
+            char* room_arg = strtok(NULL, " \n");
+            if (room_arg && room_arg[0] == '#') room_arg++;
+
             pthread_mutex_lock(&clients_mutex);
-            char old_room[ROOM_NAME_LEN];
-            strncpy(old_room, cli->room, ROOM_NAME_LEN);
-            cli->room[0] = '\0';
+            char old_room[MAX_ROOMNAME];
+            strncpy(old_room, room_arg ? room_arg : cli->room, MAX_ROOMNAME - 1);
+            old_room[MAX_ROOMNAME - 1] = '\0';
+            int left = old_room[0] != '\0' && room_leave(cli, old_room);
+            if (left && strcmp(cli->room, old_room) == 0) {
+                // Fall back to one of the rooms still joined
+                char next[1][MAX_ROOMNAME];
+                cli->room[0] = '\0';
+                if (room_list(cli, next, 1) == 1) strcpy(cli->room, next[0]);
+            }
             pthread_mutex_unlock(&clients_mutex);
 
-            send(cli->sockfd, "[INFO] Left room.\n", 19, 0);
+            if (!left) {
+                shard_send(cli->slot, "[ERROR] Not in that room.\n", 26);
+                continue;
+            }
+            size_t len;
+            char* msg = arena_printf(&len, "[INFO] Left room '%s'.\n", old_room);
+            if (msg) shard_send(cli->slot, msg, len);
+            peer_room_update(old_room);
 
-            char logbuf[BUFFER_SIZE];
             snprintf(logbuf, sizeof(logbuf),
                 "[ROOM] user '%s' left room '%s'",
                 cli->username, old_room);
             log_event(logbuf);
+            journal_event(JEV_LEAVE, username_copy, old_room, 0);
         }
 
         else if (strncmp(buffer, "/broadcast ", 10) == 0) {
+            trace_sample();
+            if (!overload_admit(LOAD_BROADCAST)) {
+                shard_send(cli->slot, "[ERROR] Server busy, message dropped.\n", 38);
+                continue;
+            }
+
+            // "/broadcast #room msg" picks one of the joined rooms,
+            // otherwise the current room is used
+            char* msg = buffer + 11;
+            char room_copy[MAX_ROOMNAME] = "";
+            if (msg[0] == '#') {
+                size_t n = strcspn(msg + 1, " ");
+                if (n == 0 || n >= MAX_ROOMNAME || msg[1 + n] != ' ') {
+                    shard_send(cli->slot, "[ERROR] Usage: /broadcast [#room] <msg>\n", 40);
+                    continue;
+                }
+                memcpy(room_copy, msg + 1, n);
+                room_copy[n] = '\0';
+                msg += n + 2;
+            }
+
             pthread_mutex_lock(&clients_mutex);
-            if (strlen(cli->room) == 0) {
-                pthread_mutex_unlock(&clients_mutex);
-                send(cli->sockfd, "[ERROR] Not in a room.\n", 24, 0);
+            if (room_copy[0] == '\0') {
+                strncpy(room_copy, cli->room, MAX_ROOMNAME - 1);
+                room_copy[MAX_ROOMNAME - 1] = '\0';
+            }
+            int member = room_copy[0] != '\0' && room_is_member(cli, room_copy);
+            pthread_mutex_unlock(&clients_mutex);
+
+            if (!member) {
+                shard_send(cli->slot, "[ERROR] Not in a room.\n", 23);
+                continue;
+            }
+
+            FilterAction verdict = filter_apply(room_copy, msg);
+            if (verdict == FILTER_DROP) {
+                shard_send(cli->slot, "[ERROR] Message blocked by the content filter.\n", 47);
+                snprintf(logbuf, sizeof(logbuf), "[FILTER] dropped message from '%s' in '%s'", username_copy, room_copy);
+                log_event(logbuf);
+                journal_event(JEV_FILTER, username_copy, room_copy, verdict);
                 continue;
+            } else if (verdict == FILTER_FLAG) {
+                snprintf(logbuf, sizeof(logbuf), "[FILTER] flagged message from '%s' in '%s': %s", username_copy, room_copy, msg);
+                log_event(logbuf);
+                journal_event(JEV_FILTER, username_copy, room_copy, verdict);
             }
-            
+
+            if (!ratelimit_room(room_copy)) {
+                shard_send(cli->slot, "[ERROR] Room is busy, message not sent.\n", 40);
+                continue;
+            }
+
+            // Posting locally while the owner is down would fork the seq numbers
+            int forwarded = peer_forward_post(room_copy, username_copy, msg);
+            if (forwarded < 0) {
+                shard_send(cli->slot, "[ERROR] Room owner is unreachable, message not sent.\n", 53);
+                continue;
+            } else if (forwarded == 0) {
+                room_post(room_copy, username_copy, msg);
+            }
+
+            snprintf(logbuf, sizeof(logbuf), "[BROADCAST] %s: %s", username_copy, msg);
+            log_event(logbuf);
+            journal_event(JEV_BROADCAST, username_copy, room_copy, strlen(msg));
+        }
+
+        else if (strcmp(cmd, "/history") == 0) {
+            char* count_arg = strtok(NULL, " \n");
+            int count = count_arg ? atoi(count_arg) : HISTORY_DEFAULT_REPLAY;
+            if (count <= 0) {
+                shard_send(cli->slot, "[ERROR] Usage: /history [n]\n", 28);
+                continue;
+            }
+
+            pthread_mutex_lock(&clients_mutex);
             char room_copy[MAX_ROOMNAME];
             strncpy(room_copy, cli->room, MAX_ROOMNAME - 1);
             room_copy[MAX_ROOMNAME - 1] = '\0';
             pthread_mutex_unlock(&clients_mutex);
 
-            char* msg = buffer + 11;
-            char fullmsg[BUFFER_SIZE];
-            snprintf(fullmsg, sizeof(fullmsg), "[%s]: %s\n", username_copy, msg);
-            broadcast_room(room_copy, fullmsg, username_copy);
+            if (strlen(room_copy) == 0) {
+                shard_send(cli->slot, "[ERROR] Not in a room.\n", 23);
+                continue;
+            }
 
-            snprintf(logbuf, sizeof(logbuf), "[BROADCAST] %s: %s", username_copy, msg);
-            log_event(logbuf);
+            if (history_replay(cli->slot, room_copy, count) == 0) {
+                shard_send(cli->slot, "[INFO] No history for this room.\n", 33);
+            }
+        }
+
+        else if (strcmp(cmd, "/search") == 0) {
+            char* room_name = strtok(NULL, " \n");
+            char* terms = strtok(NULL, "\n");
+            if (!room_name || !terms) {
+                shard_send(cli->slot, "[ERROR] Usage: /search <room> <terms>\n", 38);
+                continue;
+            }
+            if (!valid_room(room_name)) {
+                shard_send(cli->slot, "[ERROR] Invalid room name.\n", 27);
+                continue;
+            }
+
+            // Same rule as /history: only members read a room
+            pthread_mutex_lock(&clients_mutex);
+            int member = room_is_member(cli, room_name);
+            pthread_mutex_unlock(&clients_mutex);
+            if (!member) {
+                shard_send(cli->slot, "[ERROR] Join the room to search it.\n", 36);
+                continue;
+            }
+            if (search_query(cli->slot, room_name, terms) < 0) {
+                shard_send(cli->slot, "[ERROR] Search failed.\n", 23);
+            }
         }
 
         else if (strncmp(buffer, "/whisper ", 8) == 0) {
@@ -296,132 +702,215 @@ void* handle_client(void* arg) {
             char* msg = strtok(NULL, "\0");
 
             if (!target || !msg) {
-                send(cli->sockfd, "[ERROR] Usage: /whisper <user> <msg>\n", 39, 0);
+                shard_send(cli->slot, "[ERROR] Usage: /whisper <user> <msg>\n", 37);
                 continue;
             }
 
-            char fullmsg[BUFFER_SIZE];
-            snprintf(fullmsg, sizeof(fullmsg), "[WHISPER %s]: %s\n", username_copy, msg);
-            send_private(target, fullmsg, username_copy);
+            FilterAction verdict = filter_apply(NULL, msg);
+            if (verdict == FILTER_DROP) {
+                shard_send(cli->slot, "[ERROR] Message blocked by the content filter.\n", 47);
+                snprintf(logbuf, sizeof(logbuf), "[FILTER] dropped whisper from '%s' to '%s'", username_copy, target);
+                log_event(logbuf);
+                journal_event(JEV_FILTER, username_copy, target, verdict);
+                continue;
+            } else if (verdict == FILTER_FLAG) {
+                snprintf(logbuf, sizeof(logbuf), "[FILTER] flagged whisper from '%s' to '%s': %s", username_copy, target, msg);
+                log_event(logbuf);
+                journal_event(JEV_FILTER, username_copy, target, verdict);
+            }
+
+            char* fullmsg = arena_printf(NULL, "[WHISPER %s]: %s\n", username_copy, msg);
+            if (!fullmsg) continue;
+            int delivered = send_private(target, fullmsg, username_copy);
+            if (delivered == 0) {
+                char info[128];
+                snprintf(info, sizeof(info), "[INFO] '%s' is offline; message will be delivered at login.\n", target);
+                shard_send(cli->slot, info, strlen(info));
+            } else if (delivered == MAILBOX_UNKNOWN) {
+                shard_send(cli->slot, "[ERROR] No such user.\n", 22);
+                continue;
+            } else if (delivered < 0) {
+                shard_send(cli->slot, "[ERROR] Receiver's mailbox is full.\n", 36);
+                continue;
+            }
 
             snprintf(logbuf, sizeof(logbuf), "[WHISPER] %s -> %s: %s", username_copy, target, msg);
             log_event(logbuf);
+            journal_event(JEV_WHISPER, username_copy, target, strlen(msg));
         }
 
         else if (strncmp(buffer, "/sendfile ", 9) == 0) {
             char filename[256];
             long filesize;
-            char receiver[MAX_USERNAME];
+            char receiver[MAX_RECEIVER];
+
+            if (sscanf(buffer + 10, "%255s %ld %33s", filename, &filesize, receiver) != 3) {
+                shard_send(cli->slot, "[ERROR] Usage: /sendfile <file> <size> <receiver|#room>\n", 56);
+                continue;
+            }
+            if (filesize < 0) {
+                shard_send(cli->slot, "[ERROR] Bad file size.\n", 23);
+                continue;
+            }
 
-            if (sscanf(buffer + 10, "%s %ld %s", filename, &filesize, receiver) != 3) {
-                send(cli->sockfd, "[ERROR] Usage: /sendfile <file> <size> <receiver>\n", 51, 0);
+            // From here on the body follows the command whatever the
+            // answer, so every refusal skips it
+            if (!overload_admit(LOAD_UPLOAD)) {
+                shard_send(cli->slot, "[ERROR] Server busy, try the upload later.\n", 43);
+                if (discard_body(cli->sockfd, unread, &unread_len, filesize) < 0) break;
                 continue;
             }
 
             if (filesize > MAX_FILE_SIZE) {
-                send(cli->sockfd, "[ERROR] File too large (max 3MB).\n", 36, 0);
+                shard_send(cli->slot, "[ERROR] File too large (max 3MB).\n", 34);
+                if (discard_body(cli->sockfd, unread, &unread_len, filesize) < 0) break;
                 continue;
             }
 
-            // Check if receiver exists
-            if (!get_client_by_name(receiver)) {
-                send(cli->sockfd, "[ERROR] Receiver not found or offline.\n", 41, 0);
+            // Offline receivers are fine, they get the notice in their mailbox
+            if (!valid_receiver(username_copy, receiver)) {
+                shard_send(cli->slot, "[ERROR] Invalid receiver (a user, or #room you are in).\n", 56);
+                if (discard_body(cli->sockfd, unread, &unread_len, filesize) < 0) break;
                 continue;
             }
 
-            FileTransfer* new_transfer = malloc(sizeof(FileTransfer));
+            FileTransfer* new_transfer = file_transfer_alloc();
             if (!new_transfer) {
-                send(cli->sockfd, "[ERROR] Server memory allocation failed.\n", 43, 0);
+                shard_send(cli->slot, "[ERROR] Server memory allocation failed.\n", 41);
+                if (discard_body(cli->sockfd, unread, &unread_len, filesize) < 0) break;
                 continue;
             }
 
             strncpy(new_transfer->sender, username_copy, MAX_USERNAME - 1);
             new_transfer->sender[MAX_USERNAME - 1] = '\0';
-            strncpy(new_transfer->receiver, receiver, MAX_USERNAME - 1);
-            new_transfer->receiver[MAX_USERNAME - 1] = '\0';
+            strncpy(new_transfer->receiver, receiver, MAX_RECEIVER - 1);
+            new_transfer->receiver[MAX_RECEIVER - 1] = '\0';
             strncpy(new_transfer->filename, filename, 255);
             new_transfer->filename[255] = '\0';
             new_transfer->filesize = filesize;
             new_transfer->filedata = malloc(filesize);
 
             if (!new_transfer->filedata) {
-                send(cli->sockfd, "[ERROR] File buffer allocation failed.\n", 41, 0);
-                free(new_transfer);
-                continue;
-            }
-
-            FILE* f = fopen("received_file_server_side.txt", "wb");
-            if (!f) {
-                send(cli->sockfd, "[ERROR] Cannot save file on server.\n", 38, 0);
-                free(new_transfer->filedata);
-                free(new_transfer);
+                shard_send(cli->slot, "[ERROR] File buffer allocation failed.\n", 39);
+                file_transfer_free(new_transfer);
+                if (discard_body(cli->sockfd, unread, &unread_len, filesize) < 0) break;
                 continue;
             }
 
-            char filebuf[BUFFER_SIZE];
-            long received = 0;
+            // The body may have come in with the command. It is hashed
+            // as it arrives; the store is keyed by content.
+            long received = (long)unread_len < filesize ? (long)unread_len : filesize;
+            memcpy(new_transfer->filedata, unread, received);
+            sha256_init(&new_transfer->sha);
+            sha256_update(&new_transfer->sha, new_transfer->filedata, received);
+            unread_len -= received;
+            memmove(unread, unread + received, unread_len);
             while (received < filesize) {
-                ssize_t n = recv(cli->sockfd, filebuf, sizeof(filebuf), 0);
+                ssize_t n = recv(cli->sockfd, new_transfer->filedata + received, filesize - received, 0);
                 if (n <= 0) {
                     break;
                 }
-                fwrite(filebuf, 1, n, f);
-                memcpy(new_transfer->filedata + received, filebuf, n);
+                sha256_update(&new_transfer->sha, new_transfer->filedata + received, n);
                 received += n;
             }
-            fclose(f);
+            new_transfer->enqueued_time = time(NULL);
 
             if (received < filesize) {
-                send(cli->sockfd, "[ERROR] Incomplete file received.\n", 36, 0);
+                shard_send(cli->slot, "[ERROR] Incomplete file received.\n", 34);
                 free(new_transfer->filedata);
-                free(new_transfer);
+                file_transfer_free(new_transfer);
                 continue;
             }
 
-            pthread_mutex_lock(&file_queue_mutex);
-            if (upload_size < MAX_UPLOAD_QUEUE) {
-                upload_queue[upload_rear] = new_transfer;
-                upload_rear = (upload_rear + 1) % MAX_UPLOAD_QUEUE;
-                upload_size++;
-                pthread_mutex_unlock(&file_queue_mutex);
-                sem_post(&upload_slots);
-                send(cli->sockfd, "[INFO] File sent successfully.\n", 34, 0);
+            if (enqueue_upload(new_transfer) == 0) {
+                shard_send(cli->slot, "[INFO] File sent successfully.\n", 31);
             } else {
-                pthread_mutex_unlock(&file_queue_mutex);
-                send(cli->sockfd, "[ERROR] Upload queue full.\n", 29, 0);
+                shard_send(cli->slot, "[ERROR] Upload queue full.\n", 27);
                 free(new_transfer->filedata);
-                free(new_transfer);
+                file_transfer_free(new_transfer);
             }
         }
 
 
+        else if (strncmp(buffer, "/stats", 6) == 0) {
+            pipeline_report(upload_pipeline, cli->slot);
+            overload_report(cli->slot);
+            ratelimit_report(cli->slot);
+            shard_report(cli->slot);
+            filter_report(cli->slot);
+            memory_report(cli->slot);
+        }
+
+        // Marks the end of a pipelined request's replies: commands are
+        // handled in order, so everything before it has been sent
+        else if (strcmp(cmd, "/sync") == 0) {
+            char* tag = strtok(NULL, " \n");
+            size_t len;
+            char* msg = arena_printf(&len, "[SYNC] %.32s\n", tag ? tag : "");
+            if (msg) shard_send(cli->slot, msg, len);
+        }
+
+        else if (strcmp(cmd, "/trace") == 0) {
+            long spans = trace_dump();
+            if (spans < 0) {
+                shard_send(cli->slot, "[ERROR] Could not write the trace.\n", 35);
+                continue;
+            }
+            size_t len;
+            char* msg = arena_printf(&len, "[INFO] Wrote %ld span(s) to %s.\n", spans, trace_file());
+            if (msg) shard_send(cli->slot, msg, len);
+        }
+
+        else if (strncmp(buffer, "/files", 6) == 0) {
+            char* room_arg = strtok(NULL, " \n");
+            if (!room_arg) {
+                filestore_list(cli->slot, username_copy);
+            } else if (room_arg[0] == '#' && client_in_room(username_copy, room_arg + 1)) {
+                filestore_list(cli->slot, room_arg);
+            } else {
+                shard_send(cli->slot, "[ERROR] Join the room to see its files.\n", 40);
+            }
+        }
+
+        else if (strncmp(buffer, "/rmfile", 7) == 0) {
+            char* id_arg = strtok(NULL, " \n");
+            if (!id_arg) {
+                shard_send(cli->slot, "[ERROR] Usage: /rmfile <id>\n", 28);
+            } else if (filestore_remove(atol(id_arg), username_copy) < 0) {
+                shard_send(cli->slot, "[ERROR] No such file.\n", 22);
+            } else {
+                shard_send(cli->slot, "[INFO] File removed.\n", 21);
+            }
+        }
+
         else if (strncmp(buffer, "/exit", 5) == 0) {
             break;
         }
 
         else {
-            send(cli->sockfd, "[ERROR] Unknown command.\n", 26, 0);
+            shard_send(cli->slot, "[ERROR] Unknown command.\n", 25);
         }
     }
 
     snprintf(logbuf, sizeof(logbuf), "[DISCONNECT] %s disconnected.", username_copy);
     log_event(logbuf);
 
+    char last_rooms[MAX_JOINED_ROOMS][MAX_ROOMNAME];
+    pthread_mutex_lock(&clients_mutex);
+    int nrooms = room_list(cli, last_rooms, MAX_JOINED_ROOMS);
+    pthread_mutex_unlock(&clients_mutex);
+
     int sockfd = cli->sockfd;
     remove_client(sockfd);
-    
-    pthread_detach(pthread_self());
+    for (int i = 0; i < nrooms; i++) {
+        peer_room_update(last_rooms[i]);
+    }
     return NULL;
 }
 
 int room_user_count(const char* room_name) {
-    int count = 0;
     pthread_mutex_lock(&clients_mutex);
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i] && strcmp(clients[i]->room, room_name) == 0) {
-            count++;
-        }
-    }
+    int count = room_member_count(room_name);
     pthread_mutex_unlock(&clients_mutex);
     return count;
 }
@@ -438,127 +927,130 @@ Client* get_client_by_name(const char* name) {
     return NULL;
 }
 
-void* handle_file_queue(void* arg) {
-    (void)arg;
-    while (1) {
-        sem_wait(&upload_slots);        // Wait for a file to be available
-        sem_wait(&processing_slots);    // Wait for a processing slot
-
-        pthread_mutex_lock(&file_queue_mutex);
-        if (upload_size == 0) {
-            pthread_mutex_unlock(&file_queue_mutex);
-            sem_post(&processing_slots);  // Release the processing slot
-            continue;
-        }
-
-        FileTransfer* file = upload_queue[upload_front];
-        upload_queue[upload_front] = NULL;
-        upload_front = (upload_front + 1) % MAX_UPLOAD_QUEUE;
-        upload_size--;
-        active_uploads++;
-        pthread_mutex_unlock(&file_queue_mutex);
+// Pipeline stages for uploaded files. Each returns 0 to pass the file on,
+// -1 to stop it; release_upload() frees it either way.
+static int stage_validate(void* item) {
+    FileTransfer* file = item;
+    int ok = file->filedata && file->filesize > 0 && file->filesize <= MAX_FILE_SIZE &&
+             (file->receiver[0] == '#' ? valid_room(file->receiver + 1) : valid_username(file->receiver));
+    if (!ok) {
+        char logbuf[512];
+        snprintf(logbuf, sizeof(logbuf), "[ERROR] Rejected upload '%s' from %s", file->filename, file->sender);
+        log_event(logbuf);
+        return -1;
+    }
 
-        if (!file) {
-            pthread_mutex_lock(&file_queue_mutex);
-            active_uploads--;
-            pthread_mutex_unlock(&file_queue_mutex);
-            sem_post(&processing_slots);
-            continue;
-        }
+    time_t now = time(NULL);
+    int wait_seconds = (int)difftime(now, file->enqueued_time);
+
+    // Notify sender that processing started
+    char msg[256];
+    snprintf(msg, sizeof(msg),
+        "[INFO] Processing file '%.50s' started (waited %d seconds).\n",
+        file->filename, wait_seconds);
+    notify_online(file->sender, msg);
+
+    // Log processing start
+    char start_logbuf[512];
+    snprintf(start_logbuf, sizeof(start_logbuf),
+        "[FILE-PROCESS] Starting upload of '%s' from %s to %s",
+        file->filename, file->sender, file->receiver);
+    log_event(start_logbuf);
+    return 0;
+}
 
-        time_t now = time(NULL);
-        int wait_seconds = (int)difftime(now, file->enqueued_time);
-
-        // Notify sender that processing started
-        Client* sender = get_client_by_name(file->sender);
-        if (sender) {
-            char msg[256];
-            snprintf(msg, sizeof(msg),
-                "[INFO] Processing file '%.50s' started (waited %d seconds).\n",
-                file->filename, wait_seconds);
-            send(sender->sockfd, msg, strlen(msg), 0);
-        }
-
-        // Log processing start
-        char start_logbuf[512];
-        snprintf(start_logbuf, sizeof(start_logbuf),
-            "[FILE-PROCESS] Starting upload of '%s' from %s to %s",
-            file->filename, file->sender, file->receiver);
-        log_event(start_logbuf);
-
-        // Simulate upload processing time
-        sleep(2);
-
-        // Save file with timestamp
-        char filepath[512];
-        struct tm *t = localtime(&now);
-        snprintf(filepath, sizeof(filepath), "received_%04d%02d%02d_%02d%02d%02d_%s",
-                t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
-                t->tm_hour, t->tm_min, t->tm_sec,
-                file->filename);
-
-        FILE* fp = fopen(filepath, "wb");
-        if (fp) {
-            fwrite(file->filedata, 1, file->filesize, fp);
-            fclose(fp);
-            
-            // Notify receiver
-            Client* receiver = get_client_by_name(file->receiver);
-            if (receiver) {
-                char notify[256];
-                snprintf(notify, sizeof(notify),
-                    "[INFO] File '%.50s' from %s has been uploaded successfully.\n",
-                    file->filename, file->sender);
-                send(receiver->sockfd, notify, strlen(notify), 0);
-            }
-
-            // Notify sender of completion
-            if (sender) {
-                char complete_msg[256];
-                snprintf(complete_msg, sizeof(complete_msg),
-                    "[INFO] File '%.50s' uploaded successfully to %s.\n",
-                    file->filename, file->receiver);
-                send(sender->sockfd, complete_msg, strlen(complete_msg), 0);
-            }
-
-            // Log completion
-            char logbuf[512];
-            snprintf(logbuf, sizeof(logbuf),
-                "[FILE] '%.100s' from %.16s to %.16s uploaded successfully as '%.200s'.",
-                file->filename, file->sender, file->receiver, filepath);
-            log_event(logbuf);
-        } else {
-            char error_logbuf[512];
-            snprintf(error_logbuf, sizeof(error_logbuf),
-                "[ERROR] Could not write file '%s' from %s",
-                file->filename, file->sender);
-            log_event(error_logbuf);
-        }
+// The receive paths hashed the data as it came in; only the last block
+// is left
+static int stage_hash(void* item) {
+    FileTransfer* file = item;
+    sha256_final(&file->sha, file->digest);
+    return 0;
+}
 
-        // Cleanup
-        free(file->filedata);
-        free(file);
+static int stage_transform(void* item) {
+    (void)item;
+    // Simulate upload processing time
+    sleep(2);
+    return 0;
+}
 
-        // Update active uploads count and release processing slot
-        pthread_mutex_lock(&file_queue_mutex);
-        active_uploads--;
-        pthread_mutex_unlock(&file_queue_mutex);
-        
-        sem_post(&processing_slots);  // Release processing slot for next file
+// Store once by content hash; repeated sends only add a record
+static int stage_persist(void* item) {
+    FileTransfer* file = item;
+    file->file_id = filestore_put(file->digest, file->filedata, file->filesize,
+                                  file->sender, file->receiver, file->filename, &file->dedup);
+    if (file->file_id <= 0) {
+        char error_logbuf[512];
+        snprintf(error_logbuf, sizeof(error_logbuf),
+            "[ERROR] Could not write file '%s' from %s",
+            file->filename, file->sender);
+        log_event(error_logbuf);
+        return -1;
     }
-
-    return NULL;
+    return 0;
 }
 
-void leave_room(Client* cli) {
-    char old_room[ROOM_NAME_LEN];
-    strncpy(old_room, cli->room, ROOM_NAME_LEN);
-    cli->room[0] = '\0';
+static int stage_notify(void* item) {
+    FileTransfer* file = item;
+    char notify[256];
+    if (file->receiver[0] == '#') {
+        // Room share: one record, one pass over the members, who all
+        // download the same stored copy
+        snprintf(notify, sizeof(notify),
+            "[INFO] %s shared '%.50s' with %s (id %ld, /getfile %ld).\n",
+            file->sender, file->filename, file->receiver, file->file_id, file->file_id);
+        broadcast_room(file->receiver + 1, notify, file->sender);
+        history_append(file->receiver + 1, notify, strlen(notify));
+    } else {
+        // Notify receiver, or leave the notice in their mailbox
+        snprintf(notify, sizeof(notify),
+            "[INFO] File '%.50s' from %s has been uploaded successfully (id %ld).\n",
+            file->filename, file->sender, file->file_id);
+        send_private(file->receiver, notify, file->sender);
+    }
+
+    // Notify sender of completion
+    char complete_msg[256];
+    snprintf(complete_msg, sizeof(complete_msg),
+        "[INFO] File '%.50s' uploaded successfully to %s (id %ld).\n",
+        file->filename, file->receiver, file->file_id);
+    notify_online(file->sender, complete_msg);
 
-    char logbuf[BUFFER_SIZE];
+    // Log completion
+    char hex[2 * SHA256_DIGEST_LEN + 1];
+    sha256_hex(file->digest, hex);
+    char logbuf[512];
     snprintf(logbuf, sizeof(logbuf),
-        "[ROOM] user '%s' left room '%s'", cli->username, old_room);
+        "[FILE] '%.100s' from %.16s to %.33s stored as #%ld (%.16s%s).",
+        file->filename, file->sender, file->receiver, file->file_id, hex,
+        file->dedup ? ", deduplicated" : "");
     log_event(logbuf);
+    journal_event(JEV_FILE, file->sender, file->receiver, file->filesize);
+    return 0;
+}
+
+static void release_upload(void* item) {
+    FileTransfer* file = item;
+    free(file->filedata);
+    file_transfer_free(file);
+}
+
+static int upload_pending(void) {
+    return pipeline_pending(upload_pipeline);
+}
+
+static Pipeline* create_upload_pipeline(void) {
+    Pipeline* p = pipeline_create("uploads", release_upload);
+    if (!p ||
+        pipeline_add_stage(p, "validate", stage_validate, 1, MAX_UPLOAD_QUEUE) < 0 ||
+        pipeline_add_stage(p, "hash", stage_hash, 2, STAGE_QUEUE) < 0 ||
+        pipeline_add_stage(p, "transform", stage_transform, MAX_CONCURRENT_UPLOADS, STAGE_QUEUE) < 0 ||
+        pipeline_add_stage(p, "persist", stage_persist, 2, STAGE_QUEUE) < 0 ||
+        pipeline_add_stage(p, "notify", stage_notify, 1, STAGE_QUEUE) < 0 ||
+        pipeline_start(p) < 0) {
+        return NULL;
+    }
+    return p;
 }
 
 int username_exists(const char* name) {
@@ -569,53 +1061,205 @@ int username_exists(const char* name) {
     return 0;
 }
 
+Client* new_client(int sockfd, const char* username) {
+    Client* cli = client_alloc();
+    if (!cli) return NULL;
+    cli->slot = -1;
+    cli->state = STATE_COMMAND;
+    cli->remaining_file_bytes = 0;
+    //cli->current_file = NULL;
+    ratelimit_user_init(&cli->bucket);
+    cli->sockfd = sockfd;
+    strncpy(cli->username, username, MAX_USERNAME - 1);
+    cli->username[MAX_USERNAME - 1] = '\0';
+    cli->room[0] = '\0';
+
+    uint8_t rnd[SESSION_KEY_LEN / 2];
+    if (getrandom(rnd, sizeof(rnd), 0) != sizeof(rnd)) {
+        client_free(cli);
+        return NULL;
+    }
+    for (int i = 0; i < SESSION_KEY_LEN / 2; i++) {
+        sprintf(cli->session_key + 2 * i, "%02x", rnd[i]);
+    }
+    return cli;
+}
+
+typedef struct {
+    char (*names)[MAX_ROOMNAME];
+    int count, max;
+} RoomNames;
+
+static int collect_room(Room* room, void* arg) {
+    RoomNames* rn = arg;
+    if (rn->count == rn->max) return 1;
+    strcpy(rn->names[rn->count++], room->name);
+    return 0;
+}
+
+// Clients inherited from the previous process keep their session; they
+// just get a new thread here
+void adopt_clients(HandoffClient* list, int count) {
+    int adopted = 0;
+    for (int i = 0; i < count; i++) {
+        Client* cli = valid_username(list[i].username) ? new_client(list[i].fd, list[i].username) : NULL;
+        if (!cli) {
+            close(list[i].fd);
+            continue;
+        }
+        // The client learnt its key from the old process
+        if (strlen(list[i].session_key) == SESSION_KEY_LEN) {
+            strcpy(cli->session_key, list[i].session_key);
+        }
+        pthread_t tid;
+        if (add_client(cli) < 0) {
+            close(cli->sockfd);
+            client_free(cli);
+            continue;
+        }
+
+        // Rooms arrive as one space separated list
+        char* saveptr;
+        pthread_mutex_lock(&clients_mutex);
+        for (char* r = strtok_r(list[i].rooms, " ", &saveptr); r; r = strtok_r(NULL, " ", &saveptr)) {
+            if (valid_room(r)) room_join(cli, r);
+        }
+        if (valid_room(list[i].room) && room_is_member(cli, list[i].room)) {
+            strcpy(cli->room, list[i].room);
+        }
+        pthread_mutex_unlock(&clients_mutex);
+
+        if (pthread_create(&tid, NULL, handle_client, cli) != 0) {
+            remove_client(cli->sockfd);
+            continue;
+        }
+        pthread_detach(tid);
+        adopted++;
+    }
+
+    // Let the room owners know this node still has members
+    RoomNames active = { malloc(ROOM_TABLE_SIZE * sizeof(*active.names)), 0, ROOM_TABLE_SIZE };
+    if (active.names) {
+        pthread_mutex_lock(&clients_mutex);
+        room_foreach(collect_room, &active);
+        pthread_mutex_unlock(&clients_mutex);
+        for (int i = 0; i < active.count; i++) {
+            peer_room_update(active.names[i]);
+        }
+        free(active.names);
+    }
+
+    char logbuf[128];
+    snprintf(logbuf, sizeof(logbuf), "[HANDOFF] Took over %d of %d client(s).", adopted, count);
+    log_event(logbuf);
+}
+
+void print_usage(void) {
+    printf("Usage: ./chatserver <port> [--node <name> --peer-port <port> [--peer <name>=<host>:<port>]...]\n");
+    printf("                            [--handoff <socket path>] [--takeover <socket path>]\n");
+    printf("Cluster nodes authenticate each other with the secret in CHAT_PEER_SECRET\n");
+    printf("Rate limits (commands/s, burst): CHAT_USER_RATE=%d CHAT_USER_BURST=%d CHAT_ROOM_RATE=%d CHAT_ROOM_BURST=%d\n",
+           RATE_USER_DEFAULT, RATE_USER_BURST_DEFAULT, RATE_ROOM_DEFAULT, RATE_ROOM_BURST_DEFAULT);
+    printf("Tracing: CHAT_TRACE_SAMPLE=<n> traces 1 broadcast in n, /trace writes CHAT_TRACE_FILE (default %s)\n",
+           TRACE_DEFAULT_FILE);
+    printf("Event journal: CHAT_JOURNAL=<file> writes a binary journal, read it with ./journalq\n");
+    printf("Content filter: CHAT_FILTER=<word list> (default %s, reloaded when it changes)\n", FILTER_DEFAULT_PATH);
+}
+
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        printf("Usage: ./chatserver <port>\n");
+    if (argc < 2) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    // Optional cluster setup
+    const char* node_name = NULL;
+    int peer_port = 0;
+    const char* handoff_path = NULL;    // Where a successor can take over from us
+    const char* takeover_path = NULL;   // Where the process we replace listens
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--handoff") == 0 && i + 1 < argc) {
+            handoff_path = argv[++i];
+        } else if (strcmp(argv[i], "--takeover") == 0 && i + 1 < argc) {
+            takeover_path = argv[++i];
+        } else if (strcmp(argv[i], "--node") == 0 && i + 1 < argc) {
+            node_name = argv[++i];
+        } else if (strcmp(argv[i], "--peer-port") == 0 && i + 1 < argc) {
+            peer_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--peer") == 0 && i + 1 < argc) {
+            if (peer_add(argv[++i]) < 0) {
+                printf("Invalid peer '%s'\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (node_name && peer_init(node_name, peer_port) < 0) {
+        print_usage();
         return EXIT_FAILURE;
     }
 
     signal(SIGINT, sigint_handler);
-    
-    // Initialize semaphores
-    sem_init(&upload_slots, 0, 0);  // Files in queue
-    sem_init(&processing_slots, 0, MAX_CONCURRENT_UPLOADS);  // Concurrent processing limit
+
+    // Hot upgrade: inherit the listening socket and live clients. This
+    // returns once the old process has exited, so the logs and stores
+    // below are loaded in their final state.
+    int server_sock = -1;
+    HandoffClient inherited[MAX_CLIENTS];
+    int inherited_count = 0;
+    if (takeover_path) {
+        inherited_count = handoff_takeover(takeover_path, &server_sock, inherited, MAX_CLIENTS);
+        if (inherited_count < 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    pool_init(&client_pool, "client", sizeof(Client), 16);
+    pool_init(&transfer_pool, "transfer", sizeof(FileTransfer), 8);
+    ratelimit_init();
+    trace_init();
+    if (journal_init() < 0) {
+        return EXIT_FAILURE;
+    }
+    if (msglog_init() < 0 || search_init() < 0 || mailbox_init() < 0 ||
+        filestore_init() < 0 || transfer_init() < 0) {
+        return EXIT_FAILURE;
+    }
 
     // Initialize all client pointers to NULL
     for (int i = 0; i < MAX_CLIENTS; i++) {
         clients[i] = NULL;
     }
 
-    // Initialize upload queue
-    for (int i = 0; i < MAX_UPLOAD_QUEUE; i++) {
-        upload_queue[i] = NULL;
-    }
-
-    int server_sock, client_sock;
+    int client_sock;
     struct sockaddr_in server_addr, client_addr;
     socklen_t addr_len = sizeof(struct sockaddr_in);
 
-    server_sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_sock < 0) {
-        perror("Socket creation failed");
-        return EXIT_FAILURE;
-    }
+    if (!takeover_path) {
+        server_sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (server_sock < 0) {
+            perror("Socket creation failed");
+            return EXIT_FAILURE;
+        }
 
-    int opt = 1;
-    setsockopt(server_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        int opt = 1;
+        setsockopt(server_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
 
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(atoi(argv[1]));
-    server_addr.sin_addr.s_addr = INADDR_ANY;
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_port = htons(atoi(argv[1]));
+        server_addr.sin_addr.s_addr = INADDR_ANY;
 
-    if (bind(server_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        perror("Bind failed");
-        return EXIT_FAILURE;
-    }
+        if (bind(server_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+            perror("Bind failed");
+            return EXIT_FAILURE;
+        }
 
-    if (listen(server_sock, MAX_CLIENTS) < 0) {
-        perror("Listen failed");
-        return EXIT_FAILURE;
+        if (listen(server_sock, MAX_CLIENTS) < 0) {
+            perror("Listen failed");
+            return EXIT_FAILURE;
+        }
     }
 
     printf("[SERVER] Listening on port %s...\n", argv[1]);
@@ -623,10 +1267,28 @@ int main(int argc, char* argv[]) {
            //MAX_CONCURRENT_UPLOADS, MAX_UPLOAD_QUEUE);
     log_event("[START] Server started.");
 
-    // Create multiple file processing threads
-    pthread_t file_threads[MAX_CONCURRENT_UPLOADS];
-    for (int i = 0; i < MAX_CONCURRENT_UPLOADS; i++) {
-        pthread_create(&file_threads[i], NULL, handle_file_queue, NULL);
+    if (peer_start() < 0) {
+        return EXIT_FAILURE;
+    }
+
+    // File processing stages and their worker threads
+    upload_pipeline = create_upload_pipeline();
+    if (!upload_pipeline) {
+        return EXIT_FAILURE;
+    }
+    if (shard_start() < 0 || presence_start() < 0 || filter_start() < 0) {
+        return EXIT_FAILURE;
+    }
+    if (overload_start(upload_pending, MAX_UPLOAD_QUEUE + MAX_CONCURRENT_UPLOADS) < 0) {
+        return EXIT_FAILURE;
+    }
+
+    if (inherited_count > 0) {
+        adopt_clients(inherited, inherited_count);
+    }
+    if (handoff_path && handoff_listen(handoff_path, server_sock, upload_pending) < 0) {
+        printf("Cannot listen for handoff on '%s'\n", handoff_path);
+        return EXIT_FAILURE;
     }
 
     while (1) {
@@ -640,39 +1302,57 @@ int main(int argc, char* argv[]) {
         recv(client_sock, username, MAX_USERNAME - 1, 0);
         username[strcspn(username, "\n")] = 0;
 
+        // Transfer connections carry file chunks, not a chat session. They
+        // are shed like logins and capped in number, a thread each.
+        if (strncmp(username, XFER_HELLO, strlen(XFER_HELLO)) == 0) {
+            if (!overload_admit(LOAD_LOGIN)) {
+                send(client_sock, "[ERROR] Server busy, try again later.\n", 38, 0);
+                close(client_sock);
+            } else {
+                transfer_start(client_sock);
+            }
+            continue;
+        }
+
         if (!valid_username(username)) {
-            send(client_sock, "[ERROR] Invalid username.\n", 27, 0);
+            send(client_sock, "[ERROR] Invalid username.\n", 26, 0);
             close(client_sock);
             continue;
         }
 
-        pthread_mutex_lock(&clients_mutex);
-        if (username_exists(username)) {
-            pthread_mutex_unlock(&clients_mutex);
-            send(client_sock, "[ERROR] Username already taken.\n", 33, 0);
+        // Logins are the last thing shed: the user is told to come back
+        if (!overload_admit(LOAD_LOGIN)) {
+            send(client_sock, "[ERROR] Server busy, try again later.\n", 38, 0);
             close(client_sock);
             continue;
         }
-        pthread_mutex_unlock(&clients_mutex);
 
-        Client* cli = (Client*)malloc(sizeof(Client));
-        cli->state = STATE_COMMAND;
-        cli->remaining_file_bytes = 0;
-        //cli->current_file = NULL;
+        Client* cli = new_client(client_sock, username);
         if (!cli) {
-            send(client_sock, "[ERROR] Server memory allocation failed.\n", 43, 0);
+            send(client_sock, "[ERROR] Server memory allocation failed.\n", 41, 0);
             close(client_sock);
             continue;
         }
-        
-        cli->sockfd = client_sock;
-        strncpy(cli->username, username, MAX_USERNAME - 1);
-        cli->username[MAX_USERNAME - 1] = '\0';
-        cli->room[0] = '\0';
-        send(client_sock, "[INFO] Joined successfully.\n", 32, 0);
+
+        int added = add_client(cli);
+        if (added < 0) {
+            if (added == -1) send(client_sock, "[ERROR] Username already taken.\n", 32, 0);
+            else send(client_sock, "[ERROR] Server full.\n", 21, 0);
+            client_free(cli);
+            close(client_sock);
+            continue;
+        }
+        char joined[64 + SESSION_KEY_LEN];
+        int jlen = snprintf(joined, sizeof(joined), "[INFO] Joined successfully.\n[SESSION] %s\n", cli->session_key);
+        shard_post(cli->slot, joined, jlen);
 
         pthread_t tid;
-        pthread_create(&tid, NULL, handle_client, cli);
+        if (pthread_create(&tid, NULL, handle_client, cli) != 0) {
+            log_event("[ERROR] Could not start client thread.");
+            remove_client(client_sock);
+            continue;
+        }
+        pthread_detach(tid);
     }
 
     return EXIT_SUCCESS;
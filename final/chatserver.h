@@ -0,0 +1,76 @@
+// chatserver.h
+#ifndef CHATSERVER_H
+#define CHATSERVER_H
+
+#include <pthread.h>
+#include <time.h>
+#include <stdint.h>
+#include "sha256.h"
+#include "ratelimit.h"
+#include "protocol.h"
+
+#define MAX_CLIENTS 50
+#define MAX_ROOMS 50
+#define BUFFER_SIZE 4096
+#define MAX_UPLOAD_QUEUE 20  // Increased queue size
+#define MAX_CONCURRENT_UPLOADS 5  // Max concurrent uploads
+#define STAGE_QUEUE 4             // Queue between two upload pipeline stages
+#define ROOM_NAME_LEN 32
+#define ROOM_TABLE_SIZE 4096      // Rooms with members at once, power of two
+#define ROOM_MEMBER_WORDS ((MAX_CLIENTS + 63) / 64)
+#define MAX_JOINED_ROOMS 64       // Rooms one user can be in
+
+
+
+typedef enum { STATE_COMMAND, STATE_RECEIVING_FILE } ClientState;
+
+typedef struct {
+    int sockfd;
+    char username[MAX_USERNAME];
+    char room[MAX_ROOMNAME];         // Current room: default for /broadcast and /history
+    int slot;                        // Index in clients[], the bit in each room's member set
+    uint64_t joined[ROOM_TABLE_SIZE / 64];  // Bit i: member of room table entry i
+    ClientState state;               // <-- NEW
+    long remaining_file_bytes;      // <-- NEW
+    TokenBucket bucket;             // Command rate limit, owned by the client's thread
+    char session_key[SESSION_KEY_LEN + 1];  // Sent at login; proves the login on /xfer connections
+    //FileTransfer* current_file;     // <-- NEW
+} Client;
+
+
+// File transfer struct
+typedef struct {
+    char sender[MAX_USERNAME];
+    char receiver[MAX_RECEIVER];
+    char filename[256];
+    int filesize;
+    char* filedata;
+    Sha256Ctx sha;                       // Over filedata, updated as it is received
+    uint8_t digest[SHA256_DIGEST_LEN];   // Finished by the hash stage
+    time_t enqueued_time;
+    long file_id;                        // Store id, set by the persist stage
+    int dedup;
+} FileTransfer;
+
+extern Client* clients[MAX_CLIENTS];
+extern int client_count;
+extern pthread_mutex_t clients_mutex;
+
+void log_event(const char* message);
+int valid_username(const char* name);
+int valid_room(const char* room);
+int valid_receiver(const char* sender, const char* receiver);
+int client_in_room(const char* name, const char* room);
+int room_user_count(const char* room_name);
+int enqueue_upload(FileTransfer* ft);
+Client* client_alloc(void);
+void client_free(Client* cli);
+FileTransfer* file_transfer_alloc(void);
+void file_transfer_free(FileTransfer* ft);
+Client* get_client_by_name(const char* name);
+int session_user(const char* key, char* user);
+void broadcast_room(const char* room, const char* message, const char* sender);
+void room_post(const char* room, const char* sender, const char* msg);
+void room_deliver_remote(const char* room, const char* sender, const char* fullmsg);
+
+#endif /* CHATSERVER_H */
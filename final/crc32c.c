@@ -0,0 +1,70 @@
+// crc32c.c
+#include <string.h>
+
+#include "crc32c.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define HAVE_SSE42_PATH 1
+#endif
+
+static uint32_t table[256];
+static int table_ready = 0;
+
+static void build_table(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? (c >> 1) ^ 0x82f63b78u : c >> 1;
+        }
+        table[i] = c;
+    }
+    table_ready = 1;
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t* p, size_t len) {
+    if (!table_ready) build_table();
+    while (len--) {
+        crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef HAVE_SSE42_PATH
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t* p, size_t len) {
+    // 8 bytes per instruction, then the tail byte by byte
+#ifdef __x86_64__
+    uint64_t c = crc;
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)c;
+#endif
+    while (len >= 4) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        crc = _mm_crc32_u32(crc, v);
+        p += 4;
+        len -= 4;
+    }
+    while (len--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t len) {
+    crc = ~crc;
+#ifdef HAVE_SSE42_PATH
+    static int has_sse42 = -1;
+    if (has_sse42 < 0) has_sse42 = __builtin_cpu_supports("sse4.2");
+    if (has_sse42) return ~crc32c_hw(crc, data, len);
+#endif
+    return ~crc32c_sw(crc, data, len);
+}
@@ -0,0 +1,13 @@
+// crc32c.h
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32C (Castagnoli). Uses the SSE4.2 crc32 instruction when the CPU has
+// it, a table otherwise. Start with crc = 0; chain calls by passing the
+// previous result.
+uint32_t crc32c(uint32_t crc, const void* data, size_t len);
+
+#endif /* CRC32C_H */
@@ -0,0 +1,31 @@
+#!/bin/bash
+
+# Starts a 3-node chatserver cluster on localhost.
+# Each node runs in its own directory so logs, msglog/ and mailbox/ don't mix.
+# Clients can connect to any of ports 9001-9003 and share rooms.
+
+BASE_PORT=9000       # Client ports 9001..9003
+PEER_BASE_PORT=9100  # Peer ports 9101..9103
+NODES=3
+
+# Nodes only accept peers that know the cluster secret
+export CHAT_PEER_SECRET="${CHAT_PEER_SECRET:-$(head -c 16 /dev/urandom | od -An -tx1 | tr -d ' \n')}"
+
+PIDS=()
+for i in $(seq 1 $NODES); do
+    ARGS="--node node$i --peer-port $((PEER_BASE_PORT + i))"
+    for j in $(seq 1 $NODES); do
+        if [ "$i" != "$j" ]; then
+            ARGS="$ARGS --peer node$j=127.0.0.1:$((PEER_BASE_PORT + j))"
+        fi
+    done
+
+    mkdir -p "node$i"
+    (cd "node$i" && exec ../chatserver $((BASE_PORT + i)) $ARGS) &
+    PIDS+=($!)
+    echo "Started node$i on port $((BASE_PORT + i))"
+done
+
+echo "Cluster running. Press Ctrl+C to stop."
+trap 'kill ${PIDS[@]} 2>/dev/null; exit 0' INT TERM
+wait
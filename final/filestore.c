@@ -0,0 +1,427 @@
+// filestore.c
+#define _GNU_SOURCE  // memrchr
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "shard.h"
+#include "filestore.h"
+
+// Layout:
+//   store/objects/ab/cd/<sha256 hex>  content, written once per distinct file
+//   store/inbox/<user>.idx            append-only records of the user's files:
+//                                     "+ <id> <hex> <size> <sender> <name>" / "- <id>"
+//   store/tmp/                        blobs being written, renamed into place
+// Blob refcounts and the id table live in memory and are rebuilt from the
+// inbox files at startup. Two directory levels keep every directory small
+// even with millions of blobs.
+
+typedef struct {
+    uint8_t digest[SHA256_DIGEST_LEN];
+    uint32_t refs;
+    int used;
+    int fd;                 // Shared read descriptor while readers > 0
+    uint32_t readers;
+    int writing;            // A put is writing the blob; others wait for it
+} BlobRef;
+
+static BlobRef* blobs = NULL;
+static size_t blobs_cap = 0, blobs_used = 0;
+static StoredFile* files = NULL;     // files[id - 1], id == 0 marks a removed record
+static long files_cap = 0, next_id = 1;
+static pthread_mutex_t store_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t written_cond = PTHREAD_COND_INITIALIZER;  // A blob write finished
+
+void filestore_blob_path(const uint8_t digest[SHA256_DIGEST_LEN], char* buf, size_t size) {
+    char hex[2 * SHA256_DIGEST_LEN + 1];
+    sha256_hex(digest, hex);
+    snprintf(buf, size, "%s/objects/%.2s/%.2s/%s", FILESTORE_DIR, hex, hex + 2, hex);
+}
+
+static void inbox_path(const char* user, char* buf, size_t size) {
+    snprintf(buf, size, "%s/inbox/%s.idx", FILESTORE_DIR, user);
+}
+
+static size_t blob_slot(const uint8_t* digest, size_t cap) {
+    uint64_t h;
+    memcpy(&h, digest, sizeof(h));  // Already uniformly distributed
+    return h & (cap - 1);
+}
+
+static int blobs_grow(void) {
+    size_t cap = blobs_cap ? blobs_cap * 2 : 1024;
+    BlobRef* t = calloc(cap, sizeof(BlobRef));
+    if (!t) return -1;
+    for (size_t i = 0; i < blobs_cap; i++) {
+        if (!blobs[i].used) continue;
+        size_t j = blob_slot(blobs[i].digest, cap);
+        while (t[j].used) j = (j + 1) & (cap - 1);
+        t[j] = blobs[i];
+    }
+    free(blobs);
+    blobs = t;
+    blobs_cap = cap;
+    return 0;
+}
+
+// Caller holds store_mutex. Entries are never removed, a zero refcount
+// just means the blob is gone from disk.
+static BlobRef* blob_get(const uint8_t* digest) {
+    if ((blobs_used + 1) * 2 > blobs_cap && blobs_grow() < 0) return NULL;
+    size_t i = blob_slot(digest, blobs_cap);
+    while (blobs[i].used && memcmp(blobs[i].digest, digest, SHA256_DIGEST_LEN) != 0) {
+        i = (i + 1) & (blobs_cap - 1);
+    }
+    if (!blobs[i].used) {
+        memcpy(blobs[i].digest, digest, SHA256_DIGEST_LEN);
+        blobs[i].used = 1;
+        blobs_used++;
+    }
+    return &blobs[i];
+}
+
+// An existing entry, without growing the table. Caller holds store_mutex.
+static BlobRef* blob_find(const uint8_t* digest) {
+    if (blobs_cap == 0) return NULL;
+    size_t i = blob_slot(digest, blobs_cap);
+    while (blobs[i].used) {
+        if (memcmp(blobs[i].digest, digest, SHA256_DIGEST_LEN) == 0) return &blobs[i];
+        i = (i + 1) & (blobs_cap - 1);
+    }
+    return NULL;
+}
+
+static int hex_to_digest(const char* hex, uint8_t* digest) {
+    if (strlen(hex) != 2 * SHA256_DIGEST_LEN) return -1;
+    for (int i = 0; i < SHA256_DIGEST_LEN; i++) {
+        unsigned int b;
+        if (sscanf(hex + 2 * i, "%2x", &b) != 1) return -1;
+        digest[i] = b;
+    }
+    return 0;
+}
+
+// Make room for id; caller holds store_mutex
+static StoredFile* file_slot(long id) {
+    if (id > files_cap) {
+        long cap = files_cap ? files_cap : 1024;
+        while (cap < id) cap *= 2;
+        StoredFile* grown = realloc(files, cap * sizeof(StoredFile));
+        if (!grown) return NULL;
+        memset(grown + files_cap, 0, (cap - files_cap) * sizeof(StoredFile));
+        files = grown;
+        files_cap = cap;
+    }
+    return &files[id - 1];
+}
+
+static void load_inbox(const char* user, const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) return;
+
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        StoredFile rec;
+        char hex[2 * SHA256_DIGEST_LEN + 1];
+        memset(&rec, 0, sizeof(rec));
+        if (sscanf(line, "+ %ld %64s %ld %16s %63s", &rec.id, hex, &rec.size, rec.sender, rec.filename) == 5 &&
+            rec.id > 0 && hex_to_digest(hex, rec.digest) == 0) {
+            StoredFile* slot = file_slot(rec.id);
+            if (!slot) break;
+            strncpy(rec.receiver, user, MAX_RECEIVER - 1);
+            *slot = rec;
+            if (rec.id >= next_id) next_id = rec.id + 1;
+        } else if (sscanf(line, "- %ld", &rec.id) == 1 && rec.id > 0 && rec.id <= files_cap) {
+            files[rec.id - 1].id = 0;
+        }
+    }
+    fclose(f);
+}
+
+int filestore_init(void) {
+    const char* dirs[] = { FILESTORE_DIR, FILESTORE_DIR "/objects", FILESTORE_DIR "/inbox", FILESTORE_DIR "/tmp" };
+    for (int i = 0; i < 4; i++) {
+        if (mkdir(dirs[i], 0755) < 0 && errno != EEXIST) {
+            perror("filestore mkdir");
+            return -1;
+        }
+    }
+
+    DIR* dir = opendir(FILESTORE_DIR "/inbox");
+    if (!dir) {
+        perror("filestore opendir");
+        return -1;
+    }
+    struct dirent* de;
+    while ((de = readdir(dir)) != NULL) {
+        char* ext = strstr(de->d_name, ".idx");
+        if (!ext || ext[4] != '\0' || ext - de->d_name >= MAX_RECEIVER) continue;
+        char user[MAX_RECEIVER] = {0};
+        memcpy(user, de->d_name, ext - de->d_name);
+        char path[256];
+        inbox_path(user, path, sizeof(path));
+        load_inbox(user, path);
+    }
+    closedir(dir);
+
+    long live = 0;
+    for (long i = 0; i < next_id - 1; i++) {
+        if (files[i].id == 0) continue;
+        BlobRef* b = blob_get(files[i].digest);
+        if (!b) return -1;
+        b->refs++;
+        live++;
+    }
+
+    char logbuf[128];
+    snprintf(logbuf, sizeof(logbuf), "[STORE] %ld file record(s), %zu distinct blob(s)", live, blobs_used);
+    log_event(logbuf);
+    return 0;
+}
+
+static int write_blob(const uint8_t* digest, const char* data, size_t size) {
+    char path[256], tmp[256], hex[2 * SHA256_DIGEST_LEN + 1];
+    sha256_hex(digest, hex);
+
+    // Shard directories are created on demand
+    snprintf(path, sizeof(path), "%s/objects/%.2s", FILESTORE_DIR, hex);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/objects/%.2s/%.2s", FILESTORE_DIR, hex, hex + 2);
+    mkdir(path, 0755);
+
+    snprintf(tmp, sizeof(tmp), "%s/tmp/%s.%lu", FILESTORE_DIR, hex, (unsigned long)pthread_self());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = write(fd, data + done, size - done);
+        if (n <= 0) {
+            close(fd);
+            unlink(tmp);
+            return -1;
+        }
+        done += n;
+    }
+    close(fd);
+
+    filestore_blob_path(digest, path, sizeof(path));
+    if (rename(tmp, path) < 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+long filestore_put(const uint8_t digest[SHA256_DIGEST_LEN], const char* data, size_t size,
+                   const char* sender, const char* receiver, const char* filename, int* dedup) {
+    // Take the reference up front so a concurrent remove can't unlink the blob.
+    // A put of the same content that is still writing the blob counts as
+    // not stored yet: wait for it, then dedup on it or, if it failed, write.
+    pthread_mutex_lock(&store_mutex);
+    BlobRef* b = blob_get(digest);
+    while (b && b->writing) {
+        pthread_cond_wait(&written_cond, &store_mutex);
+        b = blob_find(digest);  // The table may have grown meanwhile
+    }
+    if (!b) {
+        pthread_mutex_unlock(&store_mutex);
+        return -1;
+    }
+    int exists = b->refs > 0;
+    b->refs++;
+    b->writing = !exists;
+    pthread_mutex_unlock(&store_mutex);
+
+    *dedup = exists;
+    if (!exists) {
+        int rc = write_blob(digest, data, size);
+        pthread_mutex_lock(&store_mutex);
+        b = blob_find(digest);
+        b->writing = 0;
+        if (rc < 0) b->refs--;
+        pthread_cond_broadcast(&written_cond);
+        pthread_mutex_unlock(&store_mutex);
+        if (rc < 0) return -1;
+    }
+
+    // Only the file name's last component is kept, it is display-only
+    const char* base = strrchr(filename, '/');
+    base = base ? base + 1 : filename;
+
+    pthread_mutex_lock(&store_mutex);
+    long id = next_id;
+    StoredFile* rec = file_slot(id);
+    char path[256], hex[2 * SHA256_DIGEST_LEN + 1], line[512];
+    int fd = -1;
+    if (rec) {
+        inbox_path(receiver, path, sizeof(path));
+        fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    }
+    if (fd < 0) {
+        blob_get(digest)->refs--;
+        pthread_mutex_unlock(&store_mutex);
+        return -1;
+    }
+
+    memset(rec, 0, sizeof(*rec));
+    rec->id = id;
+    memcpy(rec->digest, digest, SHA256_DIGEST_LEN);
+    rec->size = size;
+    strncpy(rec->sender, sender, MAX_USERNAME - 1);
+    strncpy(rec->receiver, receiver, MAX_RECEIVER - 1);
+    strncpy(rec->filename, base, FILESTORE_NAME_LEN - 1);
+
+    sha256_hex(digest, hex);
+    int len = snprintf(line, sizeof(line), "+ %ld %s %ld %s %s\n", id, hex, rec->size, rec->sender, rec->filename);
+    if (write(fd, line, len) != len) {
+        perror("filestore inbox write");
+    }
+    close(fd);
+    next_id++;
+    pthread_mutex_unlock(&store_mutex);
+    return id;
+}
+
+int filestore_lookup(long id, StoredFile* out) {
+    int rc = -1;
+    pthread_mutex_lock(&store_mutex);
+    if (id > 0 && id < next_id && files[id - 1].id == id) {
+        *out = files[id - 1];
+        rc = 0;
+    }
+    pthread_mutex_unlock(&store_mutex);
+    return rc;
+}
+
+int filestore_remove(long id, const char* receiver) {
+    pthread_mutex_lock(&store_mutex);
+    if (id <= 0 || id >= next_id || files[id - 1].id != id || strcmp(files[id - 1].receiver, receiver) != 0) {
+        pthread_mutex_unlock(&store_mutex);
+        return -1;
+    }
+
+    char path[256], line[32];
+    inbox_path(receiver, path, sizeof(path));
+    int fd = open(path, O_WRONLY | O_APPEND);
+    int len = snprintf(line, sizeof(line), "- %ld\n", id);
+    if (fd < 0 || write(fd, line, len) != len) {
+        if (fd >= 0) close(fd);
+        pthread_mutex_unlock(&store_mutex);
+        return -1;
+    }
+    close(fd);
+
+    files[id - 1].id = 0;
+    BlobRef* b = blob_get(files[id - 1].digest);
+    if (b && b->refs > 0 && --b->refs == 0) {
+        filestore_blob_path(files[id - 1].digest, path, sizeof(path));
+        unlink(path);
+    }
+    pthread_mutex_unlock(&store_mutex);
+    return 0;
+}
+
+// The descriptor outlives an unlink by filestore_remove(), so a download
+// that already started finishes even if the last record goes meanwhile.
+int filestore_open_blob(const uint8_t digest[SHA256_DIGEST_LEN]) {
+    int fd = -1;
+    pthread_mutex_lock(&store_mutex);
+    BlobRef* b = blob_get(digest);
+    if (b && b->readers > 0) {
+        b->readers++;
+        fd = b->fd;
+    } else if (b && b->refs > 0) {
+        char path[256];
+        filestore_blob_path(digest, path, sizeof(path));
+        fd = open(path, O_RDONLY);
+        if (fd >= 0) {
+            b->fd = fd;
+            b->readers = 1;
+        }
+    }
+    pthread_mutex_unlock(&store_mutex);
+    return fd;
+}
+
+void filestore_release_blob(const uint8_t digest[SHA256_DIGEST_LEN]) {
+    pthread_mutex_lock(&store_mutex);
+    BlobRef* b = blob_get(digest);
+    if (b && b->readers > 0 && --b->readers == 0) {
+        close(b->fd);
+        b->fd = -1;
+    }
+    pthread_mutex_unlock(&store_mutex);
+}
+
+// Add one "+ <id> ..." record to the listing. Returns -1 once out is full.
+static int list_record(const char* line, size_t n, char* out, size_t size, size_t* len, int* listed) {
+    char rec_line[64];
+    if (n >= sizeof(rec_line)) n = sizeof(rec_line) - 1;   // The id is all we need
+    memcpy(rec_line, line, n);
+    rec_line[n] = '\0';
+
+    long id;
+    StoredFile rec;
+    if (sscanf(rec_line, "+ %ld", &id) != 1 || filestore_lookup(id, &rec) < 0) return 0;  // Removed since
+    int w = snprintf(out + *len, size - *len, "  #%ld %s (%ld bytes) from %s\n",
+                     rec.id, rec.filename, rec.size, rec.sender);
+    if (w < 0 || *len + w >= size) return -1;
+    *len += w;
+    (*listed)++;
+    return 0;
+}
+
+int filestore_list(int slot, const char* receiver) {
+    char path[256];
+    inbox_path(receiver, path, sizeof(path));
+
+    // Only the user's own index is read, never the whole table. It is read
+    // backwards, newest records first, until the reply is full; removed
+    // records are skipped by the lookup.
+    char out[BUFFER_SIZE];
+    const size_t more_len = 32;     // Room kept for the "older files" line
+    size_t len = receiver[0] == '#' ? snprintf(out, sizeof(out), "[FILES] Files in %s, newest first:\n", receiver)
+                                    : snprintf(out, sizeof(out), "[FILES] Your files, newest first:\n");
+    int listed = 0, full = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        char buf[4096];
+        off_t pos = lseek(fd, 0, SEEK_END);     // buf holds the file's bytes [pos, pos + have)
+        size_t have = 0;
+        while (!full) {
+            size_t take = sizeof(buf) - have;
+            if ((off_t)take > pos) take = pos;
+            if (take == 0 && (have == 0 || pos > 0)) break;   // Done, or a line longer than buf
+            memmove(buf + take, buf, have);
+            if (pread(fd, buf, take, pos - take) != (ssize_t)take) break;
+            pos -= take;
+            have += take;
+
+            // Complete lines from the back; the first one in buf may still
+            // continue before pos
+            size_t end = have;
+            while (end > 0 && !full) {
+                size_t stop = buf[end - 1] == '\n' ? end - 1 : end;
+                char* nl = memrchr(buf, '\n', stop);
+                if (!nl && pos > 0) break;
+                size_t start = nl ? (size_t)(nl - buf) + 1 : 0;
+                full = list_record(buf + start, stop - start, out, sizeof(out) - more_len, &len, &listed) < 0;
+                end = start;
+            }
+            have = end;
+        }
+        close(fd);
+    }
+
+    if (listed == 0) len = snprintf(out, sizeof(out), "[FILES] No stored files.\n");
+    else if (full) len += snprintf(out + len, sizeof(out) - len, "  (older files not shown)\n");
+    shard_send(slot, out, len);
+    return listed;
+}
@@ -0,0 +1,53 @@
+// filestore.h
+#ifndef FILESTORE_H
+#define FILESTORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "chatserver.h"
+#include "sha256.h"
+
+#define FILESTORE_DIR "store"
+#define FILESTORE_NAME_LEN 64   // Original file name kept for display
+
+// One delivered file: a recipient's reference to a stored blob
+typedef struct {
+    long id;
+    uint8_t digest[SHA256_DIGEST_LEN];
+    long size;
+    char sender[MAX_USERNAME];
+    char receiver[MAX_RECEIVER];    // User, or "#room" for a room share
+    char filename[FILESTORE_NAME_LEN];
+} StoredFile;
+
+// Create the store layout and rebuild refcounts and the id table from the
+// recipient indexes. Returns 0 or -1.
+int filestore_init(void);
+
+// Store content once under its hash and add a record for the receiver.
+// *dedup is set when the content was already stored (no blob write).
+// Returns the new file id or -1.
+long filestore_put(const uint8_t digest[SHA256_DIGEST_LEN], const char* data, size_t size,
+                   const char* sender, const char* receiver, const char* filename, int* dedup);
+
+// Look up a file id. Returns 0 or -1 if unknown or removed.
+int filestore_lookup(long id, StoredFile* out);
+
+// Drop a record; the blob is unlinked when its last reference goes.
+// Only the receiver may remove a record. Returns 0 or -1.
+int filestore_remove(long id, const char* receiver);
+
+// Send the receiver's live files to the client in slot, newest first, as
+// many as fit in one reply. Returns number listed.
+int filestore_list(int slot, const char* receiver);
+
+// Open a stored blob for reading. Concurrent readers of the same content
+// share one descriptor, so read it with pread()/sendfile() at an explicit
+// offset. Returns the fd or -1; release with filestore_release_blob().
+int filestore_open_blob(const uint8_t digest[SHA256_DIGEST_LEN]);
+void filestore_release_blob(const uint8_t digest[SHA256_DIGEST_LEN]);
+
+// Blob path of a digest: store/objects/ab/cd/<hex>
+void filestore_blob_path(const uint8_t digest[SHA256_DIGEST_LEN], char* buf, size_t size);
+
+#endif /* FILESTORE_H */
@@ -0,0 +1,325 @@
+// filter.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "chatserver.h"
+#include "shard.h"
+#include "filter.h"
+
+// Aho-Corasick over the alphabet the list actually uses: every distinct
+// byte in a term gets a class of its own (ASCII letters fold case, nothing
+// else does), and all bytes no term contains share class 0, which can only
+// lead back towards the root. After the build every node has a transition
+// for every class (failure links are folded in), so a scan is one table
+// lookup per byte no matter how many terms the list has. Each node records
+// the longest term ending there; shorter ones ending at the same byte are
+// suffixes of it, so masking the longest covers them.
+//
+// The automaton in use is swapped under a write lock when the list
+// changes; scans hold the read lock.
+
+typedef struct {
+    char name[MAX_ROOMNAME];
+    FilterAction action;
+} RoomAction;
+
+typedef struct {
+    unsigned char char_class[256];
+    int classes;                // Row width of next
+    int* next;                  // nodes x classes
+    unsigned short* out;        // Length of the longest term ending here, 0 if none
+    int nodes, cap, max_nodes, terms;
+    FilterAction default_action;
+    RoomAction rooms[FILTER_MAX_ROOMS];
+    int nrooms;
+} Automaton;
+
+static const char* list_path = FILTER_DEFAULT_PATH;
+
+static Automaton* current = NULL;
+static pthread_rwlock_t current_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static unsigned long reloads = 0, scans = 0, masked = 0, dropped = 0, flagged = 0;
+
+static void automaton_free(Automaton* a) {
+    if (!a) return;
+    free(a->next);
+    free(a->out);
+    free(a);
+}
+
+// Returns the new node's index, or -1
+static int add_node(Automaton* a) {
+    if (a->nodes == a->cap) {
+        if (a->cap == a->max_nodes) return -1;
+        int cap = a->cap ? a->cap * 2 : 256;
+        if (cap > a->max_nodes) cap = a->max_nodes;
+        void* next = realloc(a->next, (size_t)cap * a->classes * sizeof(int));
+        if (!next) return -1;
+        a->next = next;
+        void* out = realloc(a->out, cap * sizeof(*a->out));
+        if (!out) return -1;
+        a->out = out;
+        a->cap = cap;
+    }
+    memset(a->next + (size_t)a->nodes * a->classes, 0, a->classes * sizeof(int));
+    a->out[a->nodes] = 0;
+    return a->nodes++;
+}
+
+static int add_term(Automaton* a, const char* term) {
+    int node = 0, len = 0;
+    for (const unsigned char* p = (const unsigned char*)term; *p; p++, len++) {
+        size_t at = (size_t)node * a->classes + a->char_class[*p];
+        if (a->next[at] == 0) {
+            int child = add_node(a);
+            if (child < 0) return -1;
+            a->next[at] = child;
+        }
+        node = a->next[at];
+    }
+    if (len > a->out[node]) a->out[node] = len;
+    a->terms++;
+    return 0;
+}
+
+// Breadth-first: fill in failure transitions and inherited outputs
+static int automaton_finish(Automaton* a) {
+    int* fail = calloc(a->nodes, sizeof(int));
+    int* queue = malloc(a->nodes * sizeof(int));
+    if (!fail || !queue) {
+        free(fail);
+        free(queue);
+        return -1;
+    }
+
+    int head = 0, tail = 0, k = a->classes;
+    for (int c = 0; c < k; c++) {
+        if (a->next[c]) queue[tail++] = a->next[c];
+    }
+    while (head < tail) {
+        int u = queue[head++];
+        if (a->out[u] == 0) a->out[u] = a->out[fail[u]];
+        int* row = a->next + (size_t)u * k;
+        const int* fail_row = a->next + (size_t)fail[u] * k;
+        for (int c = 0; c < k; c++) {
+            int v = row[c];
+            if (v) {
+                fail[v] = fail_row[c];
+                queue[tail++] = v;
+            } else {
+                row[c] = fail_row[c];
+            }
+        }
+    }
+    free(fail);
+    free(queue);
+    return 0;
+}
+
+static int parse_action(const char* s, FilterAction* action) {
+    if (strcmp(s, "mask") == 0) *action = FILTER_MASK;
+    else if (strcmp(s, "drop") == 0) *action = FILTER_DROP;
+    else if (strcmp(s, "flag") == 0) *action = FILTER_FLAG;
+    else return -1;
+    return 0;
+}
+
+// Next line of the list, trimmed. Returns 1, 0 at the end, or -1 for a
+// line longer than FILTER_MAX_LINE.
+static int read_line(FILE* f, char* line, size_t size) {
+    if (!fgets(line, size, f)) return 0;
+    size_t len = strcspn(line, "\r\n");
+    if ((line[len] == '\0' && !feof(f)) || len > FILTER_MAX_LINE) return -1;
+    while (len > 0 && isspace((unsigned char)line[len - 1])) len--;
+    line[len] = '\0';
+    return 1;
+}
+
+// Give every byte used by a term its own class, ASCII letters of either
+// case the same one
+static void assign_classes(Automaton* a, const unsigned char* term) {
+    for (; *term; term++) {
+        unsigned char c = *term;
+        if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        if (a->char_class[c] == 0) a->char_class[c] = a->classes++;
+        if (c >= 'a' && c <= 'z') a->char_class[c - 'a' + 'A'] = a->char_class[c];
+    }
+}
+
+// Build an automaton from the list at path. Returns NULL on any error so
+// the caller can keep the previous one. The first pass over the file
+// settles the alphabet, the second adds the terms.
+static Automaton* automaton_load(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) return NULL;
+
+    Automaton* a = calloc(1, sizeof(Automaton));
+    if (!a) {
+        fclose(f);
+        return NULL;
+    }
+    a->default_action = FILTER_MASK;
+    a->classes = 1;
+
+    char line[FILTER_MAX_LINE + 3];
+    int lineno = 0, ok = 1, rc;
+    while (ok && (rc = read_line(f, line, sizeof(line))) != 0) {
+        lineno++;
+        ok = rc > 0;
+        if (ok && line[0] != '\0' && line[0] != '#' && line[0] != '!') {
+            assign_classes(a, (const unsigned char*)line);
+        }
+    }
+    a->max_nodes = FILTER_MAX_TABLE / ((size_t)a->classes * sizeof(int));
+    if (a->max_nodes > FILTER_MAX_NODES) a->max_nodes = FILTER_MAX_NODES;
+    if (ok && (add_node(a) < 0 || fseek(f, 0, SEEK_SET) < 0)) ok = 0;
+
+    if (ok) lineno = 0;
+    while (ok && read_line(f, line, sizeof(line)) > 0) {
+        lineno++;
+        if (line[0] == '\0' || line[0] == '#') continue;
+
+        if (line[0] != '!') {
+            ok = add_term(a, line) == 0;
+            continue;
+        }
+
+        char directive[16], arg1[MAX_ROOMNAME], arg2[16];
+        int n = sscanf(line + 1, "%15s %32s %15s", directive, arg1, arg2);
+        if (n == 2 && strcmp(directive, "default") == 0) {
+            ok = parse_action(arg1, &a->default_action) == 0;
+        } else if (n == 3 && strcmp(directive, "room") == 0 && a->nrooms < FILTER_MAX_ROOMS) {
+            RoomAction* ra = &a->rooms[a->nrooms];
+            strncpy(ra->name, arg1, MAX_ROOMNAME - 1);
+            ok = parse_action(arg2, &ra->action) == 0;
+            a->nrooms += ok;
+        } else {
+            ok = 0;
+        }
+    }
+    fclose(f);
+
+    if (!ok || automaton_finish(a) < 0) {
+        char logbuf[512];
+        snprintf(logbuf, sizeof(logbuf), "[FILTER] '%s' rejected at line %d, keeping the previous list", path, lineno);
+        log_event(logbuf);
+        automaton_free(a);
+        return NULL;
+    }
+    return a;
+}
+
+static void filter_swap(Automaton* next) {
+    pthread_rwlock_wrlock(&current_lock);
+    Automaton* old = current;
+    current = next;
+    pthread_rwlock_unlock(&current_lock);
+    automaton_free(old);
+}
+
+static void* filter_thread(void* arg) {
+    (void)arg;
+    struct timespec tick = { FILTER_POLL_MS / 1000, (FILTER_POLL_MS % 1000) * 1000000L };
+    struct stat seen = {0};
+    int present = 0;
+
+    while (1) {
+        struct stat st;
+        if (stat(list_path, &st) < 0) {
+            if (present) {
+                filter_swap(NULL);
+                log_event("[FILTER] List removed, filtering off");
+                present = 0;
+            }
+        } else if (!present || st.st_ino != seen.st_ino || st.st_size != seen.st_size ||
+                   st.st_mtim.tv_sec != seen.st_mtim.tv_sec || st.st_mtim.tv_nsec != seen.st_mtim.tv_nsec) {
+            Automaton* a = automaton_load(list_path);
+            if (a) {
+                char logbuf[512];
+                snprintf(logbuf, sizeof(logbuf),
+                         "[FILTER] Loaded %d term(s), %d node(s), %d byte class(es), %d room action(s) from '%s'",
+                         a->terms, a->nodes, a->classes, a->nrooms, list_path);
+                filter_swap(a);
+                __atomic_fetch_add(&reloads, 1, __ATOMIC_RELAXED);
+                log_event(logbuf);
+            }
+            // A rejected list isn't retried until it changes again
+            seen = st;
+            present = 1;
+        }
+        nanosleep(&tick, NULL);
+    }
+    return NULL;
+}
+
+int filter_start(void) {
+    const char* env = getenv("CHAT_FILTER");
+    if (env && *env) list_path = env;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, filter_thread, NULL) != 0) {
+        perror("filter thread");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+FilterAction filter_apply(const char* room, char* msg) {
+    FilterAction result = FILTER_PASS;
+    pthread_rwlock_rdlock(&current_lock);
+    Automaton* a = current;
+    if (a && a->terms > 0) {
+        FilterAction action = a->default_action;
+        for (int i = 0; room && i < a->nrooms; i++) {
+            if (strcmp(a->rooms[i].name, room) == 0) {
+                action = a->rooms[i].action;
+                break;
+            }
+        }
+
+        int state = 0;
+        for (size_t i = 0; msg[i]; i++) {
+            state = a->next[(size_t)state * a->classes + a->char_class[(unsigned char)msg[i]]];
+            int len = a->out[state];
+            if (len == 0) continue;
+            result = action;
+            if (action != FILTER_MASK) break;
+            memset(msg + i + 1 - len, '*', len);
+        }
+    }
+    pthread_rwlock_unlock(&current_lock);
+
+    __atomic_fetch_add(&scans, 1, __ATOMIC_RELAXED);
+    if (result == FILTER_MASK) __atomic_fetch_add(&masked, 1, __ATOMIC_RELAXED);
+    else if (result == FILTER_DROP) __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+    else if (result == FILTER_FLAG) __atomic_fetch_add(&flagged, 1, __ATOMIC_RELAXED);
+    return result;
+}
+
+void filter_report(int slot) {
+    char out[256];
+    int terms = 0, nodes = 0;
+    pthread_rwlock_rdlock(&current_lock);
+    if (current) {
+        terms = current->terms;
+        nodes = current->nodes;
+    }
+    pthread_rwlock_unlock(&current_lock);
+
+    int len = snprintf(out, sizeof(out),
+                       "[STATS] Filter: %d term(s), %d node(s), %lu reload(s); scanned %lu, masked %lu, dropped %lu, flagged %lu\n",
+                       terms, nodes,
+                       __atomic_load_n(&reloads, __ATOMIC_RELAXED),
+                       __atomic_load_n(&scans, __ATOMIC_RELAXED),
+                       __atomic_load_n(&masked, __ATOMIC_RELAXED),
+                       __atomic_load_n(&dropped, __ATOMIC_RELAXED),
+                       __atomic_load_n(&flagged, __ATOMIC_RELAXED));
+    shard_send(slot, out, len);
+}
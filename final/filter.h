@@ -0,0 +1,36 @@
+// filter.h
+#ifndef FILTER_H
+#define FILTER_H
+
+#define FILTER_DEFAULT_PATH "filter.txt"   // Overridden by CHAT_FILTER
+#define FILTER_POLL_MS 1000                // How often the list's mtime is checked
+#define FILTER_MAX_NODES (1 << 18)         // Automaton size limit; a bigger list is rejected
+#define FILTER_MAX_TABLE (64 << 20)        // Transition table bytes at most (nodes x byte classes x 4)
+#define FILTER_MAX_LINE 255                // Longer lines reject the list
+#define FILTER_MAX_ROOMS 64                // Rooms with their own action
+
+// The list has one banned term per line, matched anywhere in a message,
+// ignoring the case of ASCII letters; other bytes match only themselves. Lines starting with '#' are comments. Actions:
+//   !default mask|drop|flag      for rooms without their own (default mask)
+//   !room <name> mask|drop|flag
+// Whispers use the default action.
+
+typedef enum {
+    FILTER_PASS,     // Nothing matched
+    FILTER_MASK,     // Matched terms replaced with '*'
+    FILTER_DROP,     // Message must not be delivered
+    FILTER_FLAG      // Delivered unchanged, reported in the log
+} FilterAction;
+
+// Load the list and start watching it. A missing list means no filtering.
+// Returns 0 or -1.
+int filter_start(void);
+
+// Scan msg once, masking it in place if the room's action says so. room
+// is NULL for whispers. Returns FILTER_PASS or the action taken.
+FilterAction filter_apply(const char* room, char* msg);
+
+// Write list size, reloads and match counts to the client in slot.
+void filter_report(int slot);
+
+#endif /* FILTER_H */
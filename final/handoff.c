@@ -0,0 +1,284 @@
+// handoff.c
+#define _GNU_SOURCE  // struct ucred
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+
+#include "chatserver.h"
+#include "handoff.h"
+#include "journal.h"
+#include "rooms.h"
+#include "shard.h"
+
+// The two processes talk over a SOCK_SEQPACKET Unix socket, one record per
+// message, each carrying at most one descriptor as SCM_RIGHTS:
+//   HANDOFF_LISTENER  the listening TCP socket
+//   HANDOFF_CLIENT    a client socket with its username, session key and rooms
+//   HANDOFF_END       no descriptor; the successor answers with one byte
+// Only after that byte does the old process exit. Its threads die with it,
+// and input still queued on the client sockets is read by the successor.
+// Input a client thread had already received but not yet handled dies
+// with it: commands pipelined behind the one being handled, or the rest
+// of a /sendfile body. Clients see no reply (or no [SYNC]) for those and
+// have to send them again. Transfer connections are not passed on;
+// uploads resume from their chunks.
+//
+// Output goes the other way: before the state is sent, the writer shards
+// get up to HANDOFF_FLUSH_SECONDS to hand what they hold to the sockets.
+// Whatever is still queued after that, typically for a client that has
+// stopped reading, is lost, as is output queued after the wait. Clients
+// miss those lines, or read a line cut short before the successor's.
+//
+// The socket is only for this server's own user: the file is created
+// 0600 and a successor running as anyone else is turned away.
+
+enum { HANDOFF_LISTENER = 1, HANDOFF_CLIENT, HANDOFF_END };
+
+typedef struct {
+    uint32_t kind;
+    char username[MAX_USERNAME];
+    char session_key[SESSION_KEY_LEN + 1];
+    char room[MAX_ROOMNAME];
+    char rooms[MAX_JOINED_ROOMS * MAX_ROOMNAME];
+} HandoffRecord;
+
+typedef struct {
+    int sock;
+    int listen_fd;
+    int (*pending)(void);
+} HandoffServer;
+
+static int send_record(int sock, const HandoffRecord* rec, int fd) {
+    struct iovec iov = { (void*)rec, sizeof(*rec) };
+    char ctrl[CMSG_SPACE(sizeof(int))];
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    if (fd >= 0) {
+        memset(ctrl, 0, sizeof(ctrl));
+        mh.msg_control = ctrl;
+        mh.msg_controllen = sizeof(ctrl);
+        struct cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+    }
+    return sendmsg(sock, &mh, MSG_NOSIGNAL) == sizeof(*rec) ? 0 : -1;
+}
+
+static int recv_record(int sock, HandoffRecord* rec, int* fd) {
+    struct iovec iov = { rec, sizeof(*rec) };
+    char ctrl[CMSG_SPACE(sizeof(int))];
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = ctrl;
+    mh.msg_controllen = sizeof(ctrl);
+
+    *fd = -1;
+    if (recvmsg(sock, &mh, MSG_CMSG_CLOEXEC) != sizeof(*rec)) return -1;
+    struct cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+    if (cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+        memcpy(fd, CMSG_DATA(cm), sizeof(int));
+    }
+    rec->username[MAX_USERNAME - 1] = '\0';
+    rec->session_key[SESSION_KEY_LEN] = '\0';
+    rec->room[MAX_ROOMNAME - 1] = '\0';
+    rec->rooms[sizeof(rec->rooms) - 1] = '\0';
+    return 0;
+}
+
+// Runs with clients_mutex held, so no client can come or go meanwhile
+static int send_state(int conn, int listen_fd, int* sent) {
+    HandoffRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.kind = HANDOFF_LISTENER;
+    if (send_record(conn, &rec, listen_fd) < 0) return -1;
+
+    *sent = 0;
+    for (int i = 0; i < MAX_CLIENTS; ++i) {
+        if (!clients[i]) continue;
+        memset(&rec, 0, sizeof(rec));
+        rec.kind = HANDOFF_CLIENT;
+        strncpy(rec.username, clients[i]->username, MAX_USERNAME - 1);
+        memcpy(rec.session_key, clients[i]->session_key, SESSION_KEY_LEN);
+        strncpy(rec.room, clients[i]->room, MAX_ROOMNAME - 1);
+        char names[MAX_JOINED_ROOMS][MAX_ROOMNAME];
+        int nrooms = room_list(clients[i], names, MAX_JOINED_ROOMS);
+        size_t len = 0;
+        for (int r = 0; r < nrooms; r++) {
+            len += snprintf(rec.rooms + len, sizeof(rec.rooms) - len, "%s%s", r ? " " : "", names[r]);
+        }
+        if (send_record(conn, &rec, clients[i]->sockfd) < 0) return -1;
+        (*sent)++;
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    rec.kind = HANDOFF_END;
+    if (send_record(conn, &rec, -1) < 0) return -1;
+
+    struct timeval tv = { HANDOFF_ACK_SECONDS, 0 };
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    char ack;
+    return recv(conn, &ack, 1, 0) == 1 ? 0 : -1;
+}
+
+static void* handoff_thread(void* arg) {
+    HandoffServer* srv = arg;
+    while (1) {
+        int conn = accept(srv->sock, NULL, NULL);
+        if (conn < 0) {
+            if (errno != EINTR) perror("handoff accept");
+            continue;
+        }
+        struct ucred cred = { 0, (uid_t)-1, (gid_t)-1 };
+        socklen_t clen = sizeof(cred);
+        if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &clen) < 0 || cred.uid != geteuid()) {
+            char logbuf[128];
+            snprintf(logbuf, sizeof(logbuf), "[HANDOFF] Refused successor with uid %d.", (int)cred.uid);
+            log_event(logbuf);
+            close(conn);
+            continue;
+        }
+        log_event("[HANDOFF] Successor connected, draining uploads and output.");
+
+        // Files already in the pipeline live only in this process
+        for (int waited = 0; srv->pending() > 0 && waited < HANDOFF_DRAIN_SECONDS * 10; waited++) {
+            usleep(100000);
+        }
+        // Then what the clients are owed, so the successor's writes don't
+        // land in the middle of ours
+        for (int waited = 0; shard_unsent() > 0 && waited < HANDOFF_FLUSH_SECONDS * 10; waited++) {
+            usleep(100000);
+        }
+        long unsent = shard_unsent();
+        if (unsent > 0) {
+            char logbuf[128];
+            snprintf(logbuf, sizeof(logbuf), "[HANDOFF] %ld byte(s) of client output not flushed.", unsent);
+            log_event(logbuf);
+        }
+
+        int sent = 0;
+        pthread_mutex_lock(&clients_mutex);
+        if (send_state(conn, srv->listen_fd, &sent) == 0) {
+            char logbuf[128];
+            snprintf(logbuf, sizeof(logbuf), "[HANDOFF] Passed %d client(s) to successor, exiting.", sent);
+            log_event(logbuf);
+            journal_flush();    // _exit skips the flush thread's next tick
+            _exit(0);
+        }
+        pthread_mutex_unlock(&clients_mutex);
+        log_event("[HANDOFF] Successor did not confirm, still serving.");
+        close(conn);
+    }
+    return NULL;
+}
+
+static int unix_address(const char* path, struct sockaddr_un* addr) {
+    if (strlen(path) >= sizeof(addr->sun_path)) return -1;
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+int handoff_listen(const char* path, int listen_fd, int (*pending)(void)) {
+    struct sockaddr_un addr;
+    if (unix_address(path, &addr) < 0) return -1;
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0) return -1;
+    unlink(path);
+
+    // The file takes the socket's mode at bind(), so it is never open to
+    // others, not even briefly; the chmod covers kernels that don't do that
+    if (fchmod(sock, 0600) < 0 || bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        chmod(path, 0600) < 0 || listen(sock, 1) < 0) {
+        perror("handoff bind");
+        close(sock);
+        return -1;
+    }
+
+    HandoffServer* srv = malloc(sizeof(HandoffServer));
+    pthread_t tid;
+    if (!srv) {
+        close(sock);
+        return -1;
+    }
+    srv->sock = sock;
+    srv->listen_fd = listen_fd;
+    srv->pending = pending;
+    if (pthread_create(&tid, NULL, handoff_thread, srv) != 0) {
+        close(sock);
+        free(srv);
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+int handoff_takeover(const char* path, int* listen_fd, HandoffClient* out, int max) {
+    struct sockaddr_un addr;
+    if (unix_address(path, &addr) < 0) return -1;
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0) return -1;
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("handoff connect");
+        close(sock);
+        return -1;
+    }
+
+    *listen_fd = -1;
+    int count = 0;
+    while (1) {
+        HandoffRecord rec;
+        int fd;
+        if (recv_record(sock, &rec, &fd) < 0) break;
+        if (rec.kind == HANDOFF_END) {
+            if (*listen_fd < 0) break;
+
+            // Confirm, then wait for the old process to go so its peer
+            // port and handoff path are free
+            char ack = 1;
+            char eof;
+            if (send(sock, &ack, 1, MSG_NOSIGNAL) == 1) {
+                while (recv(sock, &eof, 1, 0) > 0) {
+                }
+                close(sock);
+                return count;
+            }
+            break;
+        }
+        if (fd < 0) continue;
+        if (rec.kind == HANDOFF_LISTENER && *listen_fd < 0) {
+            *listen_fd = fd;
+        } else if (rec.kind == HANDOFF_CLIENT && count < max) {
+            out[count].fd = fd;
+            strcpy(out[count].username, rec.username);
+            strcpy(out[count].session_key, rec.session_key);
+            strcpy(out[count].room, rec.room);
+            strcpy(out[count].rooms, rec.rooms);
+            count++;
+        } else {
+            close(fd);
+        }
+    }
+
+    // Nothing was confirmed, so the old process keeps everything
+    fprintf(stderr, "handoff: takeover from %s failed\n", path);
+    for (int i = 0; i < count; i++) close(out[i].fd);
+    if (*listen_fd >= 0) close(*listen_fd);
+    close(sock);
+    return -1;
+}
@@ -0,0 +1,34 @@
+// handoff.h
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include "chatserver.h"
+
+#define HANDOFF_DRAIN_SECONDS 10   // Longest wait for queued uploads before handing off
+#define HANDOFF_FLUSH_SECONDS 5    // Longest wait for queued output to reach the sockets
+#define HANDOFF_ACK_SECONDS 5      // Longest wait for the new process to confirm
+
+// A live client passed from the old process to the new one
+typedef struct {
+    int fd;
+    char username[MAX_USERNAME];
+    char session_key[SESSION_KEY_LEN + 1];           // Transfer key the client already holds
+    char room[MAX_ROOMNAME];                         // Current room
+    char rooms[MAX_JOINED_ROOMS * MAX_ROOMNAME];     // All joined rooms, space separated
+} HandoffClient;
+
+// Old process: listen for a successor on the Unix socket at path. When one
+// connects, the listening socket and every client socket are passed to it
+// and this process exits; the clients never see a disconnect, though
+// commands received but not yet handled, and output that didn't reach the
+// sockets in time, are lost (see handoff.c). If the successor doesn't
+// confirm, this process keeps serving. pending() reports uploads still in
+// flight, which are drained first, then the writer shards. Returns 0 or -1.
+int handoff_listen(const char* path, int listen_fd, int (*pending)(void));
+
+// New process: take over from the process listening at path. Fills
+// *listen_fd and up to max clients, and returns once the old process has
+// exited. Returns the number of clients or -1.
+int handoff_takeover(const char* path, int* listen_fd, HandoffClient* out, int max);
+
+#endif /* HANDOFF_H */
@@ -0,0 +1,185 @@
+// history.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "chatserver.h"
+#include "shard.h"
+#include "arena.h"
+#include "pool.h"
+#include "history.h"
+
+// One message inside a room arena
+typedef struct {
+    uint32_t off;
+    uint32_t len;
+} HistoryEntry;
+
+// Each room owns a byte ring (the arena) plus a ring of entries pointing into it.
+typedef struct {
+    char name[MAX_ROOMNAME];
+    char* arena;                           // NULL until the room gets its first message
+    HistoryEntry entries[HISTORY_ROOM_MSGS];
+    int head;                              // Oldest entry
+    int count;
+    uint32_t write_pos;
+    unsigned long last_used;               // For LRU eviction
+} RoomHistory;
+
+static RoomHistory rooms[HISTORY_MAX_ROOMS];
+static size_t total_bytes = 0;
+static unsigned long use_clock = 0;
+static pthread_mutex_t history_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void drop_room(RoomHistory* h) {
+    if (h->arena) {
+        free(h->arena);
+        total_bytes -= HISTORY_ROOM_BYTES;
+    }
+    memset(h, 0, sizeof(*h));
+}
+
+static RoomHistory* find_room(const char* room) {
+    for (int i = 0; i < HISTORY_MAX_ROOMS; i++) {
+        if (rooms[i].arena && strcmp(rooms[i].name, room) == 0) {
+            return &rooms[i];
+        }
+    }
+    return NULL;
+}
+
+// Find or create the history of a room, evicting the least recently used
+// rooms when out of slots or over the global budget. Caller holds history_mutex.
+static RoomHistory* get_room(const char* room) {
+    RoomHistory* h = find_room(room);
+    if (h) return h;
+
+    RoomHistory* slot = NULL;
+    for (int i = 0; i < HISTORY_MAX_ROOMS; i++) {
+        if (!rooms[i].arena) {
+            slot = &rooms[i];
+            break;
+        }
+    }
+
+    while (!slot || total_bytes + HISTORY_ROOM_BYTES > HISTORY_TOTAL_BYTES) {
+        RoomHistory* oldest = NULL;
+        for (int i = 0; i < HISTORY_MAX_ROOMS; i++) {
+            if (rooms[i].arena && (!oldest || rooms[i].last_used < oldest->last_used)) {
+                oldest = &rooms[i];
+            }
+        }
+        if (!oldest) break;
+
+        char logbuf[128];
+        snprintf(logbuf, sizeof(logbuf), "[HISTORY] evicted room '%s'", oldest->name);
+        drop_room(oldest);
+        log_event(logbuf);
+        if (!slot) slot = oldest;
+    }
+    if (!slot) return NULL;
+
+    slot->arena = malloc(HISTORY_ROOM_BYTES);
+    if (!slot->arena) return NULL;
+    total_bytes += HISTORY_ROOM_BYTES;
+    strncpy(slot->name, room, MAX_ROOMNAME - 1);
+    slot->name[MAX_ROOMNAME - 1] = '\0';
+    return slot;
+}
+
+static int overlaps(const HistoryEntry* e, uint32_t off, uint32_t len) {
+    return e->off < off + len && off < e->off + e->len;
+}
+
+void history_append(const char* room, const char* msg, size_t len) {
+    if (len == 0) return;
+    if (len > HISTORY_ROOM_BYTES) len = HISTORY_ROOM_BYTES;
+
+    pthread_mutex_lock(&history_mutex);
+    RoomHistory* h = get_room(room);
+    if (!h) {
+        pthread_mutex_unlock(&history_mutex);
+        return;
+    }
+    h->last_used = ++use_clock;
+
+    uint32_t pos = h->write_pos;
+    int wrapped = 0;
+    if (pos + len > HISTORY_ROOM_BYTES) {
+        pos = 0;
+        wrapped = 1;
+    }
+
+    // Free space for the new message: oldest entries go first. On wrap the
+    // entries in the abandoned tail [write_pos, end) are the oldest ones.
+    while (h->count > 0) {
+        HistoryEntry* e = &h->entries[h->head];
+        int dead = h->count == HISTORY_ROOM_MSGS || overlaps(e, pos, len) ||
+                   (wrapped && e->off >= h->write_pos);
+        if (!dead) break;
+        h->head = (h->head + 1) % HISTORY_ROOM_MSGS;
+        h->count--;
+    }
+
+    memcpy(h->arena + pos, msg, len);
+    HistoryEntry* e = &h->entries[(h->head + h->count) % HISTORY_ROOM_MSGS];
+    e->off = pos;
+    e->len = len;
+    h->count++;
+    h->write_pos = pos + len;
+
+    pthread_mutex_unlock(&history_mutex);
+}
+
+int history_replay(int slot, const char* room, int n) {
+    char header[128];
+
+    pthread_mutex_lock(&history_mutex);
+    RoomHistory* h = find_room(room);
+    if (!h || h->count == 0) {
+        pthread_mutex_unlock(&history_mutex);
+        return 0;
+    }
+    h->last_used = ++use_clock;
+
+    if (n > h->count) n = h->count;
+    int hlen = snprintf(header, sizeof(header), "[HISTORY] Last %d message(s) in '%s':\n", n, room);
+    if (hlen >= (int)sizeof(header)) hlen = sizeof(header) - 1;
+
+    int first = h->head + h->count - n;
+    size_t total = hlen;
+    for (int i = 0; i < n; i++) {
+        total += h->entries[(first + i) % HISTORY_ROOM_MSGS].len;
+    }
+
+    // Copy the messages out and send after unlocking: a slow reader must
+    // not hold up history_append() on every broadcast. The scratch arena
+    // takes it when it fits, big replays go to the heap.
+    size_t mark = arena_mark();
+    char* out = arena_alloc(total);
+    char* heap = NULL;
+    if (!out) {
+        out = heap = malloc(total);
+        heap_miss();
+    }
+    if (!out) {
+        pthread_mutex_unlock(&history_mutex);
+        return -1;
+    }
+
+    memcpy(out, header, hlen);
+    size_t len = hlen;
+    for (int i = 0; i < n; i++) {
+        HistoryEntry* e = &h->entries[(first + i) % HISTORY_ROOM_MSGS];
+        memcpy(out + len, h->arena + e->off, e->len);
+        len += e->len;
+    }
+    pthread_mutex_unlock(&history_mutex);
+
+    int rc = shard_send(slot, out, len);
+    free(heap);
+    arena_rewind(mark);
+    return rc < 0 ? -1 : n;
+}
@@ -0,0 +1,20 @@
+// history.h
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+
+#define HISTORY_ROOM_BYTES (32 * 1024)   // Arena size per room
+#define HISTORY_ROOM_MSGS 256            // Max messages kept per room
+#define HISTORY_TOTAL_BYTES (512 * 1024) // Arena budget for all rooms
+#define HISTORY_MAX_ROOMS MAX_ROOMS
+#define HISTORY_DEFAULT_REPLAY 20
+
+// Remember a message that was broadcast to a room
+void history_append(const char* room, const char* msg, size_t len);
+
+// Send the last n messages of a room to the client in slot, copied out under the lock.
+// Returns number of messages sent, 0 if the room has no history, -1 on error.
+int history_replay(int slot, const char* room, int n);
+
+#endif /* HISTORY_H */
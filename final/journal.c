@@ -0,0 +1,231 @@
+// journal.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "journal.h"
+
+// Records are encoded into a buffer under journal_mutex and written with
+// one write() when it fills or on the flush tick, so an event costs a few
+// bytes of encoding instead of a formatted line and a file open. Names
+// are interned in a hash table; the first use of a name in a session
+// writes its JREC_NAME record.
+//
+// There are two buffers. A flush swaps them under journal_mutex and
+// writes the full one after letting go, holding only write_mutex, so
+// events keep encoding into the other buffer during the write. A write
+// that fails is cut back off the file, leaving whole records only, and
+// the next event starts a new session, since names interned in the lost
+// records must be written again.
+
+typedef struct {
+    char* name;
+    uint32_t id;
+} Interned;
+
+static int journal_fd = -1;
+static pthread_mutex_t journal_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t write_mutex = PTHREAD_MUTEX_INITIALIZER;  // Held while a buffer is written
+static unsigned char bufs[2][JOURNAL_BUFFER];
+static unsigned char* buf = bufs[0];
+static size_t used = 0;
+static uint64_t last_ns = 0;
+static int lost = 0;                // A write failed since the last event
+
+// A full buffer handed from under journal_mutex to write_out()
+typedef struct {
+    unsigned char* data;
+    size_t len;
+} Filled;
+
+static Interned* names = NULL;
+static uint32_t names_cap = 0, names_count = 0;
+
+static uint64_t realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static size_t put_varint(unsigned char* p, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+// Caller holds journal_mutex. Hands the records so far to *out and goes
+// on in the spare buffer, once the spare's own write is done. The caller
+// must pass out to write_out() after unlocking journal_mutex.
+static void swap_locked(Filled* out) {
+    pthread_mutex_lock(&write_mutex);
+    out->data = buf;
+    out->len = used;
+    buf = buf == bufs[0] ? bufs[1] : bufs[0];
+    used = 0;
+}
+
+static void write_out(Filled* out) {
+    if (!out->data) return;
+    off_t start = lseek(journal_fd, 0, SEEK_END);
+    size_t off = 0;
+    while (off < out->len) {
+        ssize_t n = write(journal_fd, out->data + off, out->len - off);
+        if (n <= 0) {
+            perror("journal write");
+            if (off > 0 && start >= 0 && ftruncate(journal_fd, start) < 0) perror("journal truncate");
+            __atomic_store_n(&lost, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        off += n;
+    }
+    out->data = NULL;
+    pthread_mutex_unlock(&write_mutex);
+}
+
+// Make room for a record of at most len bytes
+static void reserve(size_t len, Filled* out) {
+    if (used + len > JOURNAL_BUFFER && !out->data) swap_locked(out);
+}
+
+static uint32_t name_hash(const char* s) {
+    uint32_t h = 2166136261u;
+    while (*s) h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+}
+
+static int names_grow(void) {
+    uint32_t cap = names_cap ? names_cap * 2 : 1024;
+    Interned* t = calloc(cap, sizeof(Interned));
+    if (!t) return -1;
+    for (uint32_t i = 0; i < names_cap; i++) {
+        if (!names[i].name) continue;
+        uint32_t j = name_hash(names[i].name) & (cap - 1);
+        while (t[j].name) j = (j + 1) & (cap - 1);
+        t[j] = names[i];
+    }
+    free(names);
+    names = t;
+    names_cap = cap;
+    return 0;
+}
+
+// Id of name, writing its JREC_NAME record the first time. 0 on failure.
+static uint32_t intern(const char* name, Filled* out) {
+    if ((names_count + 1) * 10 >= names_cap * 7 && names_grow() < 0) return 0;
+    uint32_t i = name_hash(name) & (names_cap - 1);
+    while (names[i].name) {
+        if (strcmp(names[i].name, name) == 0) return names[i].id;
+        i = (i + 1) & (names_cap - 1);
+    }
+
+    size_t len = strlen(name);
+    if (len > 255) return 0;
+    names[i].name = strdup(name);
+    if (!names[i].name) return 0;
+    names[i].id = ++names_count;
+
+    reserve(1 + 10 + 10 + len, out);
+    buf[used++] = JREC_NAME;
+    used += put_varint(buf + used, names[i].id);
+    used += put_varint(buf + used, len);
+    memcpy(buf + used, name, len);
+    used += len;
+    return names[i].id;
+}
+
+// Caller holds journal_mutex
+static void start_session(void) {
+    last_ns = realtime_ns();
+    buf[used++] = JREC_SESSION;
+    used += put_varint(buf + used, last_ns);
+}
+
+// After a lost write, forget the interned names and begin a new session
+static void recover_locked(Filled* out) {
+    if (!__atomic_exchange_n(&lost, 0, __ATOMIC_RELAXED)) return;
+
+    for (uint32_t i = 0; i < names_cap; i++) {
+        free(names[i].name);
+        names[i].name = NULL;
+    }
+    names_count = 0;
+    reserve(1 + 10, out);
+    start_session();
+}
+
+static void* flush_thread(void* arg) {
+    (void)arg;
+    struct timespec tick = { JOURNAL_FLUSH_MS / 1000, (JOURNAL_FLUSH_MS % 1000) * 1000000L };
+    while (1) {
+        nanosleep(&tick, NULL);
+        journal_flush();
+    }
+    return NULL;
+}
+
+int journal_init(void) {
+    const char* path = getenv("CHAT_JOURNAL");
+    if (!path || !*path) return 0;
+
+    journal_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (journal_fd < 0) {
+        perror("journal open");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(journal_fd, &st) == 0 && st.st_size == 0) {
+        memcpy(buf, JOURNAL_MAGIC, 4);
+        used = 4;
+    }
+    start_session();
+    journal_flush();
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, flush_thread, NULL) != 0) {
+        perror("journal thread");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+void journal_event(JournalEvent type, const char* subject, const char* object, uint64_t value) {
+    if (journal_fd < 0) return;
+
+    Filled out = { NULL, 0 };
+    pthread_mutex_lock(&journal_mutex);
+    recover_locked(&out);
+    uint32_t sid = subject ? intern(subject, &out) : 0;
+    uint32_t oid = object ? intern(object, &out) : 0;
+
+    uint64_t now = realtime_ns();
+    int64_t delta = (int64_t)(now - last_ns);
+    last_ns = now;
+
+    reserve(1 + 4 * 10, &out);
+    buf[used++] = (unsigned char)type;
+    used += put_varint(buf + used, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+    used += put_varint(buf + used, sid);
+    used += put_varint(buf + used, oid);
+    used += put_varint(buf + used, value);
+    pthread_mutex_unlock(&journal_mutex);
+    write_out(&out);
+}
+
+void journal_flush(void) {
+    if (journal_fd < 0) return;
+    Filled out = { NULL, 0 };
+    pthread_mutex_lock(&journal_mutex);
+    if (used > 0) swap_locked(&out);
+    pthread_mutex_unlock(&journal_mutex);
+    write_out(&out);
+}
@@ -0,0 +1,48 @@
+// journal.h
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+
+#define JOURNAL_MAGIC "CHJ1"
+#define JOURNAL_BUFFER (64 * 1024)     // Records are written out when this fills up
+#define JOURNAL_FLUSH_MS 1000          // ...or this often, whichever comes first
+
+// Binary event journal, written when CHAT_JOURNAL names a file, and read
+// by journalq. After the 4-byte magic the file is a series of records,
+// each a type byte followed by unsigned LEB128 varints:
+//   JREC_SESSION  start time (ns since the epoch); resets names and time
+//   JREC_NAME     id, length, bytes: interns a user or room name
+//   JEV_*         time delta (ns since the previous record, zigzag),
+//                 subject name id, object name id (0 = none), value
+// Every server start appends a new session, so ids are per session.
+
+enum {
+    JREC_SESSION = 0x01,
+    JREC_NAME = 0x02
+};
+
+typedef enum {
+    JEV_LOGIN = 0x10,       // subject: user
+    JEV_LOGOUT,             // subject: user
+    JEV_JOIN,               // subject: user, object: room
+    JEV_LEAVE,              // subject: user, object: room
+    JEV_BROADCAST,          // subject: user, object: room, value: message bytes
+    JEV_WHISPER,            // subject: user, object: receiver, value: message bytes
+    JEV_FILE,               // subject: sender, object: receiver or #room, value: file bytes
+    JEV_DOWNLOAD,           // subject: user, object: none, value: bytes sent
+    JEV_FILTER,             // subject: user, object: room or receiver, value: FilterAction
+    JEV_LAST = JEV_FILTER
+} JournalEvent;
+
+// Open the journal named by CHAT_JOURNAL, if any. Returns 0 (also when the
+// journal is off) or -1.
+int journal_init(void);
+
+// Record an event. object may be NULL. Does nothing when the journal is off.
+void journal_event(JournalEvent type, const char* subject, const char* object, uint64_t value);
+
+// Write out buffered records.
+void journal_flush(void);
+
+#endif /* JOURNAL_H */
@@ -0,0 +1,281 @@
+// journalq.c
+// Reads the binary event journal written by chatserver (see journal.h).
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "journal.h"
+
+static const char* event_names[] = {
+    "login", "logout", "join", "leave", "broadcast", "whisper", "file", "download", "filter"
+};
+
+typedef struct {
+    const char* user;       // Filters, NULL when not given
+    const char* room;
+    int type;               // 0 when not given
+    int count_only;
+    int summary;
+} Query;
+
+// Totals by name, for the summary
+typedef struct {
+    char* name;
+    unsigned long events;
+    unsigned long broadcasts;
+    unsigned long long bytes;
+} Tally;
+
+typedef struct {
+    Tally* slots;
+    size_t cap, count;
+} TallyTable;
+
+static unsigned long by_type[JEV_LAST + 1];
+
+static void usage(void) {
+    printf("Usage: ./journalq [-u user] [-r room] [-t type] [-c | -s] <journal>\n");
+    printf("  -u, -r  only events by this user / in this room (or to this receiver)\n");
+    printf("  -t      only events of this type: login logout join leave broadcast whisper file download filter\n");
+    printf("  -c      print the number of matching events\n");
+    printf("  -s      print totals by type, user and room instead of the events\n");
+}
+
+static int get_varint(const unsigned char** p, const unsigned char* end, uint64_t* v) {
+    uint64_t out = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*p == end) return -1;
+        unsigned char b = *(*p)++;
+        out |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = out;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static uint32_t tally_hash(const char* s) {
+    uint32_t h = 2166136261u;
+    while (*s) h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+}
+
+static Tally* tally(TallyTable* t, const char* name) {
+    if ((t->count + 1) * 10 >= t->cap * 7) {
+        size_t cap = t->cap ? t->cap * 2 : 256;
+        Tally* grown = calloc(cap, sizeof(Tally));
+        if (!grown) return NULL;
+        for (size_t i = 0; i < t->cap; i++) {
+            if (!t->slots[i].name) continue;
+            size_t j = tally_hash(t->slots[i].name) & (cap - 1);
+            while (grown[j].name) j = (j + 1) & (cap - 1);
+            grown[j] = t->slots[i];
+        }
+        free(t->slots);
+        t->slots = grown;
+        t->cap = cap;
+    }
+    size_t i = tally_hash(name) & (t->cap - 1);
+    while (t->slots[i].name) {
+        if (strcmp(t->slots[i].name, name) == 0) return &t->slots[i];
+        i = (i + 1) & (t->cap - 1);
+    }
+    t->slots[i].name = strdup(name);
+    if (!t->slots[i].name) return NULL;
+    t->count++;
+    return &t->slots[i];
+}
+
+static int by_events(const void* a, const void* b) {
+    const Tally* x = a;
+    const Tally* y = b;
+    return x->events < y->events ? 1 : x->events > y->events ? -1 : 0;
+}
+
+static void print_top(const char* title, TallyTable* t, int rooms) {
+    Tally* list = malloc((t->count + 1) * sizeof(Tally));
+    if (!list) return;
+    size_t n = 0;
+    for (size_t i = 0; i < t->cap; i++) {
+        if (t->slots[i].name) list[n++] = t->slots[i];
+    }
+    qsort(list, n, sizeof(Tally), by_events);
+    printf("%s (%zu):\n", title, n);
+    for (size_t i = 0; i < n && i < 10; i++) {
+        if (rooms) printf("  %-32s %8lu events %8lu broadcasts %12llu bytes\n",
+                          list[i].name, list[i].events, list[i].broadcasts, list[i].bytes);
+        else printf("  %-16s %8lu events %8lu broadcasts %12llu bytes\n",
+                    list[i].name, list[i].events, list[i].broadcasts, list[i].bytes);
+    }
+    free(list);
+}
+
+static void print_event(uint64_t ns, int type, const char* subject, const char* object, uint64_t value) {
+    time_t secs = ns / 1000000000ull;
+    struct tm tm;
+    char when[32];
+    localtime_r(&secs, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+    printf("%s.%09llu %-9s %-16s %-16s %llu\n", when, (unsigned long long)(ns % 1000000000ull),
+           event_names[type - JEV_LOGIN], subject, object ? object : "-", (unsigned long long)value);
+}
+
+static int room_matches(const char* object, const char* room) {
+    if (!object) return 0;
+    if (object[0] == '#') object++;
+    return strcmp(object, room) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    Query q = {0};
+    int opt;
+    while ((opt = getopt(argc, argv, "u:r:t:cs")) != -1) {
+        switch (opt) {
+        case 'u': q.user = optarg; break;
+        case 'r': q.room = optarg[0] == '#' ? optarg + 1 : optarg; break;
+        case 't':
+            for (int i = 0; i <= JEV_LAST - JEV_LOGIN; i++) {
+                if (strcmp(optarg, event_names[i]) == 0) q.type = JEV_LOGIN + i;
+            }
+            if (!q.type) {
+                fprintf(stderr, "Unknown event type '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'c': q.count_only = 1; break;
+        case 's': q.summary = 1; break;
+        default:
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    int fd = open(argv[optind], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror("journal");
+        return EXIT_FAILURE;
+    }
+    if (st.st_size < 4) {
+        fprintf(stderr, "Not a journal\n");
+        return EXIT_FAILURE;
+    }
+    const unsigned char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+    madvise((void*)data, st.st_size, MADV_SEQUENTIAL);
+    if (memcmp(data, JOURNAL_MAGIC, 4) != 0) {
+        fprintf(stderr, "Not a journal\n");
+        return EXIT_FAILURE;
+    }
+
+    // Names of the current session, by id
+    char** names = NULL;
+    uint64_t names_cap = 0;
+    TallyTable users = {0}, rooms = {0};
+
+    const unsigned char* p = data + 4;
+    const unsigned char* end = data + st.st_size;
+    uint64_t now = 0;
+    unsigned long matched = 0, total = 0;
+    int truncated = 0;
+
+    while (p < end) {
+        int type = *p++;
+        uint64_t a, b, c, d;
+
+        if (type == JREC_SESSION) {
+            if (get_varint(&p, end, &a) < 0) { truncated = 1; break; }
+            now = a;
+            for (uint64_t i = 0; i < names_cap; i++) {
+                free(names[i]);
+                names[i] = NULL;
+            }
+        } else if (type == JREC_NAME) {
+            if (get_varint(&p, end, &a) < 0 || get_varint(&p, end, &b) < 0 || b > (uint64_t)(end - p)) {
+                truncated = 1;
+                break;
+            }
+            if (a >= names_cap) {
+                uint64_t cap = names_cap ? names_cap : 256;
+                while (cap <= a) cap *= 2;
+                char** grown = realloc(names, cap * sizeof(char*));
+                if (!grown) break;
+                memset(grown + names_cap, 0, (cap - names_cap) * sizeof(char*));
+                names = grown;
+                names_cap = cap;
+            }
+            free(names[a]);
+            names[a] = strndup((const char*)p, b);
+            p += b;
+        } else if (type >= JEV_LOGIN && type <= JEV_LAST) {
+            if (get_varint(&p, end, &a) < 0 || get_varint(&p, end, &b) < 0 ||
+                get_varint(&p, end, &c) < 0 || get_varint(&p, end, &d) < 0) {
+                truncated = 1;
+                break;
+            }
+            now += (int64_t)((a >> 1) ^ -(a & 1));
+            const char* subject = b && b < names_cap && names[b] ? names[b] : "?";
+            const char* object = c && c < names_cap ? names[c] : NULL;
+            total++;
+
+            if (q.type && type != q.type) continue;
+            if (q.user && strcmp(subject, q.user) != 0) continue;
+            if (q.room && !room_matches(object, q.room)) continue;
+            matched++;
+
+            if (q.summary) {
+                by_type[type]++;
+                Tally* u = tally(&users, subject);
+                if (u) {
+                    u->events++;
+                    if (type == JEV_BROADCAST) u->broadcasts++;
+                    if (type == JEV_BROADCAST || type == JEV_WHISPER || type == JEV_FILE) u->bytes += d;
+                }
+                if (object && (type == JEV_JOIN || type == JEV_LEAVE || type == JEV_BROADCAST)) {
+                    Tally* r = tally(&rooms, object);
+                    if (r) {
+                        r->events++;
+                        if (type == JEV_BROADCAST) {
+                            r->broadcasts++;
+                            r->bytes += d;
+                        }
+                    }
+                }
+            } else if (!q.count_only) {
+                print_event(now, type, subject, object, d);
+            }
+        } else {
+            fprintf(stderr, "Unknown record type 0x%02x at offset %ld\n", type, (long)(p - 1 - data));
+            break;
+        }
+    }
+
+    if (truncated) fprintf(stderr, "Journal ends in a partial record\n");
+    if (q.count_only) {
+        printf("%lu\n", matched);
+    } else if (q.summary) {
+        printf("%lu of %lu event(s) matched\n", matched, total);
+        for (int t = JEV_LOGIN; t <= JEV_LAST; t++) {
+            if (by_type[t]) printf("  %-9s %lu\n", event_names[t - JEV_LOGIN], by_type[t]);
+        }
+        print_top("Top users", &users, 0);
+        print_top("Top rooms", &rooms, 1);
+    }
+
+    munmap((void*)data, st.st_size);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,1225 @@
+// libchatclient.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <signal.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/time.h>
+
+#include "crc32c.h"
+#include "netio.h"
+#include "protocol.h"
+#include "libchatclient.h"
+
+// The chat connection is newline-framed both ways. A request goes out
+// followed by "/sync <id>"; the server handles a connection's commands in
+// order, so its "[SYNC] <id>" comes after everything it said in answer,
+// and the lines in between are the reply. Room and private messages can
+// land at any time, so they are never counted as reply lines.
+//
+// Transfers use the server's "/xfer" connections and run the blocking
+// code chatclient always had, on a thread each. Their output is queued as
+// notes, and a byte on a pipe wakes the caller's poll to deliver them.
+// Each transfer connection first presents the session key the server sent
+// right after accepting the login.
+
+#define MAX_FILENAME 256
+#define MAX_STREAMS 4                    // Parallel connections per upload
+#define STREAM_MIN_BYTES (256 * 1024)    // Smaller files use a single stream
+#define REPLY_MAX 4096
+#define SESSION_KEY_WAIT 10              // Seconds a transfer waits for the login
+#define XFER_TIMEOUT 30                  // Seconds a transfer socket may stall before it fails
+
+typedef struct Request {
+    unsigned int id;
+    cc_reply_fn fn;             // NULL: reply lines go to the line callback
+    void* arg;
+    char* text;
+    size_t len, cap;
+    int nlines;
+    int failed;
+    struct Request* next;
+} Request;
+
+typedef struct Note {
+    CcLine line;
+    struct Note* next;
+    char text[];
+} Note;
+
+typedef enum { XFER_SEND_ONE, XFER_SEND_MANY, XFER_GET } TransferKind;
+
+typedef struct Transfer {
+    ChatClient* c;
+    unsigned int id;
+    TransferKind kind;
+    char* path;                 // File or pattern to send, local name for a download (may be NULL)
+    char receiver[MAX_RECEIVER];
+    long file_id;
+    long done, total;           // Outcome, for the closing note
+    char result[REPLY_MAX];
+    pthread_t tid;
+    struct Transfer* next;
+} Transfer;
+
+struct ChatClient {
+    int fd;
+    CcState state;
+    struct sockaddr_in addr;
+    char username[CC_MAX_USERNAME];
+    char error[128];
+
+    char in[CC_LINE_MAX + 1];
+    size_t in_len;
+    char* out;
+    size_t out_len, out_cap;
+    size_t login_len;           // Bytes of out that may go before the login is accepted
+
+    Request* requests;          // Waiting for their [SYNC], oldest first
+    Request* last_request;
+    unsigned int next_request;
+
+    cc_line_fn on_line;
+    void* on_line_arg;
+
+    int notify[2];              // Transfer threads write a byte to [1]
+    pthread_mutex_t notes_lock; // Also guards the session key fields
+    pthread_cond_t key_cond;    // Signalled when the key arrives or never will
+    char session_key[SESSION_KEY_LEN + 1];
+    int key_gone;
+    Note* notes;
+    Note* last_note;
+    Transfer* transfers;
+    unsigned int next_transfer;
+};
+
+// ---- Line parsing ----
+
+static const char* body_of(const char* s) {
+    if (s[0] != '[') return s;
+    const char* end = strchr(s, ']');
+    if (!end) return s;
+    return end[1] == ' ' ? end + 2 : end + 1;
+}
+
+static CcKind classify(const char* s) {
+    if (s[0] != '[') return CC_TEXT;
+    const char* end = strchr(s, ']');
+    if (!end) return CC_TEXT;
+    const char* tag = s + 1;
+    size_t n = end - tag;
+
+    // "[user]: text" first: INFO is a valid user name
+    if (end[1] == ':') return CC_MESSAGE;
+    if (n == 4 && strncmp(tag, "INFO", 4) == 0) return CC_INFO;
+    if (n == 5 && strncmp(tag, "ERROR", 5) == 0) return CC_ERROR;
+    if (strncmp(tag, "WHISPER ", 8) == 0) return CC_WHISPER;
+    if (n >= 8 && strncmp(tag, "PRESENCE", 8) == 0) return CC_PRESENCE;
+    if (tag[0] == '#' && isdigit((unsigned char)tag[1])) return CC_MESSAGE;
+
+    // Mailbox replays are stamped "[hh:mm] " in front of the original line
+    if (n == 5 && isdigit((unsigned char)tag[0]) && tag[2] == ':') {
+        return strncmp(end + 2, "[WHISPER ", 9) == 0 ? CC_WHISPER : CC_MESSAGE;
+    }
+    return CC_REPLY;
+}
+
+static void deliver(ChatClient* c, const CcLine* line) {
+    if (c->on_line) c->on_line(c, line, c->on_line_arg);
+}
+
+// ---- Requests ----
+
+static void finish_request(ChatClient* c, int failed) {
+    Request* r = c->requests;
+    c->requests = r->next;
+    if (!c->requests) c->last_request = NULL;
+
+    if (r->fn) {
+        CcReply reply;
+        reply.id = r->id;
+        reply.failed = failed || r->failed;
+        reply.text = r->text ? r->text : "";
+        reply.len = r->len;
+        reply.nlines = r->nlines;
+        r->fn(c, &reply, r->arg);
+    }
+    free(r->text);
+    free(r);
+}
+
+static int reply_append(Request* r, const char* s, size_t len) {
+    if (r->len + len + 2 > r->cap) {
+        size_t cap = r->cap ? r->cap : 256;
+        while (cap < r->len + len + 2) cap *= 2;
+        char* grown = realloc(r->text, cap);
+        if (!grown) return -1;
+        r->text = grown;
+        r->cap = cap;
+    }
+    memcpy(r->text + r->len, s, len);
+    r->len += len;
+    r->text[r->len++] = '\n';
+    r->text[r->len] = '\0';
+    r->nlines++;
+    return 0;
+}
+
+// Transfers waiting for the session key give up
+static void drop_key(ChatClient* c) {
+    pthread_mutex_lock(&c->notes_lock);
+    c->key_gone = 1;
+    pthread_cond_broadcast(&c->key_cond);
+    pthread_mutex_unlock(&c->notes_lock);
+}
+
+static void fail(ChatClient* c, const char* why) {
+    if (c->state == CC_CLOSED) return;
+    snprintf(c->error, sizeof(c->error), "%s", why);
+    c->state = CC_CLOSED;
+    while (c->requests) finish_request(c, 1);
+    drop_key(c);
+}
+
+static void handle_line(ChatClient* c, char* s, size_t len) {
+    CcLine line;
+    memset(&line, 0, sizeof(line));
+    line.kind = classify(s);
+    line.text = s;
+    line.len = len;
+    line.body = body_of(s);
+
+    // The first line after the username is the verdict on it
+    if (c->state == CC_LOGIN) {
+        if (line.kind == CC_ERROR) fail(c, line.body);
+        else c->state = CC_READY;
+        deliver(c, &line);
+        return;
+    }
+
+    // The transfer key follows the verdict; it is kept, never shown
+    if (strncmp(s, "[SESSION] ", 10) == 0 && len == 10 + SESSION_KEY_LEN) {
+        pthread_mutex_lock(&c->notes_lock);
+        if (!c->session_key[0]) {
+            memcpy(c->session_key, s + 10, SESSION_KEY_LEN + 1);
+            pthread_cond_broadcast(&c->key_cond);
+        }
+        pthread_mutex_unlock(&c->notes_lock);
+        return;
+    }
+
+    if (line.kind == CC_REPLY && strncmp(s, "[SYNC] ", 7) == 0) {
+        unsigned int id = (unsigned int)strtoul(line.body, NULL, 10);
+        Request* r = c->requests;
+        while (r && r->id != id) r = r->next;
+        if (!r) return;
+        while (c->requests->id != id) finish_request(c, 0);
+        finish_request(c, 0);
+        return;
+    }
+
+    Request* r = c->requests;
+    int unsolicited = line.kind == CC_MESSAGE || line.kind == CC_WHISPER || line.kind == CC_PRESENCE;
+    if (!r || unsolicited || !r->fn) {
+        deliver(c, &line);
+        return;
+    }
+    if (line.kind == CC_ERROR) r->failed = 1;
+    if (reply_append(r, s, len) < 0) r->failed = 1;
+}
+
+// ---- Socket I/O ----
+
+static int out_append(ChatClient* c, const char* data, size_t len) {
+    if (c->out_len + len > c->out_cap) {
+        size_t cap = c->out_cap ? c->out_cap : 4096;
+        while (cap < c->out_len + len) cap *= 2;
+        char* grown = realloc(c->out, cap);
+        if (!grown) return -1;
+        c->out = grown;
+        c->out_cap = cap;
+    }
+    memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+    return 0;
+}
+
+static size_t writable(const ChatClient* c) {
+    if (c->state == CC_READY) return c->out_len;
+    if (c->state == CC_LOGIN) return c->login_len;
+    return 0;
+}
+
+static void flush_out(ChatClient* c) {
+    size_t limit = writable(c), sent = 0;
+    while (sent < limit) {
+        ssize_t n = send(c->fd, c->out + sent, limit - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) fail(c, strerror(errno));
+            break;
+        }
+        sent += n;
+    }
+    memmove(c->out, c->out + sent, c->out_len - sent);
+    c->out_len -= sent;
+    if (c->login_len) c->login_len -= sent < c->login_len ? sent : c->login_len;
+}
+
+static void read_input(ChatClient* c) {
+    while (c->state != CC_CLOSED) {
+        ssize_t n = recv(c->fd, c->in + c->in_len, CC_LINE_MAX - c->in_len, MSG_DONTWAIT);
+        if (n == 0) {
+            fail(c, "Connection closed by server.");
+            break;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) fail(c, strerror(errno));
+            break;
+        }
+        c->in_len += n;
+
+        size_t start = 0;
+        char* nl;
+        while ((nl = memchr(c->in + start, '\n', c->in_len - start)) != NULL) {
+            *nl = '\0';
+            handle_line(c, c->in + start, nl - (c->in + start));
+            start = nl - c->in + 1;
+        }
+        if (start == 0 && c->in_len == CC_LINE_MAX) {
+            c->in[CC_LINE_MAX] = '\0';
+            handle_line(c, c->in, CC_LINE_MAX);
+            start = CC_LINE_MAX;
+        }
+        memmove(c->in, c->in + start, c->in_len - start);
+        c->in_len -= start;
+    }
+}
+
+static void finish_connect(ChatClient* c) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) err = errno;
+    if (err) fail(c, strerror(err));
+    else c->state = CC_LOGIN;
+}
+
+// ---- Transfer notes ----
+
+static void post_note(Transfer* t, CcKind kind, long done, long total, const char* text) {
+    ChatClient* c = t->c;
+    size_t len = strlen(text);
+    Note* n = malloc(sizeof(Note) + len + 1);
+    if (!n) return;
+    memset(&n->line, 0, sizeof(n->line));
+    n->line.kind = kind;
+    n->line.len = len;
+    n->line.transfer = t->id;
+    n->line.done = done;
+    n->line.total = total;
+    n->next = NULL;
+    memcpy(n->text, text, len + 1);
+
+    pthread_mutex_lock(&c->notes_lock);
+    if (c->last_note) c->last_note->next = n;
+    else c->notes = n;
+    c->last_note = n;
+    pthread_mutex_unlock(&c->notes_lock);
+
+    // A full pipe already has the caller awake
+    char wake = 1;
+    if (write(c->notify[1], &wake, 1) < 0) {}
+}
+
+static void report(Transfer* t, CcKind kind, long done, long total, const char* fmt, ...) {
+    char text[REPLY_MAX];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(text, sizeof(text), fmt, ap);
+    va_end(ap);
+    post_note(t, kind, done, total, text);
+}
+
+// The closing line, posted by the thread once the transfer returns
+static void set_result(Transfer* t, long done, long total, const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(t->result, sizeof(t->result), fmt, ap);
+    va_end(ap);
+    t->done = done;
+    t->total = total;
+}
+
+static void reap(ChatClient* c, unsigned int id) {
+    for (Transfer** p = &c->transfers; *p; p = &(*p)->next) {
+        Transfer* t = *p;
+        if (t->id != id) continue;
+        pthread_join(t->tid, NULL);
+        *p = t->next;
+        free(t->path);
+        free(t);
+        return;
+    }
+}
+
+static void deliver_notes(ChatClient* c) {
+    char drain[64];
+    while (read(c->notify[0], drain, sizeof(drain)) > 0) {}
+
+    pthread_mutex_lock(&c->notes_lock);
+    Note* list = c->notes;
+    c->notes = c->last_note = NULL;
+    pthread_mutex_unlock(&c->notes_lock);
+
+    while (list) {
+        Note* n = list;
+        list = n->next;
+        n->line.text = n->text;
+        n->line.body = body_of(n->text);
+        deliver(c, &n->line);
+        if (n->line.kind == CC_TRANSFER_DONE) reap(c, n->line.transfer);
+        free(n);
+    }
+}
+
+// ---- Transfers: blocking, on the transfer's thread ----
+
+// Read one reply line (without the newline). Replies are short, so a byte at a time is fine.
+static int read_line(int fd, char* buf, size_t size) {
+    size_t len = 0;
+    while (len + 1 < size) {
+        char ch;
+        if (recv(fd, &ch, 1, 0) != 1) return -1;
+        if (ch == '\n') break;
+        buf[len++] = ch;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+// Transfers queued before the login is through wait for its key
+static int wait_session_key(ChatClient* c, char* key) {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += SESSION_KEY_WAIT;
+
+    pthread_mutex_lock(&c->notes_lock);
+    while (!c->session_key[0] && !c->key_gone) {
+        if (pthread_cond_timedwait(&c->key_cond, &c->notes_lock, &until) == ETIMEDOUT) break;
+    }
+    int ok = c->session_key[0] != '\0';
+    if (ok) memcpy(key, c->session_key, SESSION_KEY_LEN + 1);
+    pthread_mutex_unlock(&c->notes_lock);
+    return ok ? 0 : -1;
+}
+
+// Transfer connections: a separate socket per stream, opened with "/xfer"
+// and bound to this login with "/auth <key>". They block, so a stalled
+// server fails the transfer after XFER_TIMEOUT instead of hanging the
+// thread cc_close() joins.
+static int open_xfer(ChatClient* c) {
+    char key[SESSION_KEY_LEN + 1];
+    if (wait_session_key(c, key) < 0) return -1;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    struct timeval tv = { XFER_TIMEOUT, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));    // Covers connect() too
+    if (connect(fd, (const struct sockaddr*)&c->addr, sizeof(c->addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    send_all(fd, XFER_HELLO "\n", strlen(XFER_HELLO) + 1);
+
+    char line[64];
+    if (read_line(fd, line, sizeof(line)) < 0 || strncmp(line, "[XFER] ready", 12) != 0) {
+        close(fd);
+        return -1;
+    }
+    snprintf(line, sizeof(line), "/auth %s\n", key);
+    send_all(fd, line, strlen(line));
+    if (read_line(fd, line, sizeof(line)) < 0 || strncmp(line, "[AUTH] ", 7) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+typedef struct {
+    int file_fd;
+    const char* filename;
+    const char* map;             // File contents, mapped for the checksums
+    char token[32];
+    long size;
+    long acked;                  // Bytes the server has confirmed
+    unsigned int chunk_size;
+    unsigned int nchunks;
+    unsigned int* missing;       // Chunk indexes the server doesn't have yet
+    unsigned int nmissing;
+    unsigned int next;           // Next entry of missing to claim
+    int failed;
+    pthread_mutex_t lock;
+} UploadJob;
+
+typedef struct {
+    UploadJob* job;
+    int fd;
+} UploadStream;
+
+// Chunk header, then the body straight from the file with sendfile();
+// only the checksum touches the data, through the mapping.
+static int send_chunk(int fd, UploadJob* job, unsigned int index) {
+    off_t off = (off_t)index * job->chunk_size;
+    size_t len = job->size - off < job->chunk_size ? job->size - off : job->chunk_size;
+    uint32_t crc = crc32c(0, job->map + off, len);
+
+    char header[128];
+    snprintf(header, sizeof(header), "/chunk %s %u %zu %08x\n", job->token, index, len, crc);
+    if (send_all(fd, header, strlen(header)) < 0) return -1;
+    while (len > 0) {
+        ssize_t n = sendfile(fd, job->file_fd, &off, len);
+        if (n <= 0) return -1;
+        len -= n;
+    }
+    return 0;
+}
+
+static unsigned int chunk_bytes(const UploadJob* job, unsigned int index) {
+    long off = (long)index * job->chunk_size;
+    return job->size - off < job->chunk_size ? job->size - off : job->chunk_size;
+}
+
+// Streams claim chunks from the shared list until it runs out
+static void* upload_stream(void* arg) {
+    UploadStream* st = arg;
+    UploadJob* job = st->job;
+
+    while (1) {
+        pthread_mutex_lock(&job->lock);
+        if (job->failed || job->next >= job->nmissing) {
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+        unsigned int index = job->missing[job->next++];
+        pthread_mutex_unlock(&job->lock);
+
+        // A chunk that fails its checksum on the server is sent again
+        int acked = 0;
+        for (int attempt = 0; attempt < 3 && !acked; attempt++) {
+            char reply[128];
+            if (send_chunk(st->fd, job, index) < 0 || read_line(st->fd, reply, sizeof(reply)) < 0) break;
+            acked = strncmp(reply, "[ACK]", 5) == 0;
+        }
+        if (!acked) {
+            job->failed = 1;
+            break;
+        }
+    }
+    return NULL;
+}
+
+// Open and check a file for upload; leaves the reason in why and returns -1 if it can't go
+static int open_upload(const char* filename, struct stat* st, char* why, size_t size) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        snprintf(why, size, "[ERROR] Cannot open file '%s'.", filename);
+        return -1;
+    }
+
+    if (fstat(fd, st) < 0) {
+        snprintf(why, size, "[ERROR] File stat failed.");
+        close(fd);
+        return -1;
+    }
+
+    if (st->st_size > MAX_FILE_SIZE) {
+        snprintf(why, size, "[ERROR] File '%s' exceeds 3MB limit.", filename);
+        close(fd);
+        return -1;
+    }
+
+    // Uzantı kontrolü
+    const char* allowed[] = {".txt", ".pdf", ".png", ".jpg"};
+    int valid = 0;
+    for (int i = 0; i < 4; i++) {
+        if (strstr(filename, allowed[i])) {
+            valid = 1;
+            break;
+        }
+    }
+    if (!valid) {
+        snprintf(why, size, "[ERROR] Unsupported file type: '%s'.", filename);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// The upload header names the content too (CRC-32C of the whole file), so
+// a resume only picks up chunks of the same file and the server can check
+// the assembled result
+static int upload_header(const Transfer* t, char* buf, size_t size, int fd, const char* filename, long filesize) {
+    uint32_t crc = 0;
+    if (filesize > 0) {
+        void* map = mmap(NULL, filesize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) return -1;
+        crc = crc32c(0, map, filesize);
+        munmap(map, filesize);
+    }
+    const char* base = strrchr(filename, '/');
+    base = base ? base + 1 : filename;
+    snprintf(buf, size, "/upload %s %s %ld %08x\n", t->receiver, base, filesize, crc);
+    return 0;
+}
+
+// Fill a job from the server's "[UPLOAD] token chunk nchunks bitmap" reply
+static int start_job(UploadJob* job, const char* reply) {
+    char* bitmap = malloc(strlen(reply) + 1);
+    if (!bitmap) return -1;
+    if (sscanf(reply, "[UPLOAD] %31s %u %u %s", job->token, &job->chunk_size, &job->nchunks, bitmap) != 4 ||
+        strlen(bitmap) != job->nchunks) {
+        free(bitmap);
+        return -1;
+    }
+    if (job->size > 0) {
+        void* map = mmap(NULL, job->size, PROT_READ, MAP_PRIVATE, job->file_fd, 0);
+        if (map == MAP_FAILED) {
+            free(bitmap);
+            return -1;
+        }
+        job->map = map;
+    }
+    job->missing = malloc((job->nchunks + 1) * sizeof(unsigned int));
+    if (!job->missing) {
+        free(bitmap);
+        return -1;
+    }
+    for (unsigned int i = 0; i < job->nchunks; i++) {
+        if (bitmap[i] == '0') job->missing[job->nmissing++] = i;
+        else job->acked += chunk_bytes(job, i);
+    }
+    free(bitmap);
+    return 0;
+}
+
+static void end_job(UploadJob* job) {
+    if (job->map) munmap((void*)job->map, job->size);
+    free(job->missing);
+    close(job->file_fd);
+}
+
+// Dosya gönderme
+static void send_file(Transfer* t) {
+    const char* filename = t->path;
+    char header[REPLY_MAX], reply[REPLY_MAX];
+    struct stat st;
+    int fd = open_upload(filename, &st, reply, sizeof(reply));
+    if (fd < 0) {
+        set_result(t, 0, 1, "%s", reply);
+        return;
+    }
+
+    if (upload_header(t, header, sizeof(header), fd, filename, (long)st.st_size) < 0) {
+        set_result(t, 0, 1, "[ERROR] Cannot read file '%s'.", filename);
+        close(fd);
+        return;
+    }
+
+    // Upload header; the server answers with what it already has
+    int ctrl = open_xfer(t->c);
+    if (ctrl < 0) {
+        set_result(t, 0, 1, "[ERROR] Cannot open transfer connection.");
+        close(fd);
+        return;
+    }
+    send_all(ctrl, header, strlen(header));
+
+    UploadJob job;
+    memset(&job, 0, sizeof(job));
+    job.file_fd = fd;
+    job.filename = filename;
+    job.size = st.st_size;
+    reply[0] = '\0';
+    if (read_line(ctrl, reply, sizeof(reply)) < 0 || start_job(&job, reply) < 0) {
+        set_result(t, 0, 1, "%s", strncmp(reply, "[ERROR]", 7) == 0 ? reply : "[ERROR] Upload refused.");
+        end_job(&job);
+        close(ctrl);
+        return;
+    }
+    pthread_mutex_init(&job.lock, NULL);
+    if (job.nmissing < job.nchunks) {
+        report(t, CC_INFO, 0, 0, "[INFO] Resuming upload: %u of %u chunk(s) already on server.",
+               job.nchunks - job.nmissing, job.nchunks);
+    }
+
+    // Big files go over several connections at once
+    int nstreams = st.st_size >= STREAM_MIN_BYTES ? MAX_STREAMS : 1;
+    if ((unsigned int)nstreams > job.nmissing) nstreams = job.nmissing ? job.nmissing : 1;
+    UploadStream streams[MAX_STREAMS];
+    pthread_t tids[MAX_STREAMS];
+    streams[0].job = &job;
+    streams[0].fd = ctrl;
+    int started = 1;
+    for (int i = 1; i < nstreams; i++) {
+        streams[started].job = &job;
+        streams[started].fd = open_xfer(t->c);
+        if (streams[started].fd < 0) break;
+        if (pthread_create(&tids[started], NULL, upload_stream, &streams[started]) != 0) {
+            close(streams[started].fd);
+            break;
+        }
+        started++;
+    }
+    upload_stream(&streams[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(tids[i], NULL);
+        close(streams[i].fd);
+    }
+
+    if (job.failed) {
+        set_result(t, 0, 1, "[ERROR] Upload of '%s' interrupted; run /sendfile again to resume.", filename);
+    } else {
+        snprintf(header, sizeof(header), "/commit %s\n", job.token);
+        send_all(ctrl, header, strlen(header));
+        if (read_line(ctrl, reply, sizeof(reply)) >= 0 && strcmp(reply, "[DONE]") == 0) {
+            set_result(t, 1, 1, "[INFO] File '%s' sent to %s.", filename, t->receiver);
+        } else {
+            set_result(t, 0, 1, "%s", strncmp(reply, "[ERROR]", 7) == 0 ? reply : "[ERROR] Commit failed.");
+        }
+    }
+
+    pthread_mutex_destroy(&job.lock);
+    end_job(&job);
+    close(ctrl);
+}
+
+// One chunk in flight on a pipelined batch connection
+typedef struct {
+    UploadJob* job;
+    unsigned int index;
+} BatchChunk;
+
+typedef struct {
+    Transfer* t;
+    int fd;
+    BatchChunk* plan;            // Chunks in the order they are sent
+    unsigned int count;
+    BatchChunk* retry;           // Chunks the server refused, for the next pass
+    unsigned int nretry;
+    long total, acked;
+    int broken;
+} BatchPass;
+
+// Replies arrive in send order, so the reader just walks the plan
+static void* batch_reader(void* arg) {
+    BatchPass* pass = arg;
+    int last_pct = -1;
+    for (unsigned int i = 0; i < pass->count; i++) {
+        char reply[128];
+        if (read_line(pass->fd, reply, sizeof(reply)) < 0) {
+            pass->broken = 1;
+            break;
+        }
+        BatchChunk* ch = &pass->plan[i];
+        if (strncmp(reply, "[ACK]", 5) == 0) {
+            unsigned int len = chunk_bytes(ch->job, ch->index);
+            ch->job->acked += len;
+            pass->acked += len;
+        } else {
+            pass->retry[pass->nretry++] = *ch;
+        }
+
+        int pct = pass->total ? (int)(pass->acked * 100 / pass->total) : 100;
+        if (pct != last_pct) {
+            report(pass->t, CC_PROGRESS, pass->acked, pass->total,
+                   "[INFO] Uploading: %ld/%ld bytes (%d%%)", pass->acked, pass->total, pct);
+            last_pct = pct;
+        }
+    }
+    return NULL;
+}
+
+// Upload every file matching a pattern over one connection: all headers go
+// out together, then every chunk back to back while a reader thread takes
+// the acknowledgements, then all commits. Nothing waits on a round trip.
+static void send_files(Transfer* t) {
+    const char* pattern = t->path;
+    glob_t g;
+    if (glob(pattern, 0, NULL, &g) != 0 || g.gl_pathc == 0) {
+        set_result(t, 0, 0, "[ERROR] No files match '%s'.", pattern);
+        globfree(&g);
+        return;
+    }
+
+    UploadJob* jobs = calloc(g.gl_pathc, sizeof(UploadJob));
+    char* headers = malloc(g.gl_pathc * (MAX_FILENAME + 64));
+    int ctrl = open_xfer(t->c);
+    if (!jobs || !headers || ctrl < 0) {
+        set_result(t, 0, g.gl_pathc, "[ERROR] Cannot open transfer connection.");
+        if (ctrl >= 0) close(ctrl);
+        free(headers);
+        free(jobs);
+        globfree(&g);
+        return;
+    }
+
+    size_t njobs = 0, hlen = 0;
+    for (size_t i = 0; i < g.gl_pathc; i++) {
+        struct stat st;
+        char why[REPLY_MAX];
+        int fd = open_upload(g.gl_pathv[i], &st, why, sizeof(why));
+        if (fd < 0) {
+            report(t, CC_ERROR, 0, 0, "%s", why);
+            continue;
+        }
+        if (upload_header(t, headers + hlen, MAX_FILENAME + 64, fd, g.gl_pathv[i], (long)st.st_size) < 0) {
+            report(t, CC_ERROR, 0, 0, "[ERROR] Cannot read file '%s'.", g.gl_pathv[i]);
+            close(fd);
+            continue;
+        }
+        jobs[njobs].file_fd = fd;
+        jobs[njobs].filename = g.gl_pathv[i];
+        jobs[njobs].size = st.st_size;
+        hlen += strlen(headers + hlen);
+        njobs++;
+    }
+    send_all(ctrl, headers, hlen);
+
+    // Replies to the headers, in order; refused files drop out here
+    unsigned int nplan = 0;
+    long total = 0, already = 0;
+    for (size_t i = 0; i < njobs; i++) {
+        char reply[REPLY_MAX];
+        reply[0] = '\0';
+        if (read_line(ctrl, reply, sizeof(reply)) < 0 || start_job(&jobs[i], reply) < 0) {
+            report(t, CC_ERROR, 0, 0, "[ERROR] '%s': %s", jobs[i].filename,
+                   strncmp(reply, "[ERROR]", 7) == 0 ? reply + 8 : "Upload refused.");
+            jobs[i].failed = 1;
+            jobs[i].token[0] = '\0';
+            continue;
+        }
+        nplan += jobs[i].nmissing;
+        total += jobs[i].size;
+        already += jobs[i].acked;
+    }
+
+    BatchPass pass;
+    memset(&pass, 0, sizeof(pass));
+    pass.t = t;
+    pass.fd = ctrl;
+    pass.plan = malloc((nplan + 1) * sizeof(BatchChunk));
+    pass.retry = malloc((nplan + 1) * sizeof(BatchChunk));
+    pass.total = total;
+    pass.acked = already;
+    if (!pass.plan || !pass.retry) pass.broken = 1;
+    for (size_t i = 0; !pass.broken && i < njobs; i++) {
+        for (unsigned int k = 0; !jobs[i].failed && k < jobs[i].nmissing; k++) {
+            pass.plan[pass.count].job = &jobs[i];
+            pass.plan[pass.count++].index = jobs[i].missing[k];
+        }
+    }
+
+    // Refused chunks get two more passes
+    for (int attempt = 0; attempt < 3 && pass.count > 0 && !pass.broken; attempt++) {
+        pthread_t reader;
+        pass.nretry = 0;
+        if (pthread_create(&reader, NULL, batch_reader, &pass) != 0) {
+            pass.broken = 1;
+            break;
+        }
+        for (unsigned int i = 0; i < pass.count; i++) {
+            if (send_chunk(ctrl, pass.plan[i].job, pass.plan[i].index) < 0) {
+                // Unblock the reader; it sees the connection go
+                shutdown(ctrl, SHUT_RDWR);
+                break;
+            }
+        }
+        pthread_join(reader, NULL);
+
+        BatchChunk* swap = pass.plan;
+        pass.plan = pass.retry;
+        pass.retry = swap;
+        pass.count = pass.nretry;
+    }
+    for (unsigned int i = 0; i < pass.count; i++) pass.plan[i].job->failed = 1;
+
+    // Commits, pipelined the same way
+    if (!pass.broken) {
+        hlen = 0;
+        for (size_t i = 0; i < njobs; i++) {
+            if (jobs[i].failed) continue;
+            hlen += sprintf(headers + hlen, "/commit %s\n", jobs[i].token);
+        }
+        send_all(ctrl, headers, hlen);
+    }
+
+    int sent = 0;
+    for (size_t i = 0; i < njobs; i++) {
+        char reply[REPLY_MAX];
+        reply[0] = '\0';
+        if (jobs[i].failed || pass.broken) {
+            if (jobs[i].token[0]) {
+                report(t, CC_ERROR, 0, 0, "[ERROR] Upload of '%s' interrupted; run /sendfiles again to resume.",
+                       jobs[i].filename);
+            }
+        } else if (read_line(ctrl, reply, sizeof(reply)) >= 0 && strcmp(reply, "[DONE]") == 0) {
+            report(t, CC_INFO, 0, 0, "[INFO] File '%s' sent to %s.", jobs[i].filename, t->receiver);
+            sent++;
+        } else {
+            report(t, CC_ERROR, 0, 0, "[ERROR] '%s': %s", jobs[i].filename,
+                   strncmp(reply, "[ERROR]", 7) == 0 ? reply + 8 : "Commit failed.");
+        }
+        end_job(&jobs[i]);
+    }
+    set_result(t, sent, g.gl_pathc, "%s %d of %zu file(s) sent to %s.",
+               (size_t)sent == g.gl_pathc ? "[INFO]" : "[ERROR]", sent, g.gl_pathc, t->receiver);
+
+    free(pass.plan);
+    free(pass.retry);
+    free(headers);
+    free(jobs);
+    close(ctrl);
+    globfree(&g);
+}
+
+// Whether the first length bytes of out match stored file id, by the
+// server's CRC of the same range. Returns 1, 0, or -1 on a failed check.
+static int same_prefix(int fd, int out, long id, long length) {
+    char line[REPLY_MAX], buf[REPLY_MAX * 16];
+    uint32_t crc = 0, server_crc;
+    long pos = 0;
+    while (pos < length) {
+        ssize_t n = pread(out, buf, length - pos < (long)sizeof(buf) ? length - pos : (long)sizeof(buf), pos);
+        if (n <= 0) return -1;
+        crc = crc32c(crc, buf, n);
+        pos += n;
+    }
+
+    snprintf(line, sizeof(line), "/filecrc %ld %ld\n", id, length);
+    send_all(fd, line, strlen(line));
+    if (read_line(fd, line, sizeof(line)) < 0 ||
+        sscanf(line, "[FILECRC] %*s %*s %x", &server_crc) != 1) {
+        return -1;
+    }
+    return crc == server_crc;
+}
+
+// Download a stored file. A local file of that name is only written to
+// when it is a prefix of the stored one, checked by CRC; the download then
+// resumes from its end with a range request. Any other file is left alone.
+static void get_file(Transfer* t) {
+    long id = t->file_id;
+    int fd = open_xfer(t->c);
+    if (fd < 0) {
+        set_result(t, 0, 1, "[ERROR] Cannot open transfer connection.");
+        return;
+    }
+
+    char line[REPLY_MAX], name[MAX_FILENAME], sender[CC_MAX_USERNAME];
+    long size;
+    snprintf(line, sizeof(line), "/fileinfo %ld\n", id);
+    send_all(fd, line, strlen(line));
+    if (read_line(fd, line, sizeof(line)) < 0 ||
+        sscanf(line, "[FILEINFO] %*s %ld %16s %255[^\n]", &size, sender, name) != 3) {
+        set_result(t, 0, 1, "%s", strncmp(line, "[ERROR]", 7) == 0 ? line : "[ERROR] Download refused.");
+        close(fd);
+        return;
+    }
+    const char* outname = t->path ? t->path : name;
+
+    long offset = 0;
+    int out = open(outname, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (out < 0 && errno == EEXIST) {
+        struct stat st;
+        out = open(outname, O_RDWR);
+        if (out < 0 || fstat(out, &st) < 0) {
+            set_result(t, 0, 1, "[ERROR] Cannot write '%s'.", outname);
+            if (out >= 0) close(out);
+            close(fd);
+            return;
+        }
+        int same = S_ISREG(st.st_mode) && st.st_size <= size ? same_prefix(fd, out, id, st.st_size) : 0;
+        if (same <= 0) {
+            set_result(t, 0, 1, same < 0 ? "[ERROR] Cannot check '%s' against file #%ld."
+                                         : "[ERROR] '%s' exists and is not part of file #%ld; not overwritten.",
+                       outname, id);
+            close(out);
+            close(fd);
+            return;
+        }
+        offset = st.st_size;
+        if (offset == size) {
+            set_result(t, 1, 1, "[INFO] '%s' already holds file #%ld from %s (%ld bytes).", outname, id, sender, size);
+            close(out);
+            close(fd);
+            return;
+        }
+        if (offset > 0) {
+            report(t, CC_INFO, 0, 0, "[INFO] Resuming '%s' at %ld of %ld bytes.", outname, offset, size);
+        }
+    }
+    if (out < 0 || lseek(out, offset, SEEK_SET) < 0) {
+        set_result(t, 0, 1, "[ERROR] Cannot write '%s'.", outname);
+        close(out);
+        close(fd);
+        return;
+    }
+
+    long length;
+    snprintf(line, sizeof(line), "/getfile %ld %ld\n", id, offset);
+    send_all(fd, line, strlen(line));
+    if (read_line(fd, line, sizeof(line)) < 0 ||
+        sscanf(line, "[FILE] %*s %*s %*s %ld", &length) != 1) {
+        set_result(t, 0, 1, "%s", strncmp(line, "[ERROR]", 7) == 0 ? line : "[ERROR] Download refused.");
+        close(out);
+        close(fd);
+        return;
+    }
+
+    char buf[REPLY_MAX * 16];
+    long left = length;
+    while (left > 0) {
+        ssize_t n = recv(fd, buf, left < (long)sizeof(buf) ? left : (long)sizeof(buf), 0);
+        if (n <= 0 || write(out, buf, n) != n) break;
+        left -= n;
+    }
+
+    if (left > 0) {
+        set_result(t, 0, 1, "[ERROR] Download of '%s' interrupted; run /getfile again to resume.", outname);
+    } else {
+        set_result(t, 1, 1, "[INFO] Saved file #%ld from %s as '%s' (%ld bytes).", id, sender, outname, size);
+    }
+    close(out);
+    close(fd);
+}
+
+static void* transfer_thread(void* arg) {
+    Transfer* t = arg;
+
+    // sendfile() has no MSG_NOSIGNAL; a dropped transfer connection must
+    // fail the call, not kill the program. Stream threads inherit this.
+    sigset_t pipe_only;
+    sigemptyset(&pipe_only);
+    sigaddset(&pipe_only, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_only, NULL);
+
+    if (t->kind == XFER_SEND_ONE) send_file(t);
+    else if (t->kind == XFER_SEND_MANY) send_files(t);
+    else get_file(t);
+    post_note(t, CC_TRANSFER_DONE, t->done, t->total, t->result);
+    return NULL;
+}
+
+static unsigned int start_transfer(ChatClient* c, TransferKind kind, const char* path,
+                                   const char* receiver, long file_id) {
+    Transfer* t = calloc(1, sizeof(Transfer));
+    if (!t) return 0;
+    if (path && !(t->path = strdup(path))) {
+        free(t);
+        return 0;
+    }
+    t->c = c;
+    t->kind = kind;
+    t->file_id = file_id;
+    if (receiver) snprintf(t->receiver, sizeof(t->receiver), "%s", receiver);
+    t->id = ++c->next_transfer;
+
+    if (pthread_create(&t->tid, NULL, transfer_thread, t) != 0) {
+        free(t->path);
+        free(t);
+        return 0;
+    }
+    t->next = c->transfers;
+    c->transfers = t;
+    return t->id;
+}
+
+// ---- Public API ----
+
+ChatClient* cc_open(const char* ip, int port, const char* username) {
+    size_t ulen = strlen(username);
+    if (ulen == 0 || ulen >= CC_MAX_USERNAME) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    ChatClient* c = calloc(1, sizeof(ChatClient));
+    if (!c) return NULL;
+    c->fd = -1;
+    c->notify[0] = c->notify[1] = -1;
+    memcpy(c->username, username, ulen + 1);
+    c->addr.sin_family = AF_INET;
+    c->addr.sin_port = htons(port);
+    pthread_mutex_init(&c->notes_lock, NULL);
+    pthread_cond_init(&c->key_cond, NULL);
+
+    if (inet_pton(AF_INET, ip, &c->addr.sin_addr) != 1) {
+        errno = EINVAL;
+        cc_close(c);
+        return NULL;
+    }
+    if (pipe(c->notify) < 0 ||
+        fcntl(c->notify[0], F_SETFL, O_NONBLOCK) < 0 || fcntl(c->notify[1], F_SETFL, O_NONBLOCK) < 0) {
+        cc_close(c);
+        return NULL;
+    }
+
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (c->fd < 0) {
+        cc_close(c);
+        return NULL;
+    }
+    if (connect(c->fd, (struct sockaddr*)&c->addr, sizeof(c->addr)) == 0) {
+        c->state = CC_LOGIN;
+    } else if (errno == EINPROGRESS) {
+        c->state = CC_CONNECTING;
+    } else {
+        cc_close(c);
+        return NULL;
+    }
+
+    // The server reads the name with a single recv(), so nothing may
+    // follow it until the answer is in
+    if (out_append(c, username, ulen) < 0) {
+        cc_close(c);
+        return NULL;
+    }
+    c->login_len = ulen;
+    return c;
+}
+
+void cc_close(ChatClient* c) {
+    if (!c) return;
+    drop_key(c);
+    while (c->transfers) {
+        Transfer* t = c->transfers;
+        c->transfers = t->next;
+        pthread_join(t->tid, NULL);
+        free(t->path);
+        free(t);
+    }
+    while (c->notes) {
+        Note* n = c->notes;
+        c->notes = n->next;
+        free(n);
+    }
+    while (c->requests) {
+        Request* r = c->requests;
+        c->requests = r->next;
+        free(r->text);
+        free(r);
+    }
+    if (c->fd >= 0) close(c->fd);
+    if (c->notify[0] >= 0) close(c->notify[0]);
+    if (c->notify[1] >= 0) close(c->notify[1]);
+    pthread_mutex_destroy(&c->notes_lock);
+    pthread_cond_destroy(&c->key_cond);
+    free(c->out);
+    free(c);
+}
+
+void cc_on_line(ChatClient* c, cc_line_fn fn, void* arg) {
+    c->on_line = fn;
+    c->on_line_arg = arg;
+}
+
+CcState cc_state(const ChatClient* c) {
+    return c->state;
+}
+
+const char* cc_error(const ChatClient* c) {
+    return c->error;
+}
+
+int cc_pollfds(ChatClient* c, struct pollfd* fds) {
+    fds[0].fd = c->state == CC_CLOSED ? -1 : c->fd;
+    fds[0].events = c->state == CC_CONNECTING ? POLLOUT : POLLIN | (writable(c) ? POLLOUT : 0);
+    fds[0].revents = 0;
+    fds[1].fd = c->notify[0];
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+    return CC_POLLFDS;
+}
+
+int cc_process(ChatClient* c, const struct pollfd* fds) {
+    if (fds[1].revents & POLLIN) deliver_notes(c);
+
+    if (c->state != CC_CLOSED && fds[0].revents) {
+        if (c->state == CC_CONNECTING) finish_connect(c);
+        else if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) read_input(c);
+        if (c->state != CC_CLOSED) flush_out(c);
+    }
+    return c->state == CC_CLOSED ? -1 : 0;
+}
+
+int cc_poll(ChatClient* c, int timeout_ms) {
+    struct pollfd fds[CC_POLLFDS];
+    int n = cc_pollfds(c, fds);
+    if (poll(fds, n, timeout_ms) < 0 && errno != EINTR) {
+        fail(c, strerror(errno));
+        return -1;
+    }
+    return cc_process(c, fds);
+}
+
+unsigned int cc_request(ChatClient* c, const char* line, cc_reply_fn fn, void* arg) {
+    if (c->state == CC_CLOSED) return 0;
+    Request* r = calloc(1, sizeof(Request));
+    if (!r) return 0;
+    r->id = ++c->next_request;
+    if (r->id == 0) r->id = ++c->next_request;
+    r->fn = fn;
+    r->arg = arg;
+
+    // One command per request; the marker follows it in the same write
+    char sync[32];
+    int slen = snprintf(sync, sizeof(sync), "\n/sync %u\n", r->id);
+    size_t mark = c->out_len;
+    if (out_append(c, line, strcspn(line, "\n")) < 0 || out_append(c, sync, slen) < 0) {
+        c->out_len = mark;
+        free(r);
+        return 0;
+    }
+
+    if (c->last_request) c->last_request->next = r;
+    else c->requests = r;
+    c->last_request = r;
+    return r->id;
+}
+
+int cc_send(ChatClient* c, const char* line) {
+    return cc_request(c, line, NULL, NULL) ? 0 : -1;
+}
+
+unsigned int cc_send_file(ChatClient* c, const char* path, const char* receiver) {
+    return start_transfer(c, XFER_SEND_ONE, path, receiver, 0);
+}
+
+unsigned int cc_send_files(ChatClient* c, const char* pattern, const char* receiver) {
+    return start_transfer(c, XFER_SEND_MANY, pattern, receiver, 0);
+}
+
+unsigned int cc_get_file(ChatClient* c, long id, const char* outname) {
+    return start_transfer(c, XFER_GET, outname, NULL, id);
+}
+
+int cc_transfers(const ChatClient* c) {
+    int n = 0;
+    for (const Transfer* t = c->transfers; t; t = t->next) n++;
+    return n;
+}
@@ -0,0 +1,115 @@
+// libchatclient.h
+#ifndef LIBCHATCLIENT_H
+#define LIBCHATCLIENT_H
+
+#include <stddef.h>
+#include <poll.h>
+
+// Client side of the chat protocol, for chatclient and anything else that
+// talks to the server: bots, load generators, tests.
+//
+// Nothing blocks. The caller polls the descriptors from cc_pollfds() (or
+// just calls cc_poll()), and cc_process() does the reads and writes and
+// makes the callbacks, on the caller's thread. Commands may be queued at
+// any time, before the login is through too; they go out back to back
+// without waiting for each other's replies. File transfers run on their
+// own connections in a background thread and report through the line
+// callback like everything else.
+//
+// A callback may queue more commands and transfers, but must not call
+// cc_close().
+
+#define CC_MAX_USERNAME 17
+#define CC_LINE_MAX 4096            // Longer lines are handed over in pieces
+#define CC_POLLFDS 2                // Descriptors cc_pollfds() fills
+
+typedef struct ChatClient ChatClient;
+
+typedef enum {
+    CC_CONNECTING,
+    CC_LOGIN,                       // Username sent, waiting for the verdict
+    CC_READY,
+    CC_CLOSED                       // See cc_error() for why
+} CcState;
+
+// What a line is, going by its leading [tag]
+typedef enum {
+    CC_INFO,                        // [INFO] ...
+    CC_ERROR,                       // [ERROR] ...
+    CC_MESSAGE,                     // A room message, live or replayed: [#seq] [user]: text
+    CC_WHISPER,                     // [WHISPER user]: text
+    CC_PRESENCE,                    // [PRESENCE] and [PRESENCE #room] updates
+    CC_REPLY,                       // Any other tag: [ROOMS], [WHO], [STATS], [FILES], ...
+    CC_TEXT,                        // No tag, e.g. the entries under a [ROOMS] header
+    CC_PROGRESS,                    // Upload progress: done of total bytes
+    CC_TRANSFER_DONE                // Last line of a transfer: done of total file(s) went through
+} CcKind;
+
+typedef struct {
+    CcKind kind;
+    const char* text;               // The whole line, without its newline
+    size_t len;
+    const char* body;               // text after the leading tag
+    unsigned int transfer;          // The transfer it came from, 0 for server lines
+    long done, total;               // CC_PROGRESS and CC_TRANSFER_DONE
+} CcLine;
+
+// Everything the server said in answer to one cc_request(). Room and
+// private messages arriving meanwhile go to the line callback instead.
+typedef struct {
+    unsigned int id;
+    int failed;                     // An [ERROR] came back, or the connection closed first
+    const char* text;               // The lines, each newline-terminated
+    size_t len;
+    int nlines;
+} CcReply;
+
+// Pointers in the line or reply are only valid during the call
+typedef void (*cc_line_fn)(ChatClient* c, const CcLine* line, void* arg);
+typedef void (*cc_reply_fn)(ChatClient* c, const CcReply* reply, void* arg);
+
+// Start connecting to an IPv4 address and queue the login. NULL on error.
+ChatClient* cc_open(const char* ip, int port, const char* username);
+
+// Join the transfers still running, then close everything. A transfer
+// whose server stops answering gives up within 30 seconds.
+void cc_close(ChatClient* c);
+
+// Where unsolicited lines, replies to cc_send() and transfer output go
+void cc_on_line(ChatClient* c, cc_line_fn fn, void* arg);
+
+CcState cc_state(const ChatClient* c);
+const char* cc_error(const ChatClient* c);
+
+// Fill fds[0..CC_POLLFDS) for poll(); hand the result to cc_process().
+// Returns CC_POLLFDS.
+int cc_pollfds(ChatClient* c, struct pollfd* fds);
+
+// Do the I/O poll reported and make the callbacks. Returns -1 once the
+// connection is closed; transfer output still arrives after that.
+int cc_process(ChatClient* c, const struct pollfd* fds);
+
+// cc_pollfds(), poll() and cc_process() in one call
+int cc_poll(ChatClient* c, int timeout_ms);
+
+// Queue one command line. Its reply lines go to the line callback as they
+// arrive. Returns 0, or -1 if the connection is closed.
+int cc_send(ChatClient* c, const char* line);
+
+// Queue one command line and collect its reply for fn. Returns the
+// request id, or 0 if it could not be queued.
+unsigned int cc_request(ChatClient* c, const char* line, cc_reply_fn fn, void* arg);
+
+// Background transfers; each returns a transfer id, or 0 if it could not start.
+// One file over up to four connections, resuming what the server already has:
+unsigned int cc_send_file(ChatClient* c, const char* path, const char* receiver);
+// Every file matching a glob pattern, pipelined over one connection:
+unsigned int cc_send_files(ChatClient* c, const char* pattern, const char* receiver);
+// A stored file, resuming a local copy the server confirms is its prefix and
+// never overwriting any other file; outname NULL keeps its name:
+unsigned int cc_get_file(ChatClient* c, long id, const char* outname);
+
+// Transfers started and not yet finished
+int cc_transfers(const ChatClient* c);
+
+#endif /* LIBCHATCLIENT_H */
@@ -0,0 +1,235 @@
+// mailbox.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "chatserver.h"
+#include "shard.h"
+#include "mailbox.h"
+
+// Each user has mailbox/<user>.mbox, an append-only file of message lines.
+// The head index remembers, per user, where undelivered data starts and
+// ends, so logins and cap checks never have to touch the disk. Users who
+// ever logged in are listed in MAILBOX_USERS_FILE and kept in a hash set.
+
+typedef struct {
+    char user[MAX_USERNAME];
+    off_t head;       // First undelivered byte
+    off_t tail;       // End of file
+    int count;        // Undelivered messages
+} MailboxHead;
+
+static MailboxHead heads[MAILBOX_MAX_USERS];
+static int nheads = 0;
+static char known[MAILBOX_KNOWN_SLOTS][MAX_USERNAME];  // Open addressing, "" = empty
+static int nknown = 0;
+static pthread_mutex_t mailbox_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void mailbox_path(char* buf, size_t size, const char* user) {
+    snprintf(buf, size, "%s/%s.mbox", MAILBOX_DIR, user);
+}
+
+// Slot holding user, or the empty slot where it would go; NULL if the set
+// is full and user isn't in it. Caller holds mailbox_mutex.
+static char* known_slot(const char* user) {
+    uint32_t h = 2166136261u;
+    for (const char* p = user; *p; p++) {
+        h ^= (unsigned char)*p;
+        h *= 16777619u;
+    }
+    for (int i = 0; i < MAILBOX_KNOWN_SLOTS; i++) {
+        char* slot = known[(h + i) & (MAILBOX_KNOWN_SLOTS - 1)];
+        if (slot[0] == '\0' || strcmp(slot, user) == 0) return slot;
+    }
+    return NULL;
+}
+
+// Returns 1 if user was added, 0 if already known, -1 if the set is full.
+// One slot always stays empty so lookups of unknown names terminate.
+static int add_known(const char* user) {
+    char* slot = known_slot(user);
+    if (!slot || (slot[0] == '\0' && nknown == MAILBOX_KNOWN_SLOTS - 1)) return -1;
+    if (slot[0] != '\0') return 0;
+    strncpy(slot, user, MAX_USERNAME - 1);
+    nknown++;
+    return 1;
+}
+
+static int is_known(const char* user) {
+    char* slot = known_slot(user);
+    return slot && slot[0] != '\0';
+}
+
+static MailboxHead* find_head(const char* user, int create) {
+    for (int i = 0; i < nheads; i++) {
+        if (strcmp(heads[i].user, user) == 0) return &heads[i];
+    }
+    if (!create) return NULL;
+
+    // Reuse an emptied entry before growing
+    MailboxHead* h = NULL;
+    for (int i = 0; i < nheads && !h; i++) {
+        if (heads[i].head == heads[i].tail) h = &heads[i];
+    }
+    if (!h) {
+        if (nheads == MAILBOX_MAX_USERS) return NULL;
+        h = &heads[nheads++];
+    }
+    memset(h, 0, sizeof(*h));
+    strncpy(h->user, user, MAX_USERNAME - 1);
+    return h;
+}
+
+int mailbox_init(void) {
+    if (mkdir(MAILBOX_DIR, 0755) < 0 && errno != EEXIST) {
+        perror("mailbox mkdir");
+        return -1;
+    }
+
+    FILE* users = fopen(MAILBOX_USERS_FILE, "r");
+    if (users) {
+        char line[64];
+        while (fgets(line, sizeof(line), users)) {
+            line[strcspn(line, "\n")] = '\0';
+            if (valid_username(line)) add_known(line);
+        }
+        fclose(users);
+    }
+
+    DIR* dir = opendir(MAILBOX_DIR);
+    if (!dir) {
+        perror("mailbox opendir");
+        return -1;
+    }
+
+    struct dirent* de;
+    while ((de = readdir(dir)) != NULL) {
+        char* ext = strstr(de->d_name, ".mbox");
+        if (!ext || ext[5] != '\0' || ext - de->d_name >= MAX_USERNAME) continue;
+
+        char user[MAX_USERNAME] = {0};
+        memcpy(user, de->d_name, ext - de->d_name);
+        char path[256];
+        mailbox_path(path, sizeof(path), user);
+
+        // Count pending messages once at startup; one line per message
+        FILE* f = fopen(path, "r");
+        if (!f) continue;
+        int count = 0, c;
+        off_t size = 0;
+        while ((c = fgetc(f)) != EOF) {
+            size++;
+            if (c == '\n') count++;
+        }
+        fclose(f);
+
+        add_known(user);
+        MailboxHead* h = size > 0 ? find_head(user, 1) : NULL;
+        if (h) {
+            h->tail = size;
+            h->count = count;
+        }
+    }
+    closedir(dir);
+    return 0;
+}
+
+void mailbox_register(const char* user) {
+    pthread_mutex_lock(&mailbox_mutex);
+    if (add_known(user) == 1) {
+        FILE* users = fopen(MAILBOX_USERS_FILE, "a");
+        if (users) {
+            fprintf(users, "%s\n", user);
+            fclose(users);
+        }
+    }
+    pthread_mutex_unlock(&mailbox_mutex);
+}
+
+// Append count messages to a user's file. Caller holds mailbox_mutex.
+static int append_locked(const char* user, const char* msg, size_t len, int count) {
+    MailboxHead* h = find_head(user, 1);
+    if (!h || h->tail - h->head + (off_t)len > MAILBOX_MAX_BYTES) return -1;
+
+    char path[256];
+    mailbox_path(path, sizeof(path), user);
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0 || write(fd, msg, len) != (ssize_t)len) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    close(fd);
+
+    h->tail += len;
+    h->count += count;
+    return 0;
+}
+
+int mailbox_put(const char* user, const char* msg, size_t len) {
+    pthread_mutex_lock(&mailbox_mutex);
+    int rc = is_known(user) ? append_locked(user, msg, len, 1) : MAILBOX_UNKNOWN;
+    pthread_mutex_unlock(&mailbox_mutex);
+    return rc;
+}
+
+int mailbox_deliver(int slot, const char* user) {
+    pthread_mutex_lock(&mailbox_mutex);
+    MailboxHead* h = find_head(user, 0);
+    if (!h || h->head == h->tail) {
+        pthread_mutex_unlock(&mailbox_mutex);
+        return 0;
+    }
+
+    char path[256];
+    mailbox_path(path, sizeof(path), user);
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        pthread_mutex_unlock(&mailbox_mutex);
+        return -1;
+    }
+
+    size_t pending = h->tail - h->head;
+    char* data = malloc(pending);
+    if (!data || pread(fd, data, pending, h->head) != (ssize_t)pending) {
+        free(data);
+        close(fd);
+        pthread_mutex_unlock(&mailbox_mutex);
+        return -1;
+    }
+
+    // Take the messages out; drop the file rather than keep delivered bytes
+    int delivered = h->count;
+    h->count = 0;
+    if (ftruncate(fd, 0) == 0) {
+        h->head = h->tail = 0;
+        unlink(path);
+    } else {
+        h->head = h->tail;
+    }
+    close(fd);
+
+    // Send without the lock: a slow reader must not hold up mailbox_put(),
+    // which runs under clients_mutex
+    pthread_mutex_unlock(&mailbox_mutex);
+
+    char header[96];
+    snprintf(header, sizeof(header), "[INFO] You have %d message(s) received while offline:\n", delivered);
+    if (shard_send(slot, header, strlen(header)) < 0 || shard_send(slot, data, pending) < 0) {
+        // Keep them for the next login
+        pthread_mutex_lock(&mailbox_mutex);
+        append_locked(user, data, pending, delivered);
+        pthread_mutex_unlock(&mailbox_mutex);
+        delivered = -1;
+    }
+
+    free(data);
+    return delivered;
+}
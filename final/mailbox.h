@@ -0,0 +1,32 @@
+// mailbox.h
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stddef.h>
+
+#define MAILBOX_DIR "mailbox"
+#define MAILBOX_MAX_BYTES (64 * 1024)  // Pending bytes allowed per user
+#define MAILBOX_MAX_USERS 1024         // Users with a mailbox in the head index
+#define MAILBOX_USERS_FILE MAILBOX_DIR "/users"  // One known user name per line
+#define MAILBOX_KNOWN_SLOTS 4096       // Known users remembered, power of two
+#define MAILBOX_UNKNOWN -2             // mailbox_put(): the user never logged in
+
+// Create the mailbox directory and load the head index from existing
+// mailboxes. Returns 0 or -1.
+int mailbox_init(void);
+
+// Remember a user who logged in. Only known users get a mailbox, so
+// whispers to made-up names can't fill the head index.
+void mailbox_register(const char* user);
+
+// Append a message for an offline user. Returns 0, MAILBOX_UNKNOWN for a
+// user who never logged in, or -1 if the mailbox is full or cannot be written.
+int mailbox_put(const char* user, const char* msg, size_t len);
+
+// Send every pending message of user to the client in slot and empty the
+// mailbox. The messages are taken out under the lock and sent after it, and
+// go back in the mailbox if the send fails. Returns number of messages
+// delivered, -1 on error.
+int mailbox_deliver(int slot, const char* user);
+
+#endif /* MAILBOX_H */
@@ -0,0 +1,416 @@
+// msglog.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "chatserver.h"
+#include "shard.h"
+#include "msglog.h"
+
+// Layout on disk:
+//   msglog/<room>/<first seq>.log  records: RecordHeader + payload, append-only
+//   msglog/<room>/<first seq>.idx  sparse IndexEntry array, mmap'd, zero = unused
+
+#define RECORD_MAGIC 0x3147534du  // "MSG1"
+#define INDEX_SLOTS (MSGLOG_SEGMENT_BYTES / (MSGLOG_INDEX_INTERVAL * sizeof(RecordHeader)) + 1)
+#define INDEX_BYTES (INDEX_SLOTS * sizeof(IndexEntry))
+#define REPLAY_CHUNK (64 * 1024)
+
+typedef struct {
+    uint64_t seq;
+    uint32_t len;
+    uint32_t magic;
+} RecordHeader;
+
+typedef struct {
+    uint64_t seq;
+    uint64_t offset;
+} IndexEntry;
+
+typedef struct {
+    char name[MAX_ROOMNAME];
+    int loaded;
+    uint64_t next_seq;
+    uint64_t* bases;            // First seq of every segment, ascending
+    int nbases;
+    int bases_cap;
+    int fd;                     // Active (last) segment, -1 if none yet
+    off_t size;
+    IndexEntry* index;          // mmap of the active segment's index
+    int index_count;
+    unsigned long last_used;
+} LogRoom;
+
+static LogRoom rooms[MSGLOG_MAX_OPEN];
+static unsigned long use_clock = 0;
+static pthread_mutex_t msglog_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void segment_path(char* buf, size_t size, const char* room, uint64_t base, const char* ext) {
+    snprintf(buf, size, "%s/%s/%020llu.%s", MSGLOG_DIR, room, (unsigned long long)base, ext);
+}
+
+static int cmp_base(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static int add_base(LogRoom* r, uint64_t base) {
+    if (r->nbases == r->bases_cap) {
+        int cap = r->bases_cap ? r->bases_cap * 2 : 8;
+        uint64_t* grown = realloc(r->bases, cap * sizeof(uint64_t));
+        if (!grown) return -1;
+        r->bases = grown;
+        r->bases_cap = cap;
+    }
+    r->bases[r->nbases++] = base;
+    return 0;
+}
+
+// Number of used entries; used entries form a sorted prefix of the index
+static int index_used(const IndexEntry* index) {
+    int lo = 0, hi = INDEX_SLOTS;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (index[mid].seq != 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Last index entry with seq <= target, or -1
+static int index_floor(const IndexEntry* index, int count, uint64_t target) {
+    int lo = 0, hi = count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (index[mid].seq <= target) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo - 1;
+}
+
+static IndexEntry* map_index(const char* room, uint64_t base, int writable) {
+    char path[256];
+    segment_path(path, sizeof(path), room, base, "idx");
+    int fd = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (st.st_size < (off_t)INDEX_BYTES &&
+        (!writable || ftruncate(fd, INDEX_BYTES) < 0))) {
+        close(fd);
+        return NULL;
+    }
+
+    void* map = mmap(NULL, INDEX_BYTES, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                     MAP_SHARED, fd, 0);
+    close(fd);
+    return map == MAP_FAILED ? NULL : map;
+}
+
+static void close_active(LogRoom* r) {
+    if (r->fd >= 0) close(r->fd);
+    if (r->index) munmap(r->index, INDEX_BYTES);
+    r->fd = -1;
+    r->index = NULL;
+    r->index_count = 0;
+    r->size = 0;
+}
+
+// Open a segment for appending. An existing segment is scanned from its last
+// index entry to recover next_seq, and a torn tail record is cut off.
+static int open_segment(LogRoom* r, uint64_t base) {
+    char path[256];
+    segment_path(path, sizeof(path), r->name, base, "log");
+    r->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (r->fd < 0) return -1;
+
+    r->index = map_index(r->name, base, 1);
+    if (!r->index) {
+        close(r->fd);
+        r->fd = -1;
+        return -1;
+    }
+    r->index_count = index_used(r->index);
+
+    off_t pos = 0;
+    uint64_t last_seq = base - 1;
+    if (r->index_count > 0) {
+        pos = r->index[r->index_count - 1].offset;
+        last_seq = r->index[r->index_count - 1].seq - 1;
+    }
+    RecordHeader hdr;
+    struct stat st;
+    fstat(r->fd, &st);
+    while (pread(r->fd, &hdr, sizeof(hdr), pos) == sizeof(hdr) && hdr.magic == RECORD_MAGIC &&
+           pos + (off_t)sizeof(hdr) + hdr.len <= st.st_size) {
+        last_seq = hdr.seq;
+        pos += sizeof(hdr) + hdr.len;
+    }
+    if (pos < st.st_size && ftruncate(r->fd, pos) < 0) {
+        perror("msglog truncate");
+    }
+    while (r->index_count > 0 && (off_t)r->index[r->index_count - 1].offset >= pos) {
+        memset(&r->index[--r->index_count], 0, sizeof(IndexEntry));
+    }
+
+    r->size = pos;
+    r->next_seq = last_seq + 1;
+    return 0;
+}
+
+static int load_room(LogRoom* r, const char* room) {
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+    r->next_seq = 1;
+    strncpy(r->name, room, MAX_ROOMNAME - 1);
+
+    char dirpath[128];
+    snprintf(dirpath, sizeof(dirpath), "%s/%s", MSGLOG_DIR, room);
+    if (mkdir(dirpath, 0755) < 0 && errno != EEXIST) return -1;
+
+    DIR* dir = opendir(dirpath);
+    if (!dir) return -1;
+    struct dirent* de;
+    while ((de = readdir(dir)) != NULL) {
+        unsigned long long base;
+        char ext[8];
+        if (sscanf(de->d_name, "%llu.%7s", &base, ext) == 2 && strcmp(ext, "log") == 0) {
+            add_base(r, base);
+        }
+    }
+    closedir(dir);
+
+    if (r->nbases > 0) {
+        qsort(r->bases, r->nbases, sizeof(uint64_t), cmp_base);
+        if (open_segment(r, r->bases[r->nbases - 1]) < 0) {
+            free(r->bases);
+            return -1;
+        }
+    }
+    r->loaded = 1;
+    return 0;
+}
+
+static void unload_room(LogRoom* r) {
+    close_active(r);
+    free(r->bases);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+// Find or load a room, closing the least recently used one if the table is
+// full. Caller holds msglog_mutex.
+static LogRoom* get_room(const char* room) {
+    // The name becomes a directory under MSGLOG_DIR, so ".." and "a/b" must
+    // never get this far, whichever path (client or peer) it came in on
+    if (!valid_room(room)) return NULL;
+
+    LogRoom* slot = NULL;
+    for (int i = 0; i < MSGLOG_MAX_OPEN; i++) {
+        if (rooms[i].loaded && strcmp(rooms[i].name, room) == 0) {
+            rooms[i].last_used = ++use_clock;
+            return &rooms[i];
+        }
+        if (!rooms[i].loaded && !slot) slot = &rooms[i];
+    }
+
+    if (!slot) {
+        for (int i = 0; i < MSGLOG_MAX_OPEN; i++) {
+            if (!slot || rooms[i].last_used < slot->last_used) slot = &rooms[i];
+        }
+        unload_room(slot);
+    }
+
+    if (load_room(slot, room) < 0) {
+        memset(slot, 0, sizeof(*slot));
+        return NULL;
+    }
+    slot->last_used = ++use_clock;
+    return slot;
+}
+
+int msglog_init(void) {
+    if (mkdir(MSGLOG_DIR, 0755) < 0 && errno != EEXIST) {
+        perror("msglog mkdir");
+        return -1;
+    }
+    return 0;
+}
+
+unsigned long long msglog_append(const char* room, const char* msg, size_t len) {
+    pthread_mutex_lock(&msglog_mutex);
+    LogRoom* r = get_room(room);
+    if (!r) {
+        pthread_mutex_unlock(&msglog_mutex);
+        return 0;
+    }
+
+    // Roll over to a new segment starting at the next sequence number
+    if (r->fd < 0 || r->size >= MSGLOG_SEGMENT_BYTES || r->index_count >= (int)INDEX_SLOTS) {
+        close_active(r);
+        if (add_base(r, r->next_seq) < 0 || open_segment(r, r->next_seq) < 0) {
+            pthread_mutex_unlock(&msglog_mutex);
+            return 0;
+        }
+    }
+
+    uint64_t seq = r->next_seq;
+    RecordHeader hdr = { seq, (uint32_t)len, RECORD_MAGIC };
+    struct iovec iov[2] = {
+        { &hdr, sizeof(hdr) },
+        { (void*)msg, len },
+    };
+    ssize_t n = writev(r->fd, iov, 2);
+    if (n != (ssize_t)(sizeof(hdr) + len)) {
+        if (n > 0 && ftruncate(r->fd, r->size) < 0) perror("msglog truncate");
+        pthread_mutex_unlock(&msglog_mutex);
+        return 0;
+    }
+
+    if ((r->size == 0 || seq % MSGLOG_INDEX_INTERVAL == 0) && r->index_count < (int)INDEX_SLOTS) {
+        r->index[r->index_count].offset = r->size;
+        r->index[r->index_count].seq = seq;
+        r->index_count++;
+    }
+    r->size += n;
+    r->next_seq++;
+
+    pthread_mutex_unlock(&msglog_mutex);
+    return seq;
+}
+
+unsigned long long msglog_last_seq(const char* room) {
+    pthread_mutex_lock(&msglog_mutex);
+    LogRoom* r = get_room(room);
+    unsigned long long last = r ? r->next_seq - 1 : 0;
+    pthread_mutex_unlock(&msglog_mutex);
+    return last;
+}
+
+static int send_sink(void* arg, const char* buf, size_t len) {
+    return shard_send(*(int*)arg, buf, len);
+}
+
+// Send records of one segment with after_seq < seq <= end_seq.
+// Returns messages sent, -1 on error; *done is set once end_seq is reached.
+static long replay_segment(msglog_sink sink, void* arg, const char* room, uint64_t base,
+                           uint64_t after_seq, uint64_t end_seq, char* in, char* out, int* done) {
+    char path[256];
+    segment_path(path, sizeof(path), room, base, "log");
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    // Jump close to the first wanted record using the sparse index
+    off_t pos = 0;
+    IndexEntry* index = map_index(room, base, 0);
+    if (index) {
+        int i = index_floor(index, index_used(index), after_seq + 1);
+        if (i >= 0) pos = index[i].offset;
+        munmap(index, INDEX_BYTES);
+    }
+
+    long sent = 0;
+    size_t out_len = 0;
+    ssize_t got;
+    while (!*done && (got = pread(fd, in, REPLAY_CHUNK, pos)) > 0) {
+        size_t p = 0;
+        while (p + sizeof(RecordHeader) <= (size_t)got) {
+            RecordHeader hdr;
+            memcpy(&hdr, in + p, sizeof(hdr));
+            if (hdr.magic != RECORD_MAGIC || p + sizeof(hdr) + hdr.len > (size_t)got) break;
+            if (hdr.seq > end_seq) {
+                *done = 1;
+                break;
+            }
+
+            if (hdr.seq > after_seq) {
+                char prefix[32];
+                int plen = snprintf(prefix, sizeof(prefix), "[#%llu] ", (unsigned long long)hdr.seq);
+                if (out_len + plen + hdr.len > REPLAY_CHUNK) {
+                    if (sink(arg, out, out_len) < 0) goto fail;
+                    out_len = 0;
+                }
+                memcpy(out + out_len, prefix, plen);
+                memcpy(out + out_len + plen, in + p + sizeof(hdr), hdr.len);
+                out_len += plen + hdr.len;
+                sent++;
+            }
+            p += sizeof(hdr) + hdr.len;
+        }
+        if (p == 0) break;  // Corrupt record, stop here
+        pos += p;
+    }
+
+    if (out_len > 0 && sink(arg, out, out_len) < 0) goto fail;
+    close(fd);
+    return sent;
+
+fail:
+    close(fd);
+    return -1;
+}
+
+long msglog_replay(int slot, const char* room, unsigned long long after_seq) {
+    return msglog_replay_to(room, after_seq, send_sink, &slot, NULL);
+}
+
+long msglog_replay_to(const char* room, unsigned long long after_seq, msglog_sink sink, void* arg,
+                      unsigned long long* last_seq) {
+    pthread_mutex_lock(&msglog_mutex);
+    LogRoom* r = get_room(room);
+    if (!r) {
+        pthread_mutex_unlock(&msglog_mutex);
+        return -1;
+    }
+
+    // Snapshot the segment list and the end of the log; segments only grow,
+    // so the files can be read without holding the lock.
+    uint64_t end_seq = r->next_seq - 1;
+    if (last_seq) *last_seq = end_seq;
+    int nbases = r->nbases;
+    uint64_t* bases = malloc((nbases ? nbases : 1) * sizeof(uint64_t));
+    if (!bases) {
+        pthread_mutex_unlock(&msglog_mutex);
+        return -1;
+    }
+    memcpy(bases, r->bases, nbases * sizeof(uint64_t));
+    pthread_mutex_unlock(&msglog_mutex);
+
+    if (after_seq >= end_seq) {
+        free(bases);
+        return 0;
+    }
+
+    // Last segment starting at or before the first missed message
+    int lo = 0, hi = nbases;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (bases[mid] <= after_seq + 1) lo = mid + 1;
+        else hi = mid;
+    }
+    int first = lo > 0 ? lo - 1 : 0;
+
+    char* in = malloc(REPLAY_CHUNK);
+    char* out = malloc(REPLAY_CHUNK);
+    long total = 0;
+    int done = 0;
+    if (!in || !out) total = -1;
+    for (int i = first; i < nbases && !done && total >= 0; i++) {
+        long n = replay_segment(sink, arg, room, bases[i], after_seq, end_seq, in, out, &done);
+        total = n < 0 ? -1 : total + n;
+    }
+
+    free(in);
+    free(out);
+    free(bases);
+    return total;
+}
@@ -0,0 +1,34 @@
+// msglog.h
+#ifndef MSGLOG_H
+#define MSGLOG_H
+
+#include <stddef.h>
+
+#define MSGLOG_DIR "msglog"
+#define MSGLOG_SEGMENT_BYTES (1024 * 1024)  // Roll to a new segment past this size
+#define MSGLOG_INDEX_INTERVAL 16            // One index entry every N records
+#define MSGLOG_MAX_OPEN MAX_ROOMS           // Rooms kept open at once
+
+// Create the log directory. Returns 0 or -1.
+int msglog_init(void);
+
+// Append a room message. Returns its sequence number (starting at 1), 0 on error.
+unsigned long long msglog_append(const char* room, const char* msg, size_t len);
+
+// Last sequence number written to a room, 0 if none.
+unsigned long long msglog_last_seq(const char* room);
+
+// Send every message of a room with seq > after_seq, each prefixed "[#seq] ",
+// to the client in slot.
+// Returns number of messages sent or -1 on error.
+long msglog_replay(int slot, const char* room, unsigned long long after_seq);
+
+// Where msglog_replay_to() hands the replayed text. Returns 0, or -1 to stop.
+typedef int (*msglog_sink)(void* arg, const char* buf, size_t len);
+
+// msglog_replay() into any sink, e.g. a peer link. Sets *last_seq (when not
+// NULL) to the last seq in the log at the time of the call.
+long msglog_replay_to(const char* room, unsigned long long after_seq, msglog_sink sink, void* arg,
+                      unsigned long long* last_seq);
+
+#endif /* MSGLOG_H */
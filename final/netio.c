@@ -0,0 +1,48 @@
+// netio.c
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "netio.h"
+
+int send_all(int fd, const void* buf, size_t len) {
+    const char* p = buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int writev_all(int fd, struct iovec* iov, int iovcnt) {
+    while (iovcnt > 0) {
+        struct msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = iov;
+        mh.msg_iovlen = iovcnt;
+
+        // sendmsg instead of writev so a dead peer gives EPIPE, not SIGPIPE
+        ssize_t n = sendmsg(fd, &mh, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        // Skip fully written iovecs, trim the partially written one
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
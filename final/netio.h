@@ -0,0 +1,16 @@
+// netio.h
+#ifndef NETIO_H
+#define NETIO_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// Send the whole buffer, retrying on short writes. Returns 0 or -1.
+int send_all(int fd, const void* buf, size_t len);
+
+// Gathered send of every iovec in one sendmsg() where possible.
+// The iov array is consumed (modified) on partial writes. Returns 0 or -1.
+int writev_all(int fd, struct iovec* iov, int iovcnt);
+
+#endif /* NETIO_H */
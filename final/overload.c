@@ -0,0 +1,134 @@
+// overload.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+
+#include "chatserver.h"
+#include "overload.h"
+#include "shard.h"
+
+// A controller thread samples three signals every tick and turns the worst
+// of them into a pressure value, 1.0 meaning saturated:
+//   - uploads waiting or in progress against the pipeline's capacity
+//   - bytes queued for clients that haven't read them, on the sockets
+//     (SIOCOUTQ) and in the writer shards' output queues
+//   - how late the controller's own tick fires, i.e. CPU/scheduler lag
+// Pressure maps to a level; each level sheds one more class of work, the
+// most expensive first. Levels only drop once pressure is clearly below
+// the threshold, so the level doesn't flap around it.
+
+static const double level_enter[4] = { 0.0, 0.70, 0.85, 1.00 };
+#define LEVEL_HYSTERESIS 0.10
+
+static int (*upload_pending)(void) = NULL;
+static int upload_capacity = 1;
+
+static int level = 0;                    // Read lock-free by overload_admit()
+static unsigned long shed[LOAD_UPLOAD + 1];
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static double last_pressure = 0;
+static int last_uploads = 0;
+static long last_backlog = 0;
+static long last_lag_ms = 0;
+
+static long outbound_backlog(void) {
+    long total = 0;
+    pthread_mutex_lock(&clients_mutex);
+    for (int i = 0; i < MAX_CLIENTS; ++i) {
+        int queued;
+        if (clients[i] && ioctl(clients[i]->sockfd, SIOCOUTQ, &queued) == 0) total += queued;
+    }
+    pthread_mutex_unlock(&clients_mutex);
+    return total + shard_unsent();
+}
+
+static int level_for(double pressure, int current) {
+    int next = 0;
+    for (int l = 3; l > 0; l--) {
+        if (pressure >= level_enter[l]) {
+            next = l;
+            break;
+        }
+    }
+    if (next < current && pressure >= level_enter[current] - LEVEL_HYSTERESIS) return current;
+    return next;
+}
+
+static void* overload_thread(void* arg) {
+    (void)arg;
+    struct timespec tick = { 0, OVERLOAD_TICK_MS * 1000000L }, before, after;
+
+    while (1) {
+        clock_gettime(CLOCK_MONOTONIC, &before);
+        nanosleep(&tick, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &after);
+        long elapsed_ms = (after.tv_sec - before.tv_sec) * 1000 + (after.tv_nsec - before.tv_nsec) / 1000000;
+        long lag_ms = elapsed_ms > OVERLOAD_TICK_MS ? elapsed_ms - OVERLOAD_TICK_MS : 0;
+
+        int uploads = upload_pending();
+        long backlog = outbound_backlog();
+        double pressure = (double)uploads / upload_capacity;
+        if ((double)backlog / OVERLOAD_BACKLOG > pressure) pressure = (double)backlog / OVERLOAD_BACKLOG;
+        if ((double)lag_ms / OVERLOAD_LAG_MS > pressure) pressure = (double)lag_ms / OVERLOAD_LAG_MS;
+
+        int current = __atomic_load_n(&level, __ATOMIC_RELAXED);
+        int next = level_for(pressure, current);
+        if (next != current) {
+            __atomic_store_n(&level, next, __ATOMIC_RELAXED);
+            char logbuf[160];
+            snprintf(logbuf, sizeof(logbuf),
+                     "[OVERLOAD] level %d -> %d (pressure %.2f: uploads %d/%d, backlog %ld bytes, lag %ld ms)",
+                     current, next, pressure, uploads, upload_capacity, backlog, lag_ms);
+            log_event(logbuf);
+        }
+
+        pthread_mutex_lock(&stats_mutex);
+        last_pressure = pressure;
+        last_uploads = uploads;
+        last_backlog = backlog;
+        last_lag_ms = lag_ms;
+        pthread_mutex_unlock(&stats_mutex);
+    }
+    return NULL;
+}
+
+int overload_start(int (*pending)(void), int capacity) {
+    upload_pending = pending;
+    upload_capacity = capacity > 0 ? capacity : 1;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, overload_thread, NULL) != 0) {
+        perror("overload thread");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+int overload_admit(LoadClass cls) {
+    // Level 1 sheds uploads, 2 also broadcasts, 3 also logins
+    int current = __atomic_load_n(&level, __ATOMIC_RELAXED);
+    int admitted = cls == LOAD_CONTROL || current < 4 - (int)cls;
+    if (!admitted) __atomic_fetch_add(&shed[cls], 1, __ATOMIC_RELAXED);
+    return admitted;
+}
+
+void overload_report(int slot) {
+    char out[512];
+    pthread_mutex_lock(&stats_mutex);
+    int len = snprintf(out, sizeof(out),
+                       "[STATS] Load level %d (pressure %.2f: uploads %d/%d, backlog %ld bytes, lag %ld ms)\n"
+                       "  shed: uploads %lu, broadcasts %lu, logins %lu\n",
+                       __atomic_load_n(&level, __ATOMIC_RELAXED), last_pressure, last_uploads, upload_capacity,
+                       last_backlog, last_lag_ms,
+                       __atomic_load_n(&shed[LOAD_UPLOAD], __ATOMIC_RELAXED),
+                       __atomic_load_n(&shed[LOAD_BROADCAST], __ATOMIC_RELAXED),
+                       __atomic_load_n(&shed[LOAD_LOGIN], __ATOMIC_RELAXED));
+    pthread_mutex_unlock(&stats_mutex);
+    shard_send(slot, out, len);
+}
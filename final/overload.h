@@ -0,0 +1,28 @@
+// overload.h
+#ifndef OVERLOAD_H
+#define OVERLOAD_H
+
+#define OVERLOAD_TICK_MS 100                 // Sampling interval of the controller
+#define OVERLOAD_LAG_MS 200                  // Ticker lag counted as full pressure
+#define OVERLOAD_BACKLOG (4 * 1024 * 1024)   // Unsent bytes on client sockets counted as full pressure
+
+// Work classes, in the order they are shed. Control traffic (/exit, /leave)
+// is never shed.
+typedef enum {
+    LOAD_CONTROL,
+    LOAD_LOGIN,
+    LOAD_BROADCAST,
+    LOAD_UPLOAD
+} LoadClass;
+
+// Start the controller thread. pending() reports uploads waiting or in
+// progress, capacity is the number that counts as full. Returns 0 or -1.
+int overload_start(int (*pending)(void), int capacity);
+
+// Whether to take on work of this class now. Returns 1 to admit, 0 to shed.
+int overload_admit(LoadClass cls);
+
+// Write the current load level, its inputs and shed counts to the client in slot.
+void overload_report(int slot);
+
+#endif /* OVERLOAD_H */
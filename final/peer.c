@@ -0,0 +1,596 @@
+// peer.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "chatserver.h"
+#include "netio.h"
+#include "msglog.h"
+#include "peer.h"
+
+// Every room has one owner node, chosen by consistent hashing over the node
+// names. The owner sequences the room: other nodes POST new messages to it,
+// and it sends each stored message as one MSG frame to every node that has
+// members in the room (its interest set). A broadcast therefore crosses each
+// peer link at most once, however many remote members there are.
+//
+// Each pair of nodes uses two connections: one we dialed (outgoing frames)
+// and one the peer dialed (incoming frames). Frames are a text header line
+// followed by a payload:
+//   HELLO <node> <secret>
+//   SUB <room> / UNSUB <room>          this node has / no longer has members
+//   POST <room> <sender> <len>\n<msg>  new message for the owner to sequence
+//   MSG <room> <sender> <len>\n<line>  sequenced message from the owner
+//   FETCH <room> <after_seq> <id>      ask the owner for its log after a seq
+//   LOG <id> <len>\n<text>             a piece of the replayed log
+//   LOGEND <id> <last_seq> <count>     end of the answer to FETCH <id>
+
+#define SELF -1
+
+typedef struct {
+    char name[PEER_NAME_LEN];
+    char host[64];
+    int port;
+    int out_fd;                 // Connection we dialed, -1 while down
+    pthread_mutex_t out_mutex;  // Serializes frames on out_fd
+} Peer;
+
+typedef struct {
+    uint32_t hash;
+    int node;                   // Peer index or SELF
+} RingPoint;
+
+typedef struct {
+    char room[MAX_ROOMNAME];
+    unsigned int peer_mask;     // Bit i set: peers[i] has members
+} Interest;
+
+static char self_name[PEER_NAME_LEN];
+static char secret[PEER_SECRET_LEN + 1];
+static int listen_port = 0;
+static int enabled = 0;
+static Peer peers[PEER_MAX];
+static int npeers = 0;
+static RingPoint ring[(PEER_MAX + 1) * PEER_VNODES];
+static int nring = 0;
+
+// A peer_fetch_log() waiting for the owner's LOG and LOGEND frames
+typedef struct {
+    unsigned int id;            // 0 = free slot
+    int done;
+    PeerLog log;
+    size_t cap;
+} Fetch;
+
+static Interest interest[PEER_MAX_ROOMS];             // Owner side
+static char subscribed[PEER_MAX_ROOMS][MAX_ROOMNAME]; // Rooms we announced to their owner
+static Fetch fetches[MAX_CLIENTS];
+static unsigned int fetch_ids = 0;
+static pthread_mutex_t peer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t update_mutex = PTHREAD_MUTEX_INITIALIZER;  // Orders SUB/UNSUB decisions
+static pthread_cond_t fetch_cond = PTHREAD_COND_INITIALIZER;
+
+static uint32_t hash_str(const char* s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    // Final avalanche so nearby names spread over the ring
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    return h;
+}
+
+static int cmp_point(const void* a, const void* b) {
+    uint32_t x = ((const RingPoint*)a)->hash, y = ((const RingPoint*)b)->hash;
+    return x < y ? -1 : x > y;
+}
+
+static void add_points(const char* name, int node) {
+    for (int v = 0; v < PEER_VNODES; v++) {
+        char key[PEER_NAME_LEN + 8];
+        snprintf(key, sizeof(key), "%s#%d", name, v);
+        ring[nring].hash = hash_str(key);
+        ring[nring].node = node;
+        nring++;
+    }
+}
+
+static int owner_node(const char* room) {
+    uint32_t h = hash_str(room);
+    int lo = 0, hi = nring;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ring[mid].hash < h) lo = mid + 1;
+        else hi = mid;
+    }
+    return ring[lo == nring ? 0 : lo].node;
+}
+
+// Compare without an early exit, so timing doesn't give the secret away
+static int secret_matches(const char* given) {
+    size_t n = strlen(secret);
+    if (strlen(given) != n) return 0;
+    unsigned char diff = 0;
+    for (size_t i = 0; i < n; i++) {
+        diff |= (unsigned char)(given[i] ^ secret[i]);
+    }
+    return diff == 0;
+}
+
+static int find_peer(const char* name) {
+    for (int i = 0; i < npeers; i++) {
+        if (strcmp(peers[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+// Send one frame to a peer. Returns 0, or -1 if the link is down.
+static int peer_send(Peer* p, const char* header, const char* payload, size_t len) {
+    pthread_mutex_lock(&p->out_mutex);
+    if (p->out_fd < 0) {
+        pthread_mutex_unlock(&p->out_mutex);
+        return -1;
+    }
+
+    struct iovec iov[2] = {
+        { (void*)header, strlen(header) },
+        { (void*)payload, len },
+    };
+    if (writev_all(p->out_fd, iov, payload ? 2 : 1) < 0) {
+        close(p->out_fd);
+        p->out_fd = -1;
+        pthread_mutex_unlock(&p->out_mutex);
+
+        char logbuf[128];
+        snprintf(logbuf, sizeof(logbuf), "[PEER] link to '%s' lost", p->name);
+        log_event(logbuf);
+        return -1;
+    }
+    pthread_mutex_unlock(&p->out_mutex);
+    return 0;
+}
+
+static Interest* find_interest(const char* room, int create) {
+    Interest* free_slot = NULL;
+    for (int i = 0; i < PEER_MAX_ROOMS; i++) {
+        if (interest[i].peer_mask && strcmp(interest[i].room, room) == 0) return &interest[i];
+        if (!interest[i].peer_mask && !free_slot) free_slot = &interest[i];
+    }
+    if (!create || !free_slot) return NULL;
+    strncpy(free_slot->room, room, MAX_ROOMNAME - 1);
+    free_slot->room[MAX_ROOMNAME - 1] = '\0';
+    return free_slot;
+}
+
+// Caller holds peer_mutex
+static Fetch* find_fetch(unsigned int id) {
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (id != 0 && fetches[i].id == id && !fetches[i].done) return &fetches[i];
+    }
+    return NULL;
+}
+
+// Owner side of FETCH: the replayed log goes back as LOG frames
+typedef struct {
+    Peer* to;
+    unsigned int id;
+} LogReply;
+
+static int log_sink(void* arg, const char* buf, size_t len) {
+    LogReply* r = arg;
+    while (len > 0) {
+        size_t n = len < BUFFER_SIZE ? len : BUFFER_SIZE;
+        char header[64];
+        snprintf(header, sizeof(header), "LOG %u %zu\n", r->id, n);
+        if (peer_send(r->to, header, buf, n) < 0) return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Read exactly len bytes of a frame payload
+static int read_payload(FILE* in, char* buf, size_t len) {
+    if (len >= BUFFER_SIZE * 2 || fread(buf, 1, len, in) != len) return -1;
+    buf[len] = '\0';
+    return 0;
+}
+
+static void* reader_thread(void* arg) {
+    int fd = (int)(intptr_t)arg;
+    FILE* in = fdopen(fd, "r");
+    if (!in) {
+        close(fd);
+        return NULL;
+    }
+
+    int from = -1;
+    char line[256];
+    char* payload = malloc(BUFFER_SIZE * 2);
+    while (payload && fgets(line, sizeof(line), in)) {
+        char name[PEER_NAME_LEN], room[MAX_ROOMNAME], sender[MAX_USERNAME];
+        size_t len;
+        unsigned long long seq;
+        unsigned int id;
+        long count;
+
+        char given[PEER_SECRET_LEN + 1];
+        int fields = sscanf(line, "HELLO %31s %64s", name, given);
+        if (fields >= 1) {
+            if (fields < 2 || !secret_matches(given)) {
+                char logbuf[128];
+                snprintf(logbuf, sizeof(logbuf), "[PEER] rejected '%s': wrong secret", name);
+                log_event(logbuf);
+                break;
+            }
+            from = find_peer(name);
+            char logbuf[128];
+            snprintf(logbuf, sizeof(logbuf), "[PEER] '%s' connected%s", name, from < 0 ? " (unknown node)" : "");
+            log_event(logbuf);
+            if (from < 0) break;
+        }
+        else if (from < 0) {
+            break;  // Must introduce itself first
+        }
+        else if (sscanf(line, "SUB %32s", room) == 1) {
+            pthread_mutex_lock(&peer_mutex);
+            Interest* it = find_interest(room, 1);
+            if (it) it->peer_mask |= 1u << from;
+            pthread_mutex_unlock(&peer_mutex);
+        }
+        else if (sscanf(line, "UNSUB %32s", room) == 1) {
+            pthread_mutex_lock(&peer_mutex);
+            Interest* it = find_interest(room, 0);
+            if (it) it->peer_mask &= ~(1u << from);
+            pthread_mutex_unlock(&peer_mutex);
+        }
+        else if (sscanf(line, "POST %32s %16s %zu", room, sender, &len) == 3) {
+            if (read_payload(in, payload, len) < 0) break;
+            room_post(room, sender, payload);
+        }
+        else if (sscanf(line, "MSG %32s %16s %zu", room, sender, &len) == 3) {
+            if (read_payload(in, payload, len) < 0) break;
+            room_deliver_remote(room, sender, payload);
+        }
+        else if (sscanf(line, "FETCH %32s %llu %u", room, &seq, &id) == 3) {
+            LogReply reply = { &peers[from], id };
+            unsigned long long last = 0;
+            long count = msglog_replay_to(room, seq, log_sink, &reply, &last);
+            char frame[96];
+            snprintf(frame, sizeof(frame), "LOGEND %u %llu %ld\n", id, last, count);
+            peer_send(&peers[from], frame, NULL, 0);
+        }
+        else if (sscanf(line, "LOG %u %zu", &id, &len) == 2) {
+            if (read_payload(in, payload, len) < 0) break;
+            pthread_mutex_lock(&peer_mutex);
+            Fetch* f = find_fetch(id);
+            if (f && f->log.len + len <= PEER_FETCH_MAX) {
+                if (f->log.len + len > f->cap) {
+                    size_t cap = f->cap ? f->cap * 2 : 2 * BUFFER_SIZE;
+                    while (cap < f->log.len + len) cap *= 2;
+                    char* grown = realloc(f->log.text, cap);
+                    if (grown) {
+                        f->log.text = grown;
+                        f->cap = cap;
+                    }
+                }
+                if (f->log.len + len <= f->cap) {
+                    memcpy(f->log.text + f->log.len, payload, len);
+                    f->log.len += len;
+                }
+            }
+            pthread_mutex_unlock(&peer_mutex);
+        }
+        else if (sscanf(line, "LOGEND %u %llu %ld", &id, &seq, &count) == 3) {
+            pthread_mutex_lock(&peer_mutex);
+            Fetch* f = find_fetch(id);
+            if (f) {
+                f->log.last_seq = seq;
+                f->log.count = count;
+                f->done = 1;
+                pthread_cond_broadcast(&fetch_cond);
+            }
+            pthread_mutex_unlock(&peer_mutex);
+        }
+    }
+
+    // The peer went away: it no longer has members anywhere as far as we know
+    if (from >= 0) {
+        pthread_mutex_lock(&peer_mutex);
+        for (int i = 0; i < PEER_MAX_ROOMS; i++) {
+            interest[i].peer_mask &= ~(1u << from);
+        }
+        pthread_mutex_unlock(&peer_mutex);
+    }
+    free(payload);
+    fclose(in);
+    return NULL;
+}
+
+static void* listener_thread(void* arg) {
+    int lfd = (int)(intptr_t)arg;
+    while (1) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            perror("Peer accept failed");
+            continue;
+        }
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, reader_thread, (void*)(intptr_t)fd) != 0) {
+            close(fd);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+    return NULL;
+}
+
+static int dial(const Peer* p) {
+    char port[16];
+    snprintf(port, sizeof(port), "%d", p->port);
+    struct addrinfo hints = {0}, *res;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(p->host, port, &hints, &res) != 0) return -1;
+
+    int fd = socket(res->ai_family, res->ai_socktype, 0);
+    if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd >= 0) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+// Keeps the outgoing link of one peer up; after each (re)connect the peer
+// learns which of its rooms we have members in.
+static void* connector_thread(void* arg) {
+    Peer* p = arg;
+    int idx = p - peers;
+    while (1) {
+        pthread_mutex_lock(&p->out_mutex);
+        int up = p->out_fd >= 0;
+        pthread_mutex_unlock(&p->out_mutex);
+
+        if (!up) {
+            int fd = dial(p);
+            if (fd >= 0) {
+                char hello[PEER_NAME_LEN + PEER_SECRET_LEN + 16];
+                snprintf(hello, sizeof(hello), "HELLO %s %s\n", self_name, secret);
+                pthread_mutex_lock(&p->out_mutex);
+                p->out_fd = fd;
+                pthread_mutex_unlock(&p->out_mutex);
+                peer_send(p, hello, NULL, 0);
+
+                char logbuf[128];
+                snprintf(logbuf, sizeof(logbuf), "[PEER] link to '%s' up", p->name);
+                log_event(logbuf);
+
+                char rooms[PEER_MAX_ROOMS][MAX_ROOMNAME];
+                int n = 0;
+                pthread_mutex_lock(&peer_mutex);
+                for (int i = 0; i < PEER_MAX_ROOMS; i++) {
+                    if (subscribed[i][0] && owner_node(subscribed[i]) == idx) {
+                        strcpy(rooms[n++], subscribed[i]);
+                    }
+                }
+                pthread_mutex_unlock(&peer_mutex);
+                for (int i = 0; i < n; i++) {
+                    char frame[64];
+                    snprintf(frame, sizeof(frame), "SUB %s\n", rooms[i]);
+                    peer_send(p, frame, NULL, 0);
+                }
+            }
+        }
+        sleep(1);
+    }
+    return NULL;
+}
+
+int peer_init(const char* node_name, int port) {
+    if (strlen(node_name) == 0 || strlen(node_name) >= PEER_NAME_LEN || port <= 0) return -1;
+
+    const char* s = getenv(PEER_SECRET_ENV);
+    if (!s || !s[0] || strlen(s) > PEER_SECRET_LEN || strpbrk(s, " \t\r\n")) {
+        fprintf(stderr, "Set %s to the cluster's shared secret (1-%d characters, no spaces)\n",
+                PEER_SECRET_ENV, PEER_SECRET_LEN);
+        return -1;
+    }
+    strcpy(secret, s);
+    strcpy(self_name, node_name);
+    listen_port = port;
+    return 0;
+}
+
+int peer_add(const char* spec) {
+    if (npeers == PEER_MAX) return -1;
+    Peer* p = &peers[npeers];
+    memset(p, 0, sizeof(*p));
+    if (sscanf(spec, "%31[^=]=%63[^:]:%d", p->name, p->host, &p->port) != 3 || p->port <= 0) return -1;
+    if (find_peer(p->name) >= 0) return -1;
+    p->out_fd = -1;
+    pthread_mutex_init(&p->out_mutex, NULL);
+    npeers++;
+    return 0;
+}
+
+int peer_start(void) {
+    if (!self_name[0]) return 0;  // Not clustered
+
+    nring = 0;
+    add_points(self_name, SELF);
+    for (int i = 0; i < npeers; i++) {
+        add_points(peers[i].name, i);
+    }
+    qsort(ring, nring, sizeof(RingPoint), cmp_point);
+
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(listen_port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    if (lfd < 0 || bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(lfd, PEER_MAX) < 0) {
+        perror("Peer listen failed");
+        return -1;
+    }
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, listener_thread, (void*)(intptr_t)lfd) != 0) return -1;
+    pthread_detach(tid);
+    for (int i = 0; i < npeers; i++) {
+        if (pthread_create(&tid, NULL, connector_thread, &peers[i]) != 0) return -1;
+        pthread_detach(tid);
+    }
+
+    enabled = 1;
+    char logbuf[128];
+    snprintf(logbuf, sizeof(logbuf), "[PEER] node '%s' listening for peers on port %d (%d peer(s))",
+             self_name, listen_port, npeers);
+    log_event(logbuf);
+    return 0;
+}
+
+int peer_enabled(void) {
+    return enabled;
+}
+
+const char* peer_room_owner(const char* room) {
+    if (!enabled) return self_name;
+    int node = owner_node(room);
+    return node == SELF ? self_name : peers[node].name;
+}
+
+void peer_room_update(const char* room) {
+    if (!enabled || room[0] == '\0') return;
+    int owner = owner_node(room);
+    if (owner == SELF) return;
+
+    // Count and send in one critical section: with the count taken outside
+    // it, a join and a leave could send their SUB and UNSUB in the wrong order
+    pthread_mutex_lock(&update_mutex);
+    int local_members = room_user_count(room);
+    const char* verb = NULL;
+    pthread_mutex_lock(&peer_mutex);
+    int slot = -1, empty = -1;
+    for (int i = 0; i < PEER_MAX_ROOMS; i++) {
+        if (subscribed[i][0] && strcmp(subscribed[i], room) == 0) slot = i;
+        if (!subscribed[i][0] && empty < 0) empty = i;
+    }
+    if (local_members > 0 && slot < 0 && empty >= 0) {
+        strncpy(subscribed[empty], room, MAX_ROOMNAME - 1);
+        verb = "SUB";
+    } else if (local_members == 0 && slot >= 0) {
+        subscribed[slot][0] = '\0';
+        verb = "UNSUB";
+    }
+    pthread_mutex_unlock(&peer_mutex);
+
+    if (verb) {
+        char frame[64];
+        snprintf(frame, sizeof(frame), "%s %s\n", verb, room);
+        peer_send(&peers[owner], frame, NULL, 0);
+    }
+    pthread_mutex_unlock(&update_mutex);
+}
+
+int peer_forward_post(const char* room, const char* sender, const char* msg) {
+    if (!enabled) return 0;
+    int owner = owner_node(room);
+    if (owner == SELF) return 0;
+
+    char header[128];
+    size_t len = strlen(msg);
+    snprintf(header, sizeof(header), "POST %s %s %zu\n", room, sender, len);
+    if (peer_send(&peers[owner], header, msg, len) < 0) {
+        return -1;  // Only the owner may sequence the room
+    }
+    return 1;
+}
+
+void peer_fanout(const char* room, const char* sender, const char* msg, size_t len) {
+    if (!enabled) return;
+
+    pthread_mutex_lock(&peer_mutex);
+    Interest* it = find_interest(room, 0);
+    unsigned int mask = it ? it->peer_mask : 0;
+    pthread_mutex_unlock(&peer_mutex);
+
+    char header[128];
+    snprintf(header, sizeof(header), "MSG %s %s %zu\n", room, sender, len);
+    for (int i = 0; i < npeers; i++) {
+        if (mask & (1u << i)) {
+            peer_send(&peers[i], header, msg, len);
+        }
+    }
+}
+
+int peer_fetch_log(const char* room, unsigned long long after_seq, PeerLog* log) {
+    memset(log, 0, sizeof(*log));
+    if (!enabled) return 0;
+    int owner = owner_node(room);
+    if (owner == SELF) return 0;
+
+    pthread_mutex_lock(&peer_mutex);
+    Fetch* f = NULL;
+    for (int i = 0; i < MAX_CLIENTS && !f; i++) {
+        if (fetches[i].id == 0) f = &fetches[i];
+    }
+    if (!f) {
+        pthread_mutex_unlock(&peer_mutex);
+        return -1;
+    }
+    memset(f, 0, sizeof(*f));
+    if (++fetch_ids == 0) fetch_ids = 1;
+    f->id = fetch_ids;
+    unsigned int id = f->id;
+    pthread_mutex_unlock(&peer_mutex);
+
+    char frame[96];
+    snprintf(frame, sizeof(frame), "FETCH %s %llu %u\n", room, after_seq, id);
+    int sent = peer_send(&peers[owner], frame, NULL, 0) == 0;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += PEER_FETCH_TIMEOUT;
+
+    pthread_mutex_lock(&peer_mutex);
+    while (sent && !f->done) {
+        if (pthread_cond_timedwait(&fetch_cond, &peer_mutex, &deadline) == ETIMEDOUT) break;
+    }
+    int rc = -1;
+    if (f->done) {
+        *log = f->log;
+        rc = 1;
+    } else {
+        free(f->log.text);
+    }
+    memset(f, 0, sizeof(*f));
+    pthread_mutex_unlock(&peer_mutex);
+    return rc;
+}
+
+void peer_log_free(PeerLog* log) {
+    free(log->text);
+    log->text = NULL;
+    log->len = 0;
+}
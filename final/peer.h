@@ -0,0 +1,61 @@
+// peer.h
+#ifndef PEER_H
+#define PEER_H
+
+#include <stddef.h>
+
+#define PEER_MAX 8              // Other nodes in the cluster
+#define PEER_NAME_LEN 32
+#define PEER_SECRET_LEN 64      // Longest shared secret
+#define PEER_SECRET_ENV "CHAT_PEER_SECRET"
+#define PEER_VNODES 64          // Points per node on the hash ring
+#define PEER_MAX_ROOMS 256      // Rooms tracked for remote interest
+#define PEER_FETCH_TIMEOUT 3    // Seconds to wait for a room owner's log
+#define PEER_FETCH_MAX (1024 * 1024)  // Most replay text taken from an owner
+
+// A room owner's answer to peer_fetch_log()
+typedef struct {
+    unsigned long long last_seq;
+    long count;                 // Messages in text, -1 if the owner's replay failed
+    char* text;                 // "[#seq] " prefixed lines as msglog_replay() sends them, up to PEER_FETCH_MAX bytes
+    size_t len;
+} PeerLog;
+
+// Set this node's name and the port peers connect to. Every node must have
+// the same secret in PEER_SECRET_ENV; a peer that doesn't present it in its
+// HELLO is dropped. Returns 0 or -1.
+int peer_init(const char* node_name, int listen_port);
+
+// Register a peer given as "<name>=<host>:<port>". Returns 0 or -1.
+int peer_add(const char* spec);
+
+// Build the hash ring and start the listener and connector threads.
+int peer_start(void);
+
+// Nonzero once peer_start() succeeded
+int peer_enabled(void);
+
+// Name of the node owning a room
+const char* peer_room_owner(const char* room);
+
+// Tell the room owner whether this node has local members in the room. The
+// members are counted here, and updates are serialized, so a SUB and an
+// UNSUB racing each other can't leave the owner with a stale answer.
+void peer_room_update(const char* room);
+
+// Hand a new room message to its remote owner. Returns 1 if forwarded,
+// 0 if this node owns the room and the caller should post it, -1 if the
+// owner is unreachable (the message must not be sequenced here).
+int peer_forward_post(const char* room, const char* sender, const char* msg);
+
+// Owner side: send a sequenced room message once to every interested peer.
+void peer_fanout(const char* room, const char* sender, const char* msg, size_t len);
+
+// The log of a room lives on its owner only. Ask a remote owner for its
+// last seq and the messages after after_seq (none for ULLONG_MAX). Returns
+// 1 with *log filled in (release it with peer_log_free()), 0 if this node
+// owns the room, -1 if the owner did not answer.
+int peer_fetch_log(const char* room, unsigned long long after_seq, PeerLog* log);
+void peer_log_free(PeerLog* log);
+
+#endif /* PEER_H */
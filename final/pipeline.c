@@ -0,0 +1,191 @@
+// pipeline.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "chatserver.h"
+#include "shard.h"
+#include "pipeline.h"
+
+// Every stage owns a ring of queued items and a pool of workers. A worker
+// takes an item, runs the stage function and pushes the item into the next
+// stage's ring, waiting while that ring is full. Queue wait (time spent in
+// the ring) and run time are tracked per stage, so the stage holding things
+// up is the one with the deep queue and long wait.
+
+typedef struct {
+    void* item;
+    uint64_t enqueued_ns;
+} Slot;
+
+typedef struct {
+    char name[16];
+    StageFn fn;
+    int workers;
+    Slot* ring;
+    int cap, head, count;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty, not_full;
+
+    // Metrics, under lock
+    int busy;                // Items taken by a worker and not yet passed on
+    int peak;                // Deepest the queue has been
+    unsigned long done, dropped;
+    uint64_t wait_ns, run_ns, run_max_ns;
+
+    struct Pipeline* p;
+    int index;
+} Stage;
+
+struct Pipeline {
+    char name[32];
+    void (*drop)(void* item);
+    Stage stages[PIPELINE_MAX_STAGES];
+    int nstages;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Caller holds st->lock and has checked there is room
+static void ring_put(Stage* st, void* item) {
+    Slot* slot = &st->ring[(st->head + st->count) % st->cap];
+    slot->item = item;
+    slot->enqueued_ns = now_ns();
+    st->count++;
+    if (st->count > st->peak) st->peak = st->count;
+    pthread_cond_signal(&st->not_empty);
+}
+
+static void* stage_worker(void* arg) {
+    Stage* st = arg;
+    Pipeline* p = st->p;
+    Stage* next = st->index + 1 < p->nstages ? &p->stages[st->index + 1] : NULL;
+
+    while (1) {
+        pthread_mutex_lock(&st->lock);
+        while (st->count == 0) pthread_cond_wait(&st->not_empty, &st->lock);
+        Slot slot = st->ring[st->head];
+        st->head = (st->head + 1) % st->cap;
+        st->count--;
+        st->busy++;
+        pthread_cond_signal(&st->not_full);
+        pthread_mutex_unlock(&st->lock);
+
+        uint64_t start = now_ns();
+        int rc = st->fn(slot.item);
+        uint64_t end = now_ns();
+
+        pthread_mutex_lock(&st->lock);
+        if (rc < 0) st->dropped++;
+        else st->done++;
+        st->wait_ns += start - slot.enqueued_ns;
+        st->run_ns += end - start;
+        if (end - start > st->run_max_ns) st->run_max_ns = end - start;
+        pthread_mutex_unlock(&st->lock);
+
+        if (rc < 0 || !next) {
+            p->drop(slot.item);
+        } else {
+            // Backpressure: wait here rather than grow the next queue
+            pthread_mutex_lock(&next->lock);
+            while (next->count == next->cap) pthread_cond_wait(&next->not_full, &next->lock);
+            ring_put(next, slot.item);
+            pthread_mutex_unlock(&next->lock);
+        }
+
+        pthread_mutex_lock(&st->lock);
+        st->busy--;
+        pthread_mutex_unlock(&st->lock);
+    }
+    return NULL;
+}
+
+Pipeline* pipeline_create(const char* name, void (*drop)(void* item)) {
+    Pipeline* p = calloc(1, sizeof(Pipeline));
+    if (!p) return NULL;
+    strncpy(p->name, name, sizeof(p->name) - 1);
+    p->drop = drop;
+    return p;
+}
+
+int pipeline_add_stage(Pipeline* p, const char* name, StageFn fn, int workers, int capacity) {
+    if (p->nstages == PIPELINE_MAX_STAGES || workers < 1 || capacity < 1) return -1;
+    Stage* st = &p->stages[p->nstages];
+    st->ring = calloc(capacity, sizeof(Slot));
+    if (!st->ring) return -1;
+    strncpy(st->name, name, sizeof(st->name) - 1);
+    st->fn = fn;
+    st->workers = workers;
+    st->cap = capacity;
+    pthread_mutex_init(&st->lock, NULL);
+    pthread_cond_init(&st->not_empty, NULL);
+    pthread_cond_init(&st->not_full, NULL);
+    st->p = p;
+    st->index = p->nstages++;
+    return 0;
+}
+
+int pipeline_start(Pipeline* p) {
+    for (int i = 0; i < p->nstages; i++) {
+        for (int w = 0; w < p->stages[i].workers; w++) {
+            pthread_t tid;
+            if (pthread_create(&tid, NULL, stage_worker, &p->stages[i]) != 0) {
+                perror("pipeline thread");
+                return -1;
+            }
+            pthread_detach(tid);
+        }
+    }
+    return 0;
+}
+
+int pipeline_submit(Pipeline* p, void* item) {
+    Stage* st = &p->stages[0];
+    int rc = -1;
+    pthread_mutex_lock(&st->lock);
+    if (st->count < st->cap) {
+        ring_put(st, item);
+        rc = 0;
+    }
+    pthread_mutex_unlock(&st->lock);
+    return rc;
+}
+
+int pipeline_pending(Pipeline* p) {
+    int n = 0;
+    for (int i = 0; i < p->nstages; i++) {
+        pthread_mutex_lock(&p->stages[i].lock);
+        n += p->stages[i].count + p->stages[i].busy;
+        pthread_mutex_unlock(&p->stages[i].lock);
+    }
+    return n;
+}
+
+void pipeline_report(Pipeline* p, int slot) {
+    char out[BUFFER_SIZE];
+    size_t len = snprintf(out, sizeof(out), "[STATS] Pipeline '%s' (queue/capacity, peak, avg wait, avg/max run):\n", p->name);
+
+    for (int i = 0; i < p->nstages && len < sizeof(out); i++) {
+        Stage* st = &p->stages[i];
+        pthread_mutex_lock(&st->lock);
+        unsigned long n = st->done + st->dropped;
+        double wait_ms = n ? st->wait_ns / 1e6 / n : 0;
+        double run_ms = n ? st->run_ns / 1e6 / n : 0;
+        int w = snprintf(out + len, sizeof(out) - len,
+                         "  %-10s x%-2d queue %d/%d peak %d busy %d done %lu dropped %lu wait %.1f ms run %.1f/%.1f ms\n",
+                         st->name, st->workers, st->count, st->cap, st->peak, st->busy,
+                         st->done, st->dropped, wait_ms, run_ms, st->run_max_ns / 1e6);
+        pthread_mutex_unlock(&st->lock);
+        if (w < 0) break;
+        len += w;
+    }
+    if (len >= sizeof(out)) len = sizeof(out) - 1;
+    shard_send(slot, out, len);
+}
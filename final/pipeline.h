@@ -0,0 +1,37 @@
+// pipeline.h
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stddef.h>
+
+#define PIPELINE_MAX_STAGES 8
+
+// A stage function works on one item. Return 0 to pass it to the next stage,
+// or -1 to stop it here; stopped items go to the pipeline's drop function.
+typedef int (*StageFn)(void* item);
+
+typedef struct Pipeline Pipeline;
+
+// Create an empty pipeline. drop() releases items that a stage stopped or
+// that finished the last stage.
+Pipeline* pipeline_create(const char* name, void (*drop)(void* item));
+
+// Append a stage with its own bounded queue and worker pool. Stages run in
+// the order they are added. Returns 0 or -1.
+int pipeline_add_stage(Pipeline* p, const char* name, StageFn fn, int workers, int capacity);
+
+// Start every stage's workers. Returns 0 or -1 if a thread could not start.
+int pipeline_start(Pipeline* p);
+
+// Queue an item at the first stage without blocking. Returns 0, or -1 if
+// that stage's queue is full. Later stages block when the next queue is
+// full, so a slow stage backs up into its own queue, not into memory.
+int pipeline_submit(Pipeline* p, void* item);
+
+// Items queued or in progress anywhere in the pipeline
+int pipeline_pending(Pipeline* p);
+
+// Write per-stage queue depth, throughput and latency to the client in slot.
+void pipeline_report(Pipeline* p, int slot);
+
+#endif /* PIPELINE_H */
@@ -0,0 +1,99 @@
+// pool.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shard.h"
+#include "arena.h"
+#include "pool.h"
+
+// Heap allocations are counted where a pool or the arena falls back to
+// malloc, not by replacing the allocator; the count in /stats is what
+// shows whether a hot path allocates. Objects in a pool keep a free-list
+// link in their first bytes while they are on the list.
+
+static unsigned long misses = 0;
+
+void heap_miss(void) {
+    __atomic_fetch_add(&misses, 1, __ATOMIC_RELAXED);
+}
+
+unsigned long heap_misses(void) {
+    return __atomic_load_n(&misses, __ATOMIC_RELAXED);
+}
+
+static Pool* pools[POOL_MAX];
+static int npools = 0;
+static pthread_mutex_t pools_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void pool_init(Pool* p, const char* name, size_t size, int per_chunk) {
+    p->name = name;
+    p->size = size < sizeof(void*) ? sizeof(void*) : (size + 15) & ~(size_t)15;
+    p->per_chunk = per_chunk > 0 ? per_chunk : 1;
+    p->free_list = NULL;
+    p->in_use = p->peak = p->chunks = 0;
+    pthread_mutex_init(&p->lock, NULL);
+    if (!name) return;
+
+    pthread_mutex_lock(&pools_mutex);
+    if (npools < POOL_MAX) pools[npools++] = p;
+    pthread_mutex_unlock(&pools_mutex);
+}
+
+// Caller holds p->lock
+static int pool_grow(Pool* p) {
+    char* chunk = malloc(p->size * p->per_chunk);
+    if (!chunk) return -1;
+    heap_miss();
+    for (int i = p->per_chunk - 1; i >= 0; i--) {
+        void* obj = chunk + (size_t)i * p->size;
+        *(void**)obj = p->free_list;
+        p->free_list = obj;
+    }
+    p->chunks++;
+    return 0;
+}
+
+void* pool_get(Pool* p) {
+    pthread_mutex_lock(&p->lock);
+    if (!p->free_list && pool_grow(p) < 0) {
+        pthread_mutex_unlock(&p->lock);
+        return NULL;
+    }
+    void* obj = p->free_list;
+    p->free_list = *(void**)obj;
+    if (++p->in_use > p->peak) p->peak = p->in_use;
+    pthread_mutex_unlock(&p->lock);
+
+    memset(obj, 0, p->size);
+    return obj;
+}
+
+void pool_put(Pool* p, void* obj) {
+    if (!obj) return;
+    pthread_mutex_lock(&p->lock);
+    *(void**)obj = p->free_list;
+    p->free_list = obj;
+    p->in_use--;
+    pthread_mutex_unlock(&p->lock);
+}
+
+void memory_report(int slot) {
+    char out[512];
+    size_t len = snprintf(out, sizeof(out), "[STATS] Memory: %lu heap allocation(s) past the pools and arena, arena high water %zu/%d bytes\n",
+                          heap_misses(), arena_high_water(), ARENA_SIZE);
+
+    pthread_mutex_lock(&pools_mutex);
+    for (int i = 0; i < npools && len < sizeof(out); i++) {
+        Pool* p = pools[i];
+        pthread_mutex_lock(&p->lock);
+        int w = snprintf(out + len, sizeof(out) - len, "  pool %-10s in use %lu peak %lu chunks %lu (%d x %zu bytes)\n",
+                         p->name, p->in_use, p->peak, p->chunks, p->per_chunk, p->size);
+        pthread_mutex_unlock(&p->lock);
+        if (w < 0) break;
+        len += w;
+    }
+    pthread_mutex_unlock(&pools_mutex);
+    if (len >= sizeof(out)) len = sizeof(out) - 1;
+    shard_send(slot, out, len);
+}
@@ -0,0 +1,40 @@
+// pool.h
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#define POOL_MAX 8      // Pools listed by memory_report()
+
+// Fixed-size object pool. Objects are carved from chunks of per_chunk
+// objects and go back on a free list when released; chunks are never
+// returned to the heap, so once the pool has grown to its peak, getting
+// and putting objects allocates nothing.
+typedef struct {
+    const char* name;
+    size_t size;
+    int per_chunk;
+    void* free_list;
+    unsigned long in_use, peak, chunks;
+    pthread_mutex_t lock;
+} Pool;
+
+// Set up a pool and list it in the memory report, unless name is NULL.
+// Call before first use.
+void pool_init(Pool* p, const char* name, size_t size, int per_chunk);
+
+// A zeroed object, or NULL if a new chunk was needed and malloc failed.
+void* pool_get(Pool* p);
+void pool_put(Pool* p, void* obj);
+
+// Count a heap allocation on a path that a pool or the arena normally
+// serves: a pool growing a chunk, or a request too big for either. Setup
+// and cold paths aren't counted.
+void heap_miss(void);
+unsigned long heap_misses(void);
+
+// Write the heap miss count, pool usage and arena use to the client in slot.
+void memory_report(int slot);
+
+#endif /* POOL_H */
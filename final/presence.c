@@ -0,0 +1,232 @@
+// presence.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "chatserver.h"
+#include "rooms.h"
+#include "shard.h"
+#include "arena.h"
+#include "presence.h"
+
+// Pending changes are kept in arrival order. A change that undoes one
+// still pending (join then leave, away then back) removes it instead of
+// being queued, so a tick only reports net changes. Event kinds come in
+// opposite pairs: kind ^ 1 undoes kind.
+
+typedef enum {
+    EV_ONLINE, EV_OFFLINE,
+    EV_AWAY, EV_BACK,
+    EV_JOIN, EV_LEAVE
+} EventKind;
+
+typedef struct {
+    EventKind kind;
+    char user[MAX_USERNAME];
+    char room[MAX_ROOMNAME];    // Empty for global changes
+} Event;
+
+static const char* kind_label[] = { "online", "offline", "away", "back", "joined", "left" };
+
+static uint64_t online[ROOM_MEMBER_WORDS];
+static uint64_t away[ROOM_MEMBER_WORDS];
+static uint64_t subscribed[ROOM_MEMBER_WORDS];
+
+static Event events[PRESENCE_MAX_EVENTS];
+static int nevents = 0;
+static int overflowed = 0;
+
+// Drop the user's pending global events. Returns whether one of them was
+// an online change.
+static int drop_global_events(const char* user) {
+    int kept = 0, was_online = 0;
+    for (int i = 0; i < nevents; i++) {
+        if (events[i].room[0] == '\0' && strcmp(events[i].user, user) == 0) {
+            was_online |= events[i].kind == EV_ONLINE;
+            continue;
+        }
+        events[kept++] = events[i];
+    }
+    nevents = kept;
+    return was_online;
+}
+
+static void queue_event(EventKind kind, const char* user, const char* room) {
+    // Going offline makes a pending away or back moot; if it cancels a
+    // pending online, the user is not reported at all
+    if (kind == EV_OFFLINE && drop_global_events(user)) return;
+
+    for (int i = nevents - 1; i >= 0; i--) {
+        Event* e = &events[i];
+        if (strcmp(e->user, user) != 0 || strcmp(e->room, room) != 0) continue;
+        if (e->kind == (kind ^ 1)) {
+            memmove(e, e + 1, (nevents - i - 1) * sizeof(Event));
+            nevents--;
+            return;
+        }
+        if (e->kind == kind) return;
+    }
+    if (nevents == PRESENCE_MAX_EVENTS) {
+        overflowed = 1;
+        return;
+    }
+    Event* e = &events[nevents++];
+    e->kind = kind;
+    strncpy(e->user, user, MAX_USERNAME - 1);
+    e->user[MAX_USERNAME - 1] = '\0';
+    strncpy(e->room, room, MAX_ROOMNAME - 1);
+    e->room[MAX_ROOMNAME - 1] = '\0';
+}
+
+// Append " <label>: a b c;" for the events of one kind and room
+static size_t append_group(char* out, size_t len, EventKind kind, const char* room) {
+    int first = 1;
+    for (int i = 0; i < nevents; i++) {
+        if (events[i].kind != kind || strcmp(events[i].room, room) != 0) continue;
+        if (first) len += sprintf(out + len, " %s:", kind_label[kind]);
+        len += sprintf(out + len, " %s", events[i].user);
+        first = 0;
+    }
+    if (!first) out[len++] = ';';
+    return len;
+}
+
+// Newline-terminated line for room ("" for global changes); 0 if empty
+static size_t build_line(char* out, const char* room) {
+    size_t len = room[0] ? (size_t)sprintf(out, "[PRESENCE #%s]", room) : (size_t)sprintf(out, "[PRESENCE]");
+    size_t start = len;
+    EventKind first = room[0] ? EV_JOIN : EV_ONLINE;
+    EventKind last = room[0] ? EV_LEAVE : EV_BACK;
+    for (EventKind k = first; k <= last; k++) len = append_group(out, len, k, room);
+    if (len == start) return 0;
+    out[len - 1] = '\n';    // Replaces the trailing ';'
+    return len;
+}
+
+static void presence_flush(void) {
+    // Big enough for every event landing on one line; only the tick thread uses it
+    static char out[64 + MAX_ROOMNAME + PRESENCE_MAX_EVENTS * (MAX_USERNAME + 16)];
+
+    size_t len = build_line(out, "");
+    if (len > 0) shard_broadcast(subscribed, -1, out, len);
+
+    for (int i = 0; i < nevents; i++) {
+        if (events[i].room[0] == '\0') continue;
+        int seen = 0;
+        for (int j = 0; j < i && !seen; j++) seen = strcmp(events[j].room, events[i].room) == 0;
+        if (seen) continue;
+
+        Room* r = room_find(events[i].room);
+        if (!r) continue;
+        uint64_t audience[ROOM_MEMBER_WORDS];
+        int any = 0;
+        for (int w = 0; w < ROOM_MEMBER_WORDS; w++) {
+            audience[w] = r->members[w] & subscribed[w];
+            any |= audience[w] != 0;
+        }
+        if (any && (len = build_line(out, events[i].room)) > 0) {
+            shard_broadcast(audience, -1, out, len);
+        }
+    }
+
+    if (overflowed) {
+        const char* resync = "[PRESENCE] Too many changes, use /who to refresh.\n";
+        shard_broadcast(subscribed, -1, resync, strlen(resync));
+    }
+    nevents = 0;
+    overflowed = 0;
+}
+
+static void* presence_thread(void* arg) {
+    (void)arg;
+    struct timespec tick = { 0, PRESENCE_TICK_MS * 1000000L };
+    while (1) {
+        nanosleep(&tick, NULL);
+        pthread_mutex_lock(&clients_mutex);
+        if (nevents > 0 || overflowed) presence_flush();
+        pthread_mutex_unlock(&clients_mutex);
+    }
+    return NULL;
+}
+
+int presence_start(void) {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, presence_thread, NULL) != 0) {
+        perror("presence thread");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+static void set_bit(uint64_t* set, int slot, int on) {
+    if (on) set[slot / 64] |= 1ull << (slot % 64);
+    else set[slot / 64] &= ~(1ull << (slot % 64));
+}
+
+static int get_bit(const uint64_t* set, int slot) {
+    return (set[slot / 64] >> (slot % 64)) & 1;
+}
+
+void presence_online(const Client* cli) {
+    set_bit(online, cli->slot, 1);
+    queue_event(EV_ONLINE, cli->username, "");
+}
+
+void presence_offline(const Client* cli) {
+    set_bit(online, cli->slot, 0);
+    set_bit(away, cli->slot, 0);
+    set_bit(subscribed, cli->slot, 0);
+    queue_event(EV_OFFLINE, cli->username, "");
+}
+
+void presence_room(const Client* cli, const char* room, int joined) {
+    queue_event(joined ? EV_JOIN : EV_LEAVE, cli->username, room);
+}
+
+int presence_set_away(const Client* cli, int on) {
+    if (get_bit(away, cli->slot) == on) return 0;
+    set_bit(away, cli->slot, on);
+    queue_event(on ? EV_AWAY : EV_BACK, cli->username, "");
+    return 1;
+}
+
+int presence_is_away(const Client* cli) {
+    return get_bit(away, cli->slot);
+}
+
+void presence_subscribe(const Client* cli, int on) {
+    set_bit(subscribed, cli->slot, on);
+}
+
+char* presence_who(const char* room, size_t* len) {
+    const uint64_t* set = online;
+    if (room) {
+        Room* r = room_find(room);
+        if (!r) return NULL;
+        set = r->members;
+    }
+
+    int count = 0;
+    for (int w = 0; w < ROOM_MEMBER_WORDS; w++) count += __builtin_popcountll(set[w]);
+    char* out = arena_alloc(64 + MAX_ROOMNAME + (size_t)count * (MAX_USERNAME + 8));
+    if (!out) return NULL;
+
+    size_t n = room ? (size_t)sprintf(out, "[WHO] #%s, %d member(s):", room, count)
+                    : (size_t)sprintf(out, "[WHO] %d online:", count);
+    for (int w = 0; w < ROOM_MEMBER_WORDS; w++) {
+        uint64_t bits = set[w];
+        while (bits) {
+            int slot = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (!clients[slot]) continue;
+            n += sprintf(out + n, " %s%s", clients[slot]->username, get_bit(away, slot) ? "(away)" : "");
+        }
+    }
+    out[n++] = '\n';
+    *len = n;
+    return out;
+}
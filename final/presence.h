@@ -0,0 +1,34 @@
+// presence.h
+#ifndef PRESENCE_H
+#define PRESENCE_H
+
+#include <stddef.h>
+#include "chatserver.h"
+
+#define PRESENCE_TICK_MS 250        // Changes are batched and pushed this often
+#define PRESENCE_MAX_EVENTS 1024    // Pending changes per tick; beyond this subscribers are told to resync
+
+// Online, away and subscription state are bitsets indexed by client slot;
+// room membership is the room's own member set. Changes are queued and sent
+// once per tick as one line per audience: global changes to every
+// subscriber, room joins/leaves to the room's subscribed members.
+//
+// Everything except presence_start expects clients_mutex to be held.
+
+// Start the tick thread. Returns 0 or -1.
+int presence_start(void);
+
+void presence_online(const Client* cli);
+void presence_offline(const Client* cli);
+void presence_room(const Client* cli, const char* room, int joined);
+
+// Returns 1 if the state changed
+int presence_set_away(const Client* cli, int away);
+int presence_is_away(const Client* cli);
+void presence_subscribe(const Client* cli, int on);
+
+// "[WHO]" reply listing online users, or room's members when room is not
+// NULL. Returns a string in the calling thread's arena, or NULL.
+char* presence_who(const char* room, size_t* len);
+
+#endif /* PRESENCE_H */
@@ -0,0 +1,14 @@
+// protocol.h
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+// Limits the server and libchatclient have to agree on
+
+#define MAX_USERNAME 17
+#define MAX_ROOMNAME 33
+#define MAX_RECEIVER (MAX_ROOMNAME + 1)  // A user name, or "#room" for a room share
+#define MAX_FILE_SIZE (3 * 1024 * 1024)  // 3MB
+#define SESSION_KEY_LEN 32               // Hex digits of a login's key for transfer connections
+#define XFER_HELLO "/xfer"               // First line of a transfer connection
+
+#endif /* PROTOCOL_H */
@@ -0,0 +1,98 @@
+// ratelimit.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "shard.h"
+#include "ratelimit.h"
+
+// Tokens are kept in thousandths, so a rate of N tokens per second refills
+// exactly N units per millisecond. A room bucket packs its tokens and last
+// refill time into one 64-bit word and is updated with compare-and-swap,
+// so any client thread can charge it without a lock.
+
+static uint32_t user_rate, user_burst, room_rate, room_burst;
+static uint64_t room_slots[RATE_ROOM_SLOTS];
+static unsigned long throttled_user = 0, throttled_room = 0;
+
+static uint32_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static uint32_t env_limit(const char* name, uint32_t fallback) {
+    const char* v = getenv(name);
+    if (!v || *v == '\0') return fallback;
+    long n = atol(v);
+    return n < 0 ? 0 : n > 1000000 ? 1000000 : (uint32_t)n;
+}
+
+// Refilled token count; the clock is compared modulo 2^32 ms
+static uint32_t refill(uint32_t tokens, uint32_t last, uint32_t now, uint32_t rate, uint32_t burst) {
+    uint64_t t = tokens + (uint64_t)(uint32_t)(now - last) * rate;
+    return t > (uint64_t)burst * 1000 ? burst * 1000 : (uint32_t)t;
+}
+
+void ratelimit_init(void) {
+    user_rate = env_limit("CHAT_USER_RATE", RATE_USER_DEFAULT);
+    user_burst = env_limit("CHAT_USER_BURST", RATE_USER_BURST_DEFAULT);
+    room_rate = env_limit("CHAT_ROOM_RATE", RATE_ROOM_DEFAULT);
+    room_burst = env_limit("CHAT_ROOM_BURST", RATE_ROOM_BURST_DEFAULT);
+    if (user_burst == 0) user_burst = 1;
+    if (room_burst == 0) room_burst = 1;
+
+    uint32_t now = now_ms();
+    for (int i = 0; i < RATE_ROOM_SLOTS; i++) {
+        room_slots[i] = (uint64_t)room_burst * 1000 << 32 | now;
+    }
+}
+
+void ratelimit_user_init(TokenBucket* b) {
+    b->tokens = user_burst * 1000;
+    b->last_ms = now_ms();
+}
+
+int ratelimit_user(TokenBucket* b) {
+    if (user_rate == 0) return 1;
+    uint32_t now = now_ms();
+    b->tokens = refill(b->tokens, b->last_ms, now, user_rate, user_burst);
+    b->last_ms = now;
+    if (b->tokens < 1000) {
+        __atomic_fetch_add(&throttled_user, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    b->tokens -= 1000;
+    return 1;
+}
+
+int ratelimit_room(const char* room) {
+    if (room_rate == 0) return 1;
+
+    uint32_t h = 2166136261u;
+    for (const char* p = room; *p; p++) h = (h ^ (unsigned char)*p) * 16777619u;
+    uint64_t* slot = &room_slots[h & (RATE_ROOM_SLOTS - 1)];
+
+    uint32_t now = now_ms();
+    uint64_t old = __atomic_load_n(slot, __ATOMIC_RELAXED);
+    while (1) {
+        uint32_t tokens = refill(old >> 32, (uint32_t)old, now, room_rate, room_burst);
+        if (tokens < 1000) {
+            __atomic_fetch_add(&throttled_room, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+        uint64_t next = (uint64_t)(tokens - 1000) << 32 | now;
+        if (__atomic_compare_exchange_n(slot, &old, next, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) return 1;
+    }
+}
+
+void ratelimit_report(int slot) {
+    char out[256];
+    int len = snprintf(out, sizeof(out),
+                       "[STATS] Throttled: %lu user command(s) (limit %u/s, burst %u), "
+                       "%lu room message(s) (limit %u/s, burst %u)\n",
+                       __atomic_load_n(&throttled_user, __ATOMIC_RELAXED), user_rate, user_burst,
+                       __atomic_load_n(&throttled_room, __ATOMIC_RELAXED), room_rate, room_burst);
+    shard_send(slot, out, len);
+}
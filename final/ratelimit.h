@@ -0,0 +1,37 @@
+// ratelimit.h
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdint.h>
+
+#define RATE_ROOM_SLOTS 256        // Room buckets; rooms hashing to one slot share it
+
+// Defaults, overridden by CHAT_USER_RATE / CHAT_USER_BURST and
+// CHAT_ROOM_RATE / CHAT_ROOM_BURST (commands per second, bucket size).
+// A rate of 0 turns that limit off.
+#define RATE_USER_DEFAULT 5
+#define RATE_USER_BURST_DEFAULT 10
+#define RATE_ROOM_DEFAULT 50
+#define RATE_ROOM_BURST_DEFAULT 100
+
+// Per-user bucket. Lives in the Client and is only touched by that
+// client's thread, so it needs no lock.
+typedef struct {
+    uint32_t tokens;     // In thousandths of a token
+    uint32_t last_ms;
+} TokenBucket;
+
+// Read the limits from the environment and fill the room buckets.
+void ratelimit_init(void);
+
+// Give a new client a full bucket.
+void ratelimit_user_init(TokenBucket* b);
+
+// Take one token. Return 1 if allowed, 0 if the command is throttled.
+int ratelimit_user(TokenBucket* b);
+int ratelimit_room(const char* room);
+
+// Write throttle counts and the active limits to the client in slot.
+void ratelimit_report(int slot);
+
+#endif /* RATELIMIT_H */
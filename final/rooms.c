@@ -0,0 +1,141 @@
+// rooms.c
+#include <string.h>
+
+#include "rooms.h"
+#include "presence.h"
+
+// Open-addressed table of ROOM_TABLE_SIZE entries. A client's joined[]
+// bits refer to entry indexes. An entry whose last member left stays in
+// probe chains as a tombstone and is reused by the next new room that
+// probes past it. Tombstones only make chains longer, so once there are
+// ROOM_TOMBSTONE_LIMIT of them the live rooms are reinserted into a clean
+// table and their members' joined[] bits follow them.
+
+#define ROOM_TOMBSTONE_LIMIT (ROOM_TABLE_SIZE / 4)
+
+static Room table[ROOM_TABLE_SIZE];
+static int tombstones;
+
+static uint32_t room_hash(const char* s) {
+    uint32_t h = 2166136261u;
+    while (*s) h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+}
+
+// Index of the room, or -1. With create, an empty entry is claimed for a
+// room that isn't there yet.
+static int room_index(const char* name, int create) {
+    int free_slot = -1;
+    uint32_t i = room_hash(name) & (ROOM_TABLE_SIZE - 1);
+    for (int probes = 0; probes < ROOM_TABLE_SIZE; probes++, i = (i + 1) & (ROOM_TABLE_SIZE - 1)) {
+        Room* r = &table[i];
+        if (!r->used) {
+            if (free_slot < 0) free_slot = i;
+            break;
+        }
+        if (r->count > 0 && strcmp(r->name, name) == 0) return i;
+        if (r->count == 0 && free_slot < 0) free_slot = i;
+    }
+    if (!create || free_slot < 0) return -1;
+
+    Room* r = &table[free_slot];
+    if (r->used) tombstones--;
+    memset(r, 0, sizeof(*r));
+    strncpy(r->name, name, MAX_ROOMNAME - 1);
+    r->used = 1;
+    return free_slot;
+}
+
+static void rebuild(void) {
+    static Room live[ROOM_TABLE_SIZE];
+    int n = 0;
+    for (int i = 0; i < ROOM_TABLE_SIZE; i++) {
+        if (table[i].count > 0) live[n++] = table[i];
+    }
+    for (int s = 0; s < MAX_CLIENTS; s++) {
+        if (clients[s]) memset(clients[s]->joined, 0, sizeof(clients[s]->joined));
+    }
+    memset(table, 0, sizeof(table));
+    tombstones = 0;
+
+    for (int k = 0; k < n; k++) {
+        uint32_t i = room_hash(live[k].name) & (ROOM_TABLE_SIZE - 1);
+        while (table[i].used) i = (i + 1) & (ROOM_TABLE_SIZE - 1);
+        table[i] = live[k];
+        for (int w = 0; w < ROOM_MEMBER_WORDS; w++) {
+            uint64_t bits = live[k].members[w];
+            while (bits) {
+                Client* c = clients[w * 64 + __builtin_ctzll(bits)];
+                bits &= bits - 1;
+                if (c) c->joined[i / 64] |= 1ull << (i % 64);
+            }
+        }
+    }
+}
+
+int room_join(Client* cli, const char* name) {
+    int idx = room_index(name, 1);
+    if (idx < 0) return -1;
+    Room* r = &table[idx];
+    uint64_t bit = 1ull << (cli->slot % 64);
+    if (r->members[cli->slot / 64] & bit) return 0;
+    r->members[cli->slot / 64] |= bit;
+    r->count++;
+    cli->joined[idx / 64] |= 1ull << (idx % 64);
+    presence_room(cli, name, 1);
+    return 1;
+}
+
+int room_leave(Client* cli, const char* name) {
+    int idx = room_index(name, 0);
+    if (idx < 0) return 0;
+    Room* r = &table[idx];
+    uint64_t bit = 1ull << (cli->slot % 64);
+    if (!(r->members[cli->slot / 64] & bit)) return 0;
+    r->members[cli->slot / 64] &= ~bit;
+    r->count--;
+    cli->joined[idx / 64] &= ~(1ull << (idx % 64));
+    presence_room(cli, name, 0);
+    if (r->count == 0 && ++tombstones >= ROOM_TOMBSTONE_LIMIT) rebuild();
+    return 1;
+}
+
+Room* room_find(const char* name) {
+    int idx = room_index(name, 0);
+    return idx < 0 ? NULL : &table[idx];
+}
+
+int room_is_member(const Client* cli, const char* name) {
+    int idx = room_index(name, 0);
+    return idx >= 0 && (cli->joined[idx / 64] >> (idx % 64) & 1);
+}
+
+int room_member_count(const char* name) {
+    Room* r = room_find(name);
+    return r ? r->count : 0;
+}
+
+int room_joined_count(const Client* cli) {
+    int n = 0;
+    for (int w = 0; w < ROOM_TABLE_SIZE / 64; w++) n += __builtin_popcountll(cli->joined[w]);
+    return n;
+}
+
+int room_list(const Client* cli, char names[][MAX_ROOMNAME], int max) {
+    int n = 0;
+    for (int w = 0; w < ROOM_TABLE_SIZE / 64 && n < max; w++) {
+        uint64_t bits = cli->joined[w];
+        while (bits && n < max) {
+            int idx = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            strcpy(names[n++], table[idx].name);
+        }
+    }
+    return n;
+}
+
+void room_foreach(int (*fn)(Room* room, void* arg), void* arg) {
+    for (int i = 0; i < ROOM_TABLE_SIZE; i++) {
+        if (table[i].count > 0 && fn(&table[i], arg)) return;
+    }
+}
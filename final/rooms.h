@@ -0,0 +1,40 @@
+// rooms.h
+#ifndef ROOMS_H
+#define ROOMS_H
+
+#include <stdint.h>
+#include "chatserver.h"
+
+// Room membership. Every room has a bitset indexed by client slot and every
+// client a bitset indexed by room table entry, so fan-out is a scan of the
+// room's set bits and a user's rooms are a scan of their own bits. All
+// functions expect clients_mutex to be held.
+
+typedef struct {
+    char name[MAX_ROOMNAME];
+    uint64_t members[ROOM_MEMBER_WORDS];   // Bit i: clients[i] is in the room
+    int count;
+    unsigned int posts;                    // Broadcasts since the last rebalance
+    int used;                              // Entry has held a room; ends probe chains when 0
+} Room;
+
+// Add or remove a client. room_join returns 1 if joined, 0 if already a
+// member and -1 if the room table is full; room_leave returns 1 if left and
+// 0 if the client wasn't a member.
+int room_join(Client* cli, const char* name);
+int room_leave(Client* cli, const char* name);
+
+// The room's entry, or NULL if nobody has joined it
+Room* room_find(const char* name);
+
+int room_is_member(const Client* cli, const char* name);
+int room_member_count(const char* name);
+int room_joined_count(const Client* cli);
+
+// Copy the names of the client's rooms into names; returns how many.
+int room_list(const Client* cli, char names[][MAX_ROOMNAME], int max);
+
+// Visit every room with members. Stops early if fn returns nonzero.
+void room_foreach(int (*fn)(Room* room, void* arg), void* arg);
+
+#endif /* ROOMS_H */
@@ -0,0 +1,447 @@
+// search.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "chatserver.h"
+#include "shard.h"
+#include "pool.h"
+#include "search.h"
+
+// Posting lists hold ascending doc ids as varint-encoded deltas. Every
+// SKIP_INTERVAL postings a skip entry remembers where a block starts, so a
+// short list can be intersected with a huge one without decoding all of it.
+// Room and user are indexed as the terms "r:<room>" and "u:<user>".
+//
+// Posting data and skip arrays live in power-of-two blocks from per-size
+// pools, and outgrown blocks go back to their pool, so indexing a message
+// only touches the heap when a pool needs a new chunk. The term table
+// starts big enough that steady traffic doesn't rehash.
+
+#define TERM_MAX 32
+#define KEY_MAX (MAX_ROOMNAME + 2)      // "r:<room>" with its NUL
+#define SKIP_INTERVAL 128
+#define INDEX_CHUNK (256 * 1024)
+#define DOC_MAX (BUFFER_SIZE + 2 * MAX_ROOMNAME)
+#define BLOCK_MIN_SHIFT 4               // Pooled blocks are 16 bytes ...
+#define BLOCK_MAX_SHIFT 16              // ... to 64 KB; bigger ones use realloc
+#define BLOCK_MAX ((size_t)1 << BLOCK_MAX_SHIFT)
+#define BLOCK_CHUNK (256 * 1024)        // Bytes per pool chunk
+#define INITIAL_TERMS 16384
+#define INITIAL_DOCS 65536
+#define REPLY_BUF (16 * 1024)           // /search output is sent in pieces this big
+
+typedef struct {
+    uint32_t prev_doc;   // Last doc id before the block
+    uint32_t off;        // Byte offset of the block in data
+} SkipEntry;
+
+typedef struct {
+    char term[KEY_MAX];
+    uint8_t* data;
+    uint32_t len, cap;
+    uint32_t count;
+    uint32_t last_doc;
+    SkipEntry* skips;
+    uint32_t nskips, skips_cap;
+} Posting;
+
+typedef struct {
+    const Posting* p;
+    uint32_t idx;        // Postings consumed so far
+    uint32_t pos;        // Byte offset of the next varint
+    uint32_t doc;        // Current doc id
+    int valid;
+} Cursor;
+
+static Posting* postings = NULL;
+static uint32_t nposting = 0, posting_cap = 0;
+static uint32_t* table = NULL;          // Posting index + 1, 0 = empty slot
+static uint32_t table_cap = 0;
+static uint64_t* doc_offsets = NULL;    // Doc id -> offset in the docs file
+static uint32_t ndocs = 0, docs_cap = 0;
+static int docs_fd = -1;
+static off_t indexed_off = 0;
+
+static pthread_rwlock_t index_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t pending_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pending_cond = PTHREAD_COND_INITIALIZER;
+static int pending = 0;
+static Pool blocks[BLOCK_MAX_SHIFT + 1];  // blocks[s] holds 1 << s bytes
+
+static uint32_t hash_term(const char* s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int grow(void** ptr, uint32_t* cap, uint32_t need, size_t elem, uint32_t first) {
+    if (need <= *cap) return 0;
+    uint32_t n = *cap ? *cap : first;
+    while (n < need) n *= 2;
+    void* p = realloc(*ptr, (size_t)n * elem);
+    if (!p) return -1;
+    *ptr = p;
+    *cap = n;
+    return 0;
+}
+
+// Like grow() for a posting's own arrays, in pooled power-of-two blocks
+static int grow_block(void** ptr, uint32_t* cap, uint32_t need, size_t elem) {
+    if (need <= *cap) return 0;
+    size_t old = (size_t)*cap * elem;
+    size_t size = (size_t)1 << BLOCK_MIN_SHIFT;
+    while (size < (size_t)need * elem) size *= 2;
+
+    void* p;
+    if (size > BLOCK_MAX) heap_miss();
+    if (old > BLOCK_MAX) {
+        p = realloc(*ptr, size);    // Already past the pools
+    } else {
+        p = size > BLOCK_MAX ? malloc(size) : pool_get(&blocks[__builtin_ctzll(size)]);
+        if (p && old) {
+            memcpy(p, *ptr, old);
+            pool_put(&blocks[__builtin_ctzll(old)], *ptr);
+        }
+    }
+    if (!p) return -1;
+    *ptr = p;
+    *cap = size / elem;
+    return 0;
+}
+
+static Posting* find_posting(const char* term) {
+    if (table_cap == 0) return NULL;
+    for (uint32_t i = hash_term(term) & (table_cap - 1);; i = (i + 1) & (table_cap - 1)) {
+        if (table[i] == 0) return NULL;
+        if (strcmp(postings[table[i] - 1].term, term) == 0) return &postings[table[i] - 1];
+    }
+}
+
+static int rehash(uint32_t cap) {
+    uint32_t* t = calloc(cap, sizeof(uint32_t));
+    if (!t) return -1;
+    for (uint32_t p = 0; p < nposting; p++) {
+        uint32_t i = hash_term(postings[p].term) & (cap - 1);
+        while (t[i]) i = (i + 1) & (cap - 1);
+        t[i] = p + 1;
+    }
+    free(table);
+    table = t;
+    table_cap = cap;
+    return 0;
+}
+
+static Posting* get_posting(const char* term) {
+    Posting* p = find_posting(term);
+    if (p) return p;
+
+    if (strlen(term) >= KEY_MAX) return NULL;
+    if ((nposting + 1) * 10 >= table_cap * 7 && rehash(table_cap ? table_cap * 2 : INITIAL_TERMS * 2) < 0) return NULL;
+    if (grow((void**)&postings, &posting_cap, nposting + 1, sizeof(Posting), INITIAL_TERMS) < 0) return NULL;
+
+    p = &postings[nposting];
+    memset(p, 0, sizeof(*p));
+    strcpy(p->term, term);
+
+    uint32_t i = hash_term(term) & (table_cap - 1);
+    while (table[i]) i = (i + 1) & (table_cap - 1);
+    table[i] = ++nposting;
+    return p;
+}
+
+static void posting_add(const char* term, uint32_t doc) {
+    Posting* p = get_posting(term);
+    if (!p || (p->count > 0 && p->last_doc == doc)) return;  // Once per doc
+
+    if (grow_block((void**)&p->data, &p->cap, p->len + 5, 1) < 0) return;
+    if (p->count % SKIP_INTERVAL == 0) {
+        if (grow_block((void**)&p->skips, &p->skips_cap, p->nskips + 1, sizeof(SkipEntry)) < 0) return;
+        p->skips[p->nskips].prev_doc = p->count ? p->last_doc : 0;
+        p->skips[p->nskips].off = p->len;
+        p->nskips++;
+    }
+
+    uint32_t delta = p->count ? doc - p->last_doc : doc;
+    do {
+        uint8_t b = delta & 0x7f;
+        delta >>= 7;
+        p->data[p->len++] = delta ? (b | 0x80) : b;
+    } while (delta);
+    p->last_doc = doc;
+    p->count++;
+}
+
+static int cursor_next(Cursor* c) {
+    if (c->idx >= c->p->count) {
+        c->valid = 0;
+        return 0;
+    }
+    uint32_t delta = 0;
+    int shift = 0;
+    uint8_t b;
+    do {
+        b = c->p->data[c->pos++];
+        delta |= (uint32_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    c->doc = c->idx == 0 ? delta : c->doc + delta;
+    c->idx++;
+    c->valid = 1;
+    return 1;
+}
+
+// Advance to the first posting >= target
+static int cursor_seek(Cursor* c, uint32_t target) {
+    if (c->valid && c->doc >= target) return 1;
+
+    // Largest block whose predecessor is still below target
+    uint32_t lo = 0, hi = c->p->nskips;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (mid == 0 || c->p->skips[mid].prev_doc < target) lo = mid + 1;
+        else hi = mid;
+    }
+    uint32_t block = lo ? lo - 1 : 0;
+    if (block * SKIP_INTERVAL > c->idx) {
+        c->idx = block * SKIP_INTERVAL;
+        c->pos = c->p->skips[block].off;
+        c->doc = c->p->skips[block].prev_doc;
+    }
+
+    while (cursor_next(c)) {
+        if (c->doc >= target) return 1;
+    }
+    return 0;
+}
+
+// Split text into lowercase alphanumeric terms. Returns number of terms.
+static int tokenize(const char* text, char terms[][TERM_MAX + 1], int max) {
+    int n = 0;
+    while (*text && n < max) {
+        while (*text && !isalnum((unsigned char)*text)) text++;
+        int len = 0;
+        while (isalnum((unsigned char)*text)) {
+            if (len < TERM_MAX) terms[n][len] = tolower((unsigned char)*text);
+            len++;
+            text++;
+        }
+        if (len > 0 && len <= TERM_MAX) terms[n++][len] = '\0';
+    }
+    return n;
+}
+
+// Index one "room\tuser\ttext" record. Caller holds the write lock.
+static void index_doc(char* line, uint64_t offset) {
+    char* room = line;
+    char* user = strchr(room, '\t');
+    if (!user) return;
+    *user++ = '\0';
+    char* text = strchr(user, '\t');
+    if (!text) return;
+    *text++ = '\0';
+
+    if (grow((void**)&doc_offsets, &docs_cap, ndocs + 1, sizeof(uint64_t), INITIAL_DOCS) < 0) return;
+    uint32_t doc = ndocs++;
+    doc_offsets[doc] = offset;
+
+    char term[TERM_MAX + MAX_ROOMNAME];
+    snprintf(term, sizeof(term), "r:%s", room);
+    posting_add(term, doc);
+    snprintf(term, sizeof(term), "u:%s", user);
+    posting_add(term, doc);
+
+    static char words[BUFFER_SIZE / 2][TERM_MAX + 1];
+    int n = tokenize(text, words, BUFFER_SIZE / 2);
+    for (int i = 0; i < n; i++) {
+        posting_add(words[i], doc);
+    }
+}
+
+// Index everything appended to the docs file since the last pass
+static void index_pending(char* chunk) {
+    ssize_t got;
+    while ((got = pread(docs_fd, chunk, INDEX_CHUNK, indexed_off)) > 0) {
+        ssize_t p = 0;
+        pthread_rwlock_wrlock(&index_lock);
+        while (p < got) {
+            char* nl = memchr(chunk + p, '\n', got - p);
+            if (!nl) break;  // Partial record, pick it up next time
+            *nl = '\0';
+            index_doc(chunk + p, indexed_off + p);
+            p = nl - chunk + 1;
+        }
+        pthread_rwlock_unlock(&index_lock);
+        if (p == 0) break;
+        indexed_off += p;
+    }
+}
+
+static void* indexer_thread(void* arg) {
+    (void)arg;
+    char* chunk = malloc(INDEX_CHUNK);
+    if (!chunk) return NULL;
+
+    index_pending(chunk);
+    char logbuf[128];
+    snprintf(logbuf, sizeof(logbuf), "[SEARCH] index ready: %u messages, %u terms", ndocs, nposting);
+    log_event(logbuf);
+
+    while (1) {
+        pthread_mutex_lock(&pending_mutex);
+        while (!pending) {
+            pthread_cond_wait(&pending_cond, &pending_mutex);
+        }
+        pending = 0;
+        pthread_mutex_unlock(&pending_mutex);
+
+        index_pending(chunk);
+    }
+    return NULL;
+}
+
+int search_init(void) {
+    for (int s = BLOCK_MIN_SHIFT; s <= BLOCK_MAX_SHIFT; s++) {
+        pool_init(&blocks[s], NULL, (size_t)1 << s, BLOCK_CHUNK >> s ? BLOCK_CHUNK >> s : 1);
+    }
+
+    docs_fd = open(SEARCH_DOCS_FILE, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (docs_fd < 0) {
+        perror("search docs open");
+        return -1;
+    }
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, indexer_thread, NULL) != 0) {
+        perror("search indexer");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+void search_submit(const char* room, const char* user, const char* text) {
+    if (docs_fd < 0) return;
+
+    char line[DOC_MAX];
+    int len = snprintf(line, sizeof(line), "%s\t%s\t", room, user);
+    for (const char* t = text; *t && len < (int)sizeof(line) - 1; t++) {
+        line[len++] = (*t == '\t' || *t == '\n' || *t == '\r') ? ' ' : *t;
+    }
+    line[len++] = '\n';
+
+    // One O_APPEND write keeps records whole; the indexer tails the file
+    if (write(docs_fd, line, len) != len) {
+        perror("search submit");
+        return;
+    }
+
+    pthread_mutex_lock(&pending_mutex);
+    pending = 1;
+    pthread_cond_signal(&pending_cond);
+    pthread_mutex_unlock(&pending_mutex);
+}
+
+static int cmp_count(const void* a, const void* b) {
+    const Posting* x = *(const Posting* const*)a;
+    const Posting* y = *(const Posting* const*)b;
+    return x->count < y->count ? -1 : x->count > y->count;
+}
+
+int search_query(int slot, const char* room, char* terms) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    char keys[SEARCH_MAX_TERMS + 2][TERM_MAX + MAX_ROOMNAME];
+    int nkeys = 0;
+    snprintf(keys[nkeys++], sizeof(keys[0]), "r:%s", room);
+    char* save = NULL;
+    for (char* tok = strtok_r(terms, " ", &save); tok && nkeys < SEARCH_MAX_TERMS + 2;
+         tok = strtok_r(NULL, " ", &save)) {
+        if (strncmp(tok, "from:", 5) == 0) {
+            snprintf(keys[nkeys++], sizeof(keys[0]), "u:%s", tok + 5);
+            continue;
+        }
+        char words[SEARCH_MAX_TERMS][TERM_MAX + 1];
+        int n = tokenize(tok, words, SEARCH_MAX_TERMS);
+        for (int i = 0; i < n && nkeys < SEARCH_MAX_TERMS + 2; i++) {
+            strcpy(keys[nkeys++], words[i]);
+        }
+    }
+
+    uint64_t hits[SEARCH_MAX_RESULTS];
+    int nhits = 0;
+    uint32_t matched = 0;
+    uint32_t last[SEARCH_MAX_RESULTS];   // Ring of the newest matches
+
+    pthread_rwlock_rdlock(&index_lock);
+    const Posting* lists[SEARCH_MAX_TERMS + 2];
+    int missing = 0;
+    for (int i = 0; i < nkeys; i++) {
+        lists[i] = find_posting(keys[i]);
+        if (!lists[i]) missing = 1;
+    }
+
+    if (!missing) {
+        // Start from the rarest term and probe the others with skip-aware seeks
+        qsort(lists, nkeys, sizeof(lists[0]), cmp_count);
+        Cursor cur[SEARCH_MAX_TERMS + 2];
+        for (int i = 0; i < nkeys; i++) cur[i] = (Cursor){ lists[i], 0, 0, 0, 0 };
+
+        int done = 0;
+        while (!done && cursor_next(&cur[0])) {
+            int all = 1;
+            for (int i = 1; i < nkeys && all; i++) {
+                if (!cursor_seek(&cur[i], cur[0].doc)) done = 1;
+                all = !done && cur[i].doc == cur[0].doc;
+            }
+            if (all) last[matched++ % SEARCH_MAX_RESULTS] = cur[0].doc;
+        }
+
+        // Newest first
+        for (uint32_t j = matched; j > 0 && nhits < SEARCH_MAX_RESULTS; j--) {
+            hits[nhits++] = doc_offsets[last[(j - 1) % SEARCH_MAX_RESULTS]];
+        }
+    }
+    pthread_rwlock_unlock(&index_lock);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+
+    // Whole lines only; the buffer is sent whenever the next one might not fit
+    char out[REPLY_BUF];
+    size_t cap = sizeof(out);
+    size_t len = snprintf(out, cap, "[SEARCH] %u match(es) in '%s' (%.2f ms), showing %d:\n",
+                          matched, room, ms, nhits);
+    if (len >= cap) len = cap - 1;  // snprintf returns what it would have written
+
+    for (int i = 0; i < nhits; i++) {
+        if (cap - len < DOC_MAX + 8) {
+            if (shard_send(slot, out, len) < 0) return -1;
+            len = 0;
+        }
+        char line[DOC_MAX + 1];
+        ssize_t got = pread(docs_fd, line, DOC_MAX, hits[i]);
+        if (got <= 0) continue;
+        line[got] = '\0';
+        line[strcspn(line, "\n")] = '\0';
+
+        char* user = strchr(line, '\t');
+        char* text = user ? strchr(user + 1, '\t') : NULL;
+        if (!text) continue;
+        *text++ = '\0';
+        len += snprintf(out + len, cap - len, "[%s]: %s\n", user + 1, text);
+        if (len >= cap) len = cap - 1;
+    }
+
+    return shard_send(slot, out, len) < 0 ? -1 : nhits;
+}
@@ -0,0 +1,20 @@
+// search.h
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#define SEARCH_DOCS_FILE "search.dat"  // Append-only "room\tuser\ttext\n" records
+#define SEARCH_MAX_RESULTS 20
+#define SEARCH_MAX_TERMS 8
+
+// Open the document file and start the background indexer, which first
+// indexes everything already in the file. Returns 0 or -1.
+int search_init(void);
+
+// Record a room message for indexing. Cheap: one append, indexing happens later.
+void search_submit(const char* room, const char* user, const char* text);
+
+// Answer "/search <room> <terms>" for the client in slot. Terms are ANDed; "from:<user>"
+// restricts to one sender. Returns number of results sent or -1 on error.
+int search_query(int slot, const char* room, char* terms);
+
+#endif /* SEARCH_H */
@@ -0,0 +1,24 @@
+// sha256.h
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_LEN 32
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t bitlen;
+    uint8_t block[64];
+    size_t block_len;
+} Sha256Ctx;
+
+void sha256_init(Sha256Ctx* ctx);
+void sha256_update(Sha256Ctx* ctx, const void* data, size_t len);
+void sha256_final(Sha256Ctx* ctx, uint8_t digest[SHA256_DIGEST_LEN]);
+
+// Lowercase hex form, out must hold 2 * SHA256_DIGEST_LEN + 1 bytes
+void sha256_hex(const uint8_t digest[SHA256_DIGEST_LEN], char* out);
+
+#endif /* SHA256_H */
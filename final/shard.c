@@ -0,0 +1,638 @@
+// shard.c
+#define _GNU_SOURCE  // memrchr
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#include "chatserver.h"
+#include "netio.h"
+#include "rooms.h"
+#include "pool.h"
+#include "trace.h"
+#include "shard.h"
+
+// A broadcast is copied once into a refcounted buffer; each shard holding
+// members gets one queue entry with the bits of the members it owns. The
+// writer moves each entry onto the output queues of its target slots and
+// writes them with non-blocking sends, resuming partial writes where they
+// stopped; sockets that are full wait in poll() for POLLOUT, so one slow
+// reader never holds up the rest of the shard. Per-connection order is the
+// order of the shard's queue. A connection whose output queue fills up is
+// shut down; its own thread then sees the disconnect and detaches it.
+//
+// Replies to a client's own commands take the same path (shard_send), as
+// single-target entries, so they never land in the middle of a room line
+// the writer has half sent. Its thread waits while the connection already
+// has half a queue waiting, instead of being dropped for pipelining.
+//
+// Locks: a shard's lock guards its queue and the entries being moved
+// (current); fd_lock guards the connections. The writer only holds fd_lock
+// for non-blocking work, so attach, detach and move never wait on a socket.
+// Detach clears the slot's bit from queued and current entries, so a
+// message never reaches whoever takes over a freed slot. shard_of only
+// changes under the owning shard's lock, which is how shard_send finds the
+// right queue without clients_mutex.
+
+typedef struct {
+    int refs;
+    uint32_t trace_id;      // Traced message, 0 if not sampled
+    int unsent[SHARD_COUNT];    // Traced only: targets per shard not yet written
+    size_t len;
+    char data[];
+} SharedBuf;
+
+typedef struct OutMsg {
+    SharedBuf* buf;
+    uint64_t targets[ROOM_MEMBER_WORDS];
+    int reply_slot;         // Slot of a shard_send() entry, -1 for broadcasts
+    struct OutMsg* next;
+} OutMsg;
+
+// A connection owned by a shard, with what hasn't reached its socket yet
+typedef struct {
+    int fd;                             // -1 if the slot is not on this shard
+    int broken;                         // Send failed or queue overflowed; nothing more is queued
+    SharedBuf* out[SHARD_CONN_QUEUE];   // Ring, oldest at head
+    int head, count;
+    size_t offset;                      // Bytes of out[head] already written
+    int incoming;                       // Replies still in the shard's queue
+} Conn;
+
+typedef struct {
+    pthread_mutex_t lock;
+    OutMsg *head, *tail;
+    OutMsg* current;            // Entries being moved to output queues, NULL when idle
+    int queued;
+    int sleeping;               // Writer is (about to be) in poll(); wake it through wake_fd
+    int wake_fd;                // eventfd
+
+    pthread_mutex_t fd_lock;
+    pthread_cond_t drained;     // Broadcast after each writer pass, with fd_lock
+    Conn conns[MAX_CLIENTS];
+    int clients;
+    long pending_bytes;         // Queued on this shard's connections, not yet written
+
+    unsigned long delivered;    // Messages fully handed to the kernel
+    unsigned long entries;      // Queue entries processed
+    unsigned long dropped;      // Connections shut down for not reading
+} Shard;
+
+static Shard shards[SHARD_COUNT];
+
+// Changed under clients_mutex and the owning shard's lock
+static int shard_of[MAX_CLIENTS];
+static time_t last_move[MAX_CLIENTS];   // Owned by whoever holds clients_mutex
+
+// Queue entries and message copies up to a chat line's size come from
+// pools; only oversized lines (big presence batches) use the heap
+#define SMALL_MSG (BUFFER_SIZE + 64)
+static Pool msg_pool, buf_pool;
+
+static unsigned long broadcasts = 0, cross_shard = 0, migrations = 0, skipped_busy = 0;
+
+static void buf_release(SharedBuf* buf) {
+    if (__atomic_sub_fetch(&buf->refs, 1, __ATOMIC_ACQ_REL) > 0) return;
+    if (buf->len <= SMALL_MSG) pool_put(&buf_pool, buf);
+    else free(buf);
+}
+
+// A traced buffer's targets on shard s that are still to be written; the
+// shard's TRACE_SENT is when the last of them finishes. Caller holds fd_lock.
+static void trace_unsent(Shard* s, SharedBuf* buf, int n) {
+    if (buf->trace_id) buf->unsent[s - shards] += n;
+}
+
+static void wake(Shard* s) {
+    uint64_t one = 1;
+    if (write(s->wake_fd, &one, sizeof(one)) < 0) {}
+}
+
+// Append an entry to the shard's queue. Caller holds s->lock; returns 1 if
+// the writer has to be woken once the lock is released.
+static int enqueue_locked(Shard* s, OutMsg* m) {
+    if (s->tail) s->tail->next = m;
+    else s->head = m;
+    s->tail = m;
+    s->queued++;
+    int asleep = s->sleeping;
+    s->sleeping = 0;
+    return asleep;
+}
+
+// Drop everything queued on a connection. Caller holds fd_lock.
+static void conn_clear(Shard* s, Conn* c) {
+    while (c->count > 0) {
+        SharedBuf* buf = c->out[c->head];
+        s->pending_bytes -= buf->len - c->offset;
+        trace_unsent(s, buf, -1);
+        buf_release(buf);
+        c->head = (c->head + 1) % SHARD_CONN_QUEUE;
+        c->count--;
+        c->offset = 0;
+    }
+    c->head = 0;
+}
+
+// A reader that stopped reading: shut the socket so its thread notices
+static void conn_drop(Shard* s, Conn* c, int slot) {
+    conn_clear(s, c);
+    c->broken = 1;
+    shutdown(c->fd, SHUT_RDWR);
+    s->dropped++;
+    char logbuf[96];
+    snprintf(logbuf, sizeof(logbuf), "[SHARD] Dropped connection in slot %d: output queue full.", slot);
+    log_event(logbuf);
+}
+
+// Write as much as the socket takes without blocking. Caller holds fd_lock.
+static void conn_flush(Shard* s, Conn* c) {
+    while (c->count > 0 && !c->broken) {
+        SharedBuf* buf = c->out[c->head];
+        ssize_t n = send(c->fd, buf->data + c->offset, buf->len - c->offset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            conn_clear(s, c);
+            c->broken = 1;
+            return;
+        }
+        c->offset += n;
+        s->pending_bytes -= n;
+        if (c->offset < buf->len) return;
+        if (buf->trace_id && --buf->unsent[s - shards] == 0) trace_record(buf->trace_id, TRACE_SENT);
+        buf_release(buf);
+        c->head = (c->head + 1) % SHARD_CONN_QUEUE;
+        c->count--;
+        c->offset = 0;
+        s->delivered++;
+    }
+}
+
+static void conn_push(Shard* s, Conn* c, int slot, SharedBuf* buf) {
+    if (c->fd < 0 || c->broken) return;
+    if (c->count == SHARD_CONN_QUEUE) {
+        conn_drop(s, c, slot);
+        return;
+    }
+    __atomic_add_fetch(&buf->refs, 1, __ATOMIC_RELAXED);
+    trace_unsent(s, buf, 1);
+    c->out[(c->head + c->count) % SHARD_CONN_QUEUE] = buf;
+    c->count++;
+    s->pending_bytes += buf->len;
+}
+
+static void* shard_writer(void* arg) {
+    Shard* s = arg;
+    struct pollfd fds[MAX_CLIENTS + 1];
+    while (1) {
+        pthread_mutex_lock(&s->lock);
+        OutMsg* list = s->head;
+        s->head = s->tail = NULL;
+        s->queued = 0;
+        s->current = list;
+        pthread_mutex_unlock(&s->lock);
+
+        // Move the entries onto the output queues, then write what the
+        // sockets take
+        pthread_mutex_lock(&s->fd_lock);
+        unsigned long nentries = 0;
+        for (OutMsg* m = list; m; m = m->next) {
+            int r = m->reply_slot;
+            if (r >= 0 && (m->targets[r / 64] >> (r % 64)) & 1) s->conns[r].incoming--;
+            for (int w = 0; w < ROOM_MEMBER_WORDS; w++) {
+                uint64_t bits = m->targets[w];
+                while (bits) {
+                    int slot = w * 64 + __builtin_ctzll(bits);
+                    bits &= bits - 1;
+                    conn_push(s, &s->conns[slot], slot, m->buf);
+                }
+            }
+            nentries++;
+        }
+        int nfds = 1;
+        fds[0].fd = s->wake_fd;
+        fds[0].events = POLLIN;
+        for (int slot = 0; slot < MAX_CLIENTS; slot++) {
+            Conn* c = &s->conns[slot];
+            if (c->fd < 0 || c->count == 0) continue;
+            conn_flush(s, c);
+            if (c->count > 0 && !c->broken) {
+                fds[nfds].fd = c->fd;
+                fds[nfds].events = POLLOUT;
+                nfds++;
+            }
+        }
+        pthread_cond_broadcast(&s->drained);
+        pthread_mutex_unlock(&s->fd_lock);
+
+        pthread_mutex_lock(&s->lock);
+        s->current = NULL;
+        s->entries += nentries;
+        int idle = s->head == NULL;
+        s->sleeping = idle;
+        pthread_mutex_unlock(&s->lock);
+
+        while (list) {
+            OutMsg* m = list;
+            list = m->next;
+            buf_release(m->buf);
+            pool_put(&msg_pool, m);
+        }
+
+        // New entries or a socket with room again
+        if (idle) {
+            if (poll(fds, nfds, -1) < 0 && errno != EINTR) perror("shard poll");
+            if (fds[0].revents & POLLIN) {
+                uint64_t n;
+                if (read(s->wake_fd, &n, sizeof(n)) < 0) {}
+            }
+            pthread_mutex_lock(&s->lock);
+            s->sleeping = 0;
+            pthread_mutex_unlock(&s->lock);
+        }
+    }
+    return NULL;
+}
+
+// Caller holds clients_mutex, so no new entries can appear for the slot.
+// The connection moves with its unwritten output, so nothing is waited
+// for; a slot still named by entries the old writer hasn't taken yet is
+// left for a later tick.
+static int shard_move(int slot, int to) {
+    int from = shard_of[slot];
+    if (from < 0 || from == to) return -1;
+    Shard* a = &shards[from];
+    Shard* b = &shards[to];
+    uint64_t bit = 1ull << (slot % 64);
+
+    pthread_mutex_lock(&a->lock);
+    int busy = 0;
+    for (OutMsg* m = a->head; m && !busy; m = m->next) busy = (m->targets[slot / 64] & bit) != 0;
+    for (OutMsg* m = a->current; m && !busy; m = m->next) busy = (m->targets[slot / 64] & bit) != 0;
+    if (busy) {
+        pthread_mutex_unlock(&a->lock);
+        skipped_busy++;
+        return -1;
+    }
+
+    // Installed on b before shard_of changes, so a shard_send that sees
+    // the new shard finds the connection there. Only the rebalancer holds
+    // two fd_locks at once, under clients_mutex.
+    pthread_mutex_lock(&a->fd_lock);
+    Conn* moving = &a->conns[slot];
+    long bytes = 0;
+    for (int i = 0; i < moving->count; i++) bytes += moving->out[(moving->head + i) % SHARD_CONN_QUEUE]->len;
+    bytes -= moving->offset;
+    int queued = moving->count;
+
+    pthread_mutex_lock(&b->fd_lock);
+    for (int i = 0; i < moving->count; i++) {
+        SharedBuf* buf = moving->out[(moving->head + i) % SHARD_CONN_QUEUE];
+        trace_unsent(a, buf, -1);
+        trace_unsent(b, buf, 1);
+    }
+    b->conns[slot] = *moving;
+    b->pending_bytes += bytes;
+    b->clients++;
+    pthread_mutex_unlock(&b->fd_lock);
+
+    a->pending_bytes -= bytes;
+    moving->fd = -1;
+    moving->count = 0;
+    a->clients--;
+    __atomic_store_n(&shard_of[slot], to, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&a->drained);    // Waiters look the slot up again
+    pthread_mutex_unlock(&a->fd_lock);
+    pthread_mutex_unlock(&a->lock);
+    if (queued > 0) wake(b);
+
+    last_move[slot] = time(NULL);
+    migrations++;
+    return 0;
+}
+
+typedef struct {
+    int budget;
+    int cap;          // Most clients one shard may hold after a move
+    time_t now;
+} Rebalance;
+
+// Pull the members of a busy room onto the shard most of them are on
+static int rebalance_room(Room* room, void* arg) {
+    Rebalance* rb = arg;
+    unsigned int posts = room->posts;
+    room->posts = 0;
+    if (posts < SHARD_BUSY_POSTS || rb->budget == 0) return 0;
+
+    int per_shard[SHARD_COUNT] = {0};
+    for (int w = 0; w < ROOM_MEMBER_WORDS; w++) {
+        uint64_t bits = room->members[w];
+        while (bits) {
+            int slot = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (shard_of[slot] >= 0) per_shard[shard_of[slot]]++;
+        }
+    }
+    int target = 0;
+    for (int i = 1; i < SHARD_COUNT; i++) {
+        if (per_shard[i] > per_shard[target]) target = i;
+    }
+    if (per_shard[target] == room->count) return 0;
+
+    for (int w = 0; w < ROOM_MEMBER_WORDS && rb->budget > 0; w++) {
+        uint64_t bits = room->members[w];
+        while (bits && rb->budget > 0) {
+            int slot = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (shard_of[slot] < 0 || shard_of[slot] == target) continue;
+            if (rb->now - last_move[slot] < SHARD_COOLDOWN_SEC) continue;
+            if (shards[target].clients >= rb->cap) return 0;
+            if (shard_move(slot, target) == 0) rb->budget--;
+        }
+    }
+    return 0;
+}
+
+static void* rebalance_thread(void* arg) {
+    (void)arg;
+    struct timespec tick = { SHARD_TICK_MS / 1000, (SHARD_TICK_MS % 1000) * 1000000L };
+    while (1) {
+        nanosleep(&tick, NULL);
+        pthread_mutex_lock(&clients_mutex);
+        // Co-locating must not pile everyone onto one writer
+        Rebalance rb = { SHARD_MIGRATIONS_PER_TICK, client_count / SHARD_COUNT * 2 + SHARD_COUNT, time(NULL) };
+        room_foreach(rebalance_room, &rb);
+        pthread_mutex_unlock(&clients_mutex);
+    }
+    return NULL;
+}
+
+int shard_start(void) {
+    pool_init(&msg_pool, "shard msg", sizeof(OutMsg), 64);
+    pool_init(&buf_pool, "shard buf", sizeof(SharedBuf) + SMALL_MSG, 16);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        shard_of[i] = -1;
+    }
+    for (int i = 0; i < SHARD_COUNT; i++) {
+        Shard* s = &shards[i];
+        pthread_mutex_init(&s->lock, NULL);
+        pthread_mutex_init(&s->fd_lock, NULL);
+        pthread_cond_init(&s->drained, NULL);
+        s->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (s->wake_fd < 0) {
+            perror("shard eventfd");
+            return -1;
+        }
+        for (int j = 0; j < MAX_CLIENTS; j++) {
+            s->conns[j].fd = -1;
+        }
+    }
+
+    for (int i = 0; i < SHARD_COUNT; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, shard_writer, &shards[i]) != 0) {
+            perror("shard thread");
+            return -1;
+        }
+        pthread_detach(tid);
+    }
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, rebalance_thread, NULL) != 0) {
+        perror("rebalance thread");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+void shard_attach(int slot, int fd) {
+    int best = 0;
+    for (int i = 1; i < SHARD_COUNT; i++) {
+        if (shards[i].clients < shards[best].clients) best = i;
+    }
+    Shard* s = &shards[best];
+    pthread_mutex_lock(&s->fd_lock);
+    memset(&s->conns[slot], 0, sizeof(Conn));
+    s->conns[slot].fd = fd;
+    s->clients++;
+    __atomic_store_n(&shard_of[slot], best, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&s->fd_lock);
+    last_move[slot] = 0;
+}
+
+void shard_detach(int slot) {
+    int from = shard_of[slot];
+    if (from < 0) return;
+    Shard* s = &shards[from];
+    uint64_t mask = ~(1ull << (slot % 64));
+
+    pthread_mutex_lock(&s->lock);
+    pthread_mutex_lock(&s->fd_lock);
+    conn_clear(s, &s->conns[slot]);
+    s->conns[slot].fd = -1;
+    s->clients--;
+    for (OutMsg* m = s->head; m; m = m->next) {
+        m->targets[slot / 64] &= mask;
+    }
+    for (OutMsg* m = s->current; m; m = m->next) {
+        m->targets[slot / 64] &= mask;
+    }
+    __atomic_store_n(&shard_of[slot], -1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&s->drained);
+    pthread_mutex_unlock(&s->fd_lock);
+    pthread_mutex_unlock(&s->lock);
+}
+
+int shard_broadcast(const uint64_t members[ROOM_MEMBER_WORDS], int skip_slot, const char* msg, size_t len) {
+    OutMsg* out[SHARD_COUNT] = {0};
+    int touched = 0;
+
+    for (int w = 0; w < ROOM_MEMBER_WORDS; w++) {
+        uint64_t bits = members[w];
+        while (bits) {
+            int slot = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            int sh = shard_of[slot];
+            if (slot == skip_slot || sh < 0) continue;
+            if (!out[sh]) {
+                out[sh] = pool_get(&msg_pool);
+                if (!out[sh]) continue;
+                out[sh]->reply_slot = -1;
+                touched++;
+            }
+            out[sh]->targets[w] |= 1ull << (slot % 64);
+        }
+    }
+    if (touched == 0) return 0;
+
+    SharedBuf* buf = len <= SMALL_MSG ? pool_get(&buf_pool) : malloc(sizeof(SharedBuf) + len);
+    if (len > SMALL_MSG) heap_miss();
+    if (!buf) {
+        for (int i = 0; i < SHARD_COUNT; i++) pool_put(&msg_pool, out[i]);
+        return 0;
+    }
+    buf->refs = touched;
+    buf->trace_id = trace_current();
+    memset(buf->unsent, 0, sizeof(buf->unsent));
+    buf->len = len;
+    memcpy(buf->data, msg, len);
+
+    for (int i = 0; i < SHARD_COUNT; i++) {
+        if (!out[i]) continue;
+        Shard* s = &shards[i];
+        out[i]->buf = buf;
+        pthread_mutex_lock(&s->lock);
+        int asleep = enqueue_locked(s, out[i]);
+        pthread_mutex_unlock(&s->lock);
+        if (asleep) wake(s);
+    }
+
+    __atomic_fetch_add(&broadcasts, 1, __ATOMIC_RELAXED);
+    if (touched > 1) __atomic_fetch_add(&cross_shard, 1, __ATOMIC_RELAXED);
+    return touched;
+}
+
+// Queue one piece of a reply: whole lines, so room traffic queued in
+// between never lands inside one
+static int send_piece(int slot, const char* msg, size_t len, const struct timespec* deadline) {
+    while (1) {
+        int sh = __atomic_load_n(&shard_of[slot], __ATOMIC_ACQUIRE);
+        if (sh < 0) return -1;
+        Shard* s = &shards[sh];
+        pthread_mutex_lock(&s->lock);
+        if (shard_of[slot] != sh) {     // Moved meanwhile
+            pthread_mutex_unlock(&s->lock);
+            continue;
+        }
+        pthread_mutex_lock(&s->fd_lock);
+        Conn* c = &s->conns[slot];
+        if (c->broken) {
+            pthread_mutex_unlock(&s->fd_lock);
+            pthread_mutex_unlock(&s->lock);
+            return -1;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        int late = now.tv_sec > deadline->tv_sec ||
+                   (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+        if (c->count + c->incoming >= SHARD_CONN_QUEUE / 2 && !late) {
+            // Short waits: the connection may move to another shard
+            pthread_mutex_unlock(&s->lock);
+            struct timespec until = now;
+            until.tv_nsec += 100 * 1000000L;
+            if (until.tv_nsec >= 1000000000L) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&s->drained, &s->fd_lock, &until);
+            pthread_mutex_unlock(&s->fd_lock);
+            continue;
+        }
+
+        OutMsg* m = pool_get(&msg_pool);
+        SharedBuf* buf = !m ? NULL : len <= SMALL_MSG ? pool_get(&buf_pool) : malloc(sizeof(SharedBuf) + len);
+        if (m && len > SMALL_MSG) heap_miss();
+        if (!buf) {
+            pool_put(&msg_pool, m);
+            pthread_mutex_unlock(&s->fd_lock);
+            pthread_mutex_unlock(&s->lock);
+            return -1;
+        }
+        c->incoming++;
+        pthread_mutex_unlock(&s->fd_lock);
+
+        buf->refs = 1;
+        buf->trace_id = trace_current();
+        memset(buf->unsent, 0, sizeof(buf->unsent));
+        buf->len = len;
+        memcpy(buf->data, msg, len);
+        m->buf = buf;
+        m->targets[slot / 64] = 1ull << (slot % 64);
+        m->reply_slot = slot;
+        int asleep = enqueue_locked(s, m);
+        pthread_mutex_unlock(&s->lock);
+        if (asleep) wake(s);
+        return 0;
+    }
+}
+
+static int send_pieces(int slot, const char* msg, size_t len, int wait_sec) {
+    if (slot < 0 || slot >= MAX_CLIENTS) return -1;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += wait_sec;
+    size_t off = 0;
+    while (off < len) {
+        // Up to the last newline that fits a pooled buffer; a longer line
+        // goes in one piece of its own
+        size_t piece = len - off;
+        if (piece > SMALL_MSG) {
+            const char* nl = memrchr(msg + off, '\n', SMALL_MSG);
+            if (!nl) nl = memchr(msg + off + SMALL_MSG, '\n', len - off - SMALL_MSG);
+            if (nl) piece = nl - (msg + off) + 1;
+        }
+        if (send_piece(slot, msg + off, piece, &deadline) < 0) return -1;
+        off += piece;
+    }
+    return 0;
+}
+
+int shard_send(int slot, const char* msg, size_t len) {
+    return send_pieces(slot, msg, len, SHARD_SEND_WAIT_SEC);
+}
+
+int shard_post(int slot, const char* msg, size_t len) {
+    return send_pieces(slot, msg, len, 0);
+}
+
+long shard_unsent(void) {
+    long total = 0;
+    for (int i = 0; i < SHARD_COUNT; i++) {
+        Shard* s = &shards[i];
+        // Entries the writer is moving may count twice, never zero times
+        pthread_mutex_lock(&s->lock);
+        for (OutMsg* m = s->head; m; m = m->next) total += m->buf->len;
+        for (OutMsg* m = s->current; m; m = m->next) total += m->buf->len;
+        pthread_mutex_lock(&s->fd_lock);
+        total += s->pending_bytes;
+        pthread_mutex_unlock(&s->fd_lock);
+        pthread_mutex_unlock(&s->lock);
+    }
+    return total;
+}
+
+void shard_report(int slot) {
+    char out[512];
+    size_t len = snprintf(out, sizeof(out),
+                          "[STATS] Writer shards: broadcasts %lu, cross-shard %lu, migrations %lu, deferred %lu\n",
+                          __atomic_load_n(&broadcasts, __ATOMIC_RELAXED),
+                          __atomic_load_n(&cross_shard, __ATOMIC_RELAXED),
+                          __atomic_load_n(&migrations, __ATOMIC_RELAXED),
+                          __atomic_load_n(&skipped_busy, __ATOMIC_RELAXED));
+
+    for (int i = 0; i < SHARD_COUNT && len < sizeof(out); i++) {
+        Shard* s = &shards[i];
+        pthread_mutex_lock(&s->lock);
+        int queued = s->queued;
+        unsigned long entries = s->entries;
+        pthread_mutex_unlock(&s->lock);
+        pthread_mutex_lock(&s->fd_lock);
+        int w = snprintf(out + len, sizeof(out) - len,
+                         "  shard %d: clients %d queue %d entries %lu delivered %lu unsent %ld dropped %lu\n",
+                         i, s->clients, queued, entries, s->delivered, s->pending_bytes, s->dropped);
+        pthread_mutex_unlock(&s->fd_lock);
+        if (w < 0) break;
+        len += w;
+    }
+    if (len >= sizeof(out)) len = sizeof(out) - 1;
+    shard_send(slot, out, len);
+}
@@ -0,0 +1,59 @@
+// shard.h
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "chatserver.h"
+
+#define SHARD_COUNT 4                   // Writer threads for room traffic
+#define SHARD_TICK_MS 1000              // Rebalance interval
+#define SHARD_BUSY_POSTS 5              // Broadcasts per tick that make a room worth co-locating
+#define SHARD_MIGRATIONS_PER_TICK 8     // Connections moved per tick at most
+#define SHARD_COOLDOWN_SEC 10           // Minimum time between two moves of one connection
+#define SHARD_CONN_QUEUE 256            // Messages waiting on one connection before it is dropped
+#define SHARD_SEND_WAIT_SEC 30          // Longest a reply waits for its connection's queue to drain
+
+// Room messages are written by SHARD_COUNT writer threads, each owning a
+// share of the connections. A broadcast costs one queue handoff per shard
+// its members are spread over, so a rebalancer moves members of busy rooms
+// onto the shard most of them already use.
+//
+// shard_attach, shard_detach and shard_broadcast expect clients_mutex to be
+// held; the rebalancer takes it too, which is what keeps a move from
+// reordering a connection's messages. Writers never block on a socket, so
+// none of these wait for a slow reader.
+
+// Start the writers and the rebalancer. Returns 0 or -1.
+int shard_start(void);
+
+// Place a new connection on the least loaded shard / take it off before
+// its socket is closed.
+void shard_attach(int slot, int fd);
+void shard_detach(int slot);
+
+// Queue msg for every member slot except skip_slot (-1 for none). Returns
+// the number of shards the message was handed to.
+int shard_broadcast(const uint64_t members[ROOM_MEMBER_WORDS], int skip_slot, const char* msg, size_t len);
+
+// Send a reply from the connection's own thread, in order with the room
+// traffic queued for it before. Long replies are split into pieces. Waits
+// while the connection has half a queue of messages pending, for at most
+// SHARD_SEND_WAIT_SEC. Needs no lock; the caller must not hold
+// clients_mutex, since the rebalancer takes it. Returns 0, or -1 if the
+// connection is gone or was dropped.
+int shard_send(int slot, const char* msg, size_t len);
+
+// Like shard_send for another connection (a whisper, a file notice): never
+// waits, a connection that is too far behind is dropped as for room
+// traffic. May be called with clients_mutex held.
+int shard_post(int slot, const char* msg, size_t len);
+
+// Bytes queued for clients that their sockets haven't taken yet, counting
+// entries still waiting for their writer once each
+long shard_unsent(void);
+
+// Write per-shard load, cross-shard broadcasts and migrations to the client in slot.
+void shard_report(int slot);
+
+#endif /* SHARD_H */
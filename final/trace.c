@@ -0,0 +1,218 @@
+// trace.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "trace.h"
+
+// A ring has one writer, its thread. The writer fills a slot and then
+// publishes it by advancing head with a release store. The dump copies
+// a ring without stopping the writer: it reads head, copies, reads head
+// again, and keeps only the entries the writer can't have reused in
+// between.
+
+typedef struct {
+    uint64_t ts_ns;
+    uint32_t id;
+    uint8_t phase;
+} TraceEvent;
+
+typedef struct {
+    uint64_t head;           // Events ever written
+    int owned;               // A live thread writes here
+    TraceEvent ev[TRACE_EVENTS_PER_THREAD];
+} TraceRing;
+
+typedef struct {
+    TraceEvent e;
+    int ring;
+} Collected;
+
+static const char* phase_name[] = { "recv", "parse", "lock", "fanout start", "fanout end", "sent" };
+
+// Span names, by the phase that ends them. A "write" span starts at
+// fan-out start, since the writers run while the fan-out is still queueing.
+static const char* span_name[] = { "recv", "parse", "lock wait", "room lookup", "fan-out", "write" };
+
+static TraceRing* rings[TRACE_MAX_THREADS];
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+
+static unsigned int sample_every = 0;
+static const char* dump_path = TRACE_DEFAULT_FILE;
+static uint32_t next_id = 0;
+
+static __thread TraceRing* my_ring = NULL;
+static __thread uint32_t current_id = 0;
+static __thread uint64_t recv_ns = 0;
+static __thread unsigned int seen = 0;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// The ring stays, with its events, for the dump and the next thread
+static void release_ring(void* arg) {
+    TraceRing* ring = arg;
+    __atomic_store_n(&ring->owned, 0, __ATOMIC_RELEASE);
+}
+
+static TraceRing* claim_ring(void) {
+    if (my_ring) return my_ring;
+
+    pthread_mutex_lock(&rings_mutex);
+    for (int i = 0; i < TRACE_MAX_THREADS && !my_ring; i++) {
+        if (!rings[i]) {
+            rings[i] = calloc(1, sizeof(TraceRing));
+            if (!rings[i]) break;
+        }
+        if (!__atomic_load_n(&rings[i]->owned, __ATOMIC_ACQUIRE)) {
+            rings[i]->owned = 1;
+            my_ring = rings[i];
+        }
+    }
+    pthread_mutex_unlock(&rings_mutex);
+    if (my_ring) pthread_setspecific(ring_key, my_ring);
+    return my_ring;
+}
+
+static void put_event(uint32_t id, TracePhase phase, uint64_t ts) {
+    TraceRing* ring = claim_ring();
+    if (!ring) return;
+    uint64_t h = ring->head;
+    TraceEvent* e = &ring->ev[h % TRACE_EVENTS_PER_THREAD];
+    e->ts_ns = ts;
+    e->id = id;
+    e->phase = phase;
+    __atomic_store_n(&ring->head, h + 1, __ATOMIC_RELEASE);
+}
+
+void trace_init(void) {
+    const char* v = getenv("CHAT_TRACE_SAMPLE");
+    if (v && atol(v) > 0) sample_every = (unsigned int)atol(v);
+    v = getenv("CHAT_TRACE_FILE");
+    if (v && *v) dump_path = v;
+    pthread_key_create(&ring_key, release_ring);
+}
+
+void trace_recv(void) {
+    if (sample_every) recv_ns = now_ns();
+}
+
+uint32_t trace_sample(void) {
+    current_id = 0;
+    if (!sample_every || ++seen % sample_every != 0) return 0;
+    current_id = __atomic_add_fetch(&next_id, 1, __ATOMIC_RELAXED);
+    if (current_id == 0) current_id = __atomic_add_fetch(&next_id, 1, __ATOMIC_RELAXED);
+    put_event(current_id, TRACE_RECV, recv_ns);
+    put_event(current_id, TRACE_PARSE, now_ns());
+    return current_id;
+}
+
+void trace_point(TracePhase phase) {
+    if (current_id) put_event(current_id, phase, now_ns());
+}
+
+uint32_t trace_current(void) {
+    return current_id;
+}
+
+void trace_record(uint32_t id, TracePhase phase) {
+    if (id) put_event(id, phase, now_ns());
+}
+
+void trace_end(void) {
+    current_id = 0;
+}
+
+const char* trace_file(void) {
+    return dump_path;
+}
+
+static int by_message(const void* a, const void* b) {
+    const Collected* x = a;
+    const Collected* y = b;
+    if (x->e.id != y->e.id) return x->e.id < y->e.id ? -1 : 1;
+    if (x->e.ts_ns != y->e.ts_ns) return x->e.ts_ns < y->e.ts_ns ? -1 : 1;
+    return x->e.phase - y->e.phase;
+}
+
+// Copy the events still valid in every ring
+static Collected* collect(size_t* count) {
+    pthread_mutex_lock(&rings_mutex);
+    int nrings = 0;
+    while (nrings < TRACE_MAX_THREADS && rings[nrings]) nrings++;
+    pthread_mutex_unlock(&rings_mutex);
+
+    Collected* all = malloc((size_t)nrings * TRACE_EVENTS_PER_THREAD * sizeof(Collected) + 1);
+    if (!all) return NULL;
+    size_t n = 0;
+    for (int r = 0; r < nrings; r++) {
+        TraceRing* ring = rings[r];
+        uint64_t end = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t start = end > TRACE_EVENTS_PER_THREAD ? end - TRACE_EVENTS_PER_THREAD : 0;
+        size_t first = n;
+        for (uint64_t i = start; i < end; i++) {
+            all[n].e = ring->ev[i % TRACE_EVENTS_PER_THREAD];
+            all[n].ring = r;
+            n++;
+        }
+        // Slots the writer reached meanwhile may hold newer events
+        uint64_t now = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t safe = now > TRACE_EVENTS_PER_THREAD ? now - TRACE_EVENTS_PER_THREAD : 0;
+        if (safe > start) {
+            size_t drop = safe - start > end - start ? end - start : safe - start;
+            memmove(all + first, all + first + drop, (n - first - drop) * sizeof(Collected));
+            n -= drop;
+        }
+    }
+    *count = n;
+    return all;
+}
+
+long trace_dump(void) {
+    size_t n;
+    Collected* all = collect(&n);
+    if (!all) return -1;
+    qsort(all, n, sizeof(Collected), by_message);
+
+    FILE* f = fopen(dump_path, "w");
+    if (!f) {
+        free(all);
+        return -1;
+    }
+
+    // Per message: a span between each pair of consecutive thread-side
+    // phases, and one per shard from fan-out start to its last byte sent
+    long spans = 0;
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (size_t i = 0; i < n;) {
+        size_t end = i;
+        const Collected* at[TRACE_SENT] = {0};
+        while (end < n && all[end].e.id == all[i].e.id) {
+            if (all[end].e.phase < TRACE_SENT) at[all[end].e.phase] = &all[end];
+            end++;
+        }
+        for (size_t j = i; j < end; j++) {
+            const Collected* cur = &all[j];
+            const Collected* from = cur->e.phase == TRACE_SENT ? at[TRACE_FANOUT_START] :
+                                    cur->e.phase > TRACE_RECV ? at[cur->e.phase - 1] : NULL;
+            if (!from || from->e.ts_ns > cur->e.ts_ns) continue;
+            fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"broadcast\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                       "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"msg\":%u,\"from\":\"%s\",\"to\":\"%s\"}}",
+                    spans ? ",\n" : "", span_name[cur->e.phase], cur->ring,
+                    from->e.ts_ns / 1000.0, (cur->e.ts_ns - from->e.ts_ns) / 1000.0,
+                    cur->e.id, phase_name[from->e.phase], phase_name[cur->e.phase]);
+            spans++;
+        }
+        i = end;
+    }
+    fprintf(f, "\n]}\n");
+    int rc = fclose(f);
+    free(all);
+    return rc == 0 ? spans : -1;
+}
@@ -0,0 +1,54 @@
+// trace.h
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_EVENTS_PER_THREAD 4096   // Ring size; older events are overwritten
+#define TRACE_MAX_THREADS 256          // Rings; a thread that exits frees its ring for the next one
+#define TRACE_DEFAULT_FILE "trace.json"
+
+// Sampled latency tracing of room broadcasts. CHAT_TRACE_SAMPLE=N traces
+// one broadcast in N (0, the default, is off); CHAT_TRACE_FILE names the
+// dump. Each thread writes into its own ring without locks, and /trace
+// dumps the rings as Chrome trace JSON (chrome://tracing or Perfetto):
+// one span per step of each traced message, on the row of the thread
+// that did it.
+
+typedef enum {
+    TRACE_RECV,           // Bytes read from the sender's socket
+    TRACE_PARSE,          // Command recognised
+    TRACE_LOCK,           // clients_mutex acquired for the fan-out
+    TRACE_FANOUT_START,
+    TRACE_FANOUT_END,     // Handed to every writer shard
+    TRACE_SENT            // A shard wrote its last byte of the message
+} TracePhase;
+
+void trace_init(void);
+
+// Called right after recv(); only remembers the time.
+void trace_recv(void);
+
+// Decide whether the command read last is traced. If so, records RECV and
+// PARSE and returns its trace id; otherwise returns 0.
+uint32_t trace_sample(void);
+
+// Record a phase of the message this thread is handling, if it is traced.
+void trace_point(TracePhase phase);
+
+// Id of the message this thread is handling, 0 if untraced.
+uint32_t trace_current(void);
+
+// Record a phase on behalf of another thread's message (the writers).
+void trace_record(uint32_t id, TracePhase phase);
+
+// This thread is done with its message.
+void trace_end(void);
+
+// Write every ring to the dump file. Returns the number of spans written,
+// or -1 if the file could not be written.
+long trace_dump(void);
+
+const char* trace_file(void);
+
+#endif /* TRACE_H */
@@ -0,0 +1,599 @@
+// transfer.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/random.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#include "chatserver.h"
+#include "netio.h"
+#include "crc32c.h"
+#include "filestore.h"
+#include "overload.h"
+#include "transfer.h"
+#include "journal.h"
+
+// An upload is split into fixed-size chunks. Each chunk is checked with
+// CRC-32C and written at its offset in <token>.part; <token>.map holds one
+// byte per chunk (1 = stored) so an interrupted upload resumes with only the
+// missing chunks, even after a server restart. <token>.meta holds the header.
+// The header carries a CRC-32C of the whole file: it is part of what makes
+// a resume match, and the assembled file is checked against it on commit.
+// The SHA-256 the store is keyed by runs along the chunks as they line up
+// from the start; commit only hashes what was still out of order.
+
+#define TOKEN_LEN 16
+#define MAX_CHUNKS (((MAX_FILE_SIZE) + XFER_CHUNK_SIZE - 1) / XFER_CHUNK_SIZE)
+#define SESSION_IDLE_EVICT 600  // Seconds before an idle upload may be evicted
+
+typedef struct {
+    int used;
+    char token[TOKEN_LEN + 1];
+    char sender[MAX_USERNAME];
+    char receiver[MAX_RECEIVER];
+    char filename[256];
+    long size;
+    uint32_t crc;               // Of the whole file, as the sender announced it
+    uint32_t nchunks;
+    uint8_t done[MAX_CHUNKS];
+    uint32_t ndone;
+    int part_fd;
+    int map_fd;
+    int committing;
+    int writers;                // Chunk writes in flight with the lock dropped
+    Sha256Ctx sha;              // Over chunks [0, hashed)
+    uint32_t hashed;
+    int hashing;                // A thread is extending sha
+    time_t last_activity;
+} UploadSession;
+
+static UploadSession sessions[XFER_MAX_SESSIONS];
+static pthread_mutex_t xfer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writers_cond = PTHREAD_COND_INITIALIZER;  // A session's writers reached 0
+static int connections;  // Open transfer connections, under xfer_mutex
+
+static void session_path(const char* token, const char* ext, char* buf, size_t size) {
+    snprintf(buf, size, "%s/%s.%s", XFER_DIR, token, ext);
+}
+
+static uint32_t chunk_len(const UploadSession* s, uint32_t index) {
+    long left = s->size - (long)index * XFER_CHUNK_SIZE;
+    return left < XFER_CHUNK_SIZE ? left : XFER_CHUNK_SIZE;
+}
+
+// Caller holds xfer_mutex
+static void close_session(UploadSession* s, int delete_files) {
+    if (s->part_fd >= 0) close(s->part_fd);
+    if (s->map_fd >= 0) close(s->map_fd);
+    if (delete_files) {
+        const char* exts[] = { "part", "map", "meta" };
+        char path[256];
+        for (int i = 0; i < 3; i++) {
+            session_path(s->token, exts[i], path, sizeof(path));
+            unlink(path);
+        }
+    }
+    memset(s, 0, sizeof(*s));
+}
+
+static UploadSession* find_session(const char* token) {
+    for (int i = 0; i < XFER_MAX_SESSIONS; i++) {
+        if (sessions[i].used && strcmp(sessions[i].token, token) == 0) return &sessions[i];
+    }
+    return NULL;
+}
+
+static int open_session_files(UploadSession* s, int create) {
+    char path[256];
+    int flags = O_RDWR | (create ? O_CREAT | O_TRUNC : 0);
+    session_path(s->token, "part", path, sizeof(path));
+    s->part_fd = open(path, flags, 0644);
+    session_path(s->token, "map", path, sizeof(path));
+    s->map_fd = open(path, flags, 0644);
+    if (s->part_fd < 0 || s->map_fd < 0) return -1;
+    if (create) {
+        return ftruncate(s->part_fd, s->size) == 0 && ftruncate(s->map_fd, s->nchunks) == 0 ? 0 : -1;
+    }
+    return pread(s->map_fd, s->done, s->nchunks, 0) == (ssize_t)s->nchunks ? 0 : -1;
+}
+
+int transfer_init(void) {
+    if (mkdir(XFER_DIR, 0755) < 0 && errno != EEXIST) {
+        perror("transfer mkdir");
+        return -1;
+    }
+
+    DIR* dir = opendir(XFER_DIR);
+    if (!dir) return -1;
+    struct dirent* de;
+    int n = 0;
+    while ((de = readdir(dir)) != NULL && n < XFER_MAX_SESSIONS) {
+        char* ext = strstr(de->d_name, ".meta");
+        if (!ext || ext[5] != '\0' || ext - de->d_name != TOKEN_LEN) continue;
+
+        UploadSession* s = &sessions[n];
+        memcpy(s->token, de->d_name, TOKEN_LEN);
+        char path[256];
+        session_path(s->token, "meta", path, sizeof(path));
+        // Headers from before the file CRC was added don't have 8 hex digits there
+        FILE* f = fopen(path, "r");
+        int crc_start = 0, crc_end = 0;
+        int ok = f && fscanf(f, "%16s %33s %ld %n%8x%n %255s", s->sender, s->receiver, &s->size,
+                             &crc_start, &s->crc, &crc_end, s->filename) == 5 &&
+                 crc_end - crc_start == 8 && s->size > 0 && s->size <= MAX_FILE_SIZE;
+        if (f) fclose(f);
+        s->nchunks = (s->size + XFER_CHUNK_SIZE - 1) / XFER_CHUNK_SIZE;
+        if (!ok || open_session_files(s, 0) < 0) {
+            close_session(s, 1);
+            continue;
+        }
+        for (uint32_t i = 0; i < s->nchunks; i++) {
+            s->ndone += s->done[i] ? 1 : 0;
+        }
+        sha256_init(&s->sha);
+        s->used = 1;
+        s->last_activity = time(NULL);
+        n++;
+    }
+    closedir(dir);
+
+    if (n > 0) {
+        char logbuf[128];
+        snprintf(logbuf, sizeof(logbuf), "[XFER] %d unfinished upload(s) can be resumed", n);
+        log_event(logbuf);
+    }
+    return 0;
+}
+
+static void reply(int fd, const char* msg) {
+    send_all(fd, msg, strlen(msg));
+}
+
+// The user behind the connection's session key, looked up per command so
+// the key stops working when its login ends
+static int current_user(int fd, const char* key, char* user) {
+    if (session_user(key, user) < 0) {
+        reply(fd, "[ERROR] Not logged in.\n");
+        return -1;
+    }
+    return 0;
+}
+
+// The sender is whoever the connection's session key belongs to
+static void cmd_upload(int fd, const char* key, const char* args) {
+    char sender[MAX_USERNAME], receiver[MAX_RECEIVER], filename[256];
+    long size;
+    unsigned int crc;
+    if (sscanf(args, "%33s %255s %ld %x", receiver, filename, &size, &crc) != 4) {
+        reply(fd, "[ERROR] Usage: /upload <receiver> <name> <size> <crc32c hex>\n");
+        return;
+    }
+    if (size <= 0 || size > MAX_FILE_SIZE) {
+        reply(fd, "[ERROR] File too large (max 3MB).\n");
+        return;
+    }
+    if (current_user(fd, key, sender) < 0) return;
+    if (!overload_admit(LOAD_UPLOAD)) {
+        reply(fd, "[ERROR] Server busy, try the upload later.\n");
+        return;
+    }
+    if (!valid_receiver(sender, receiver)) {
+        reply(fd, "[ERROR] Invalid receiver (a user, or #room you are in).\n");
+        return;
+    }
+
+    pthread_mutex_lock(&xfer_mutex);
+
+    // Same sender, receiver, name, size and content: resume the earlier attempt
+    UploadSession* s = NULL;
+    for (int i = 0; i < XFER_MAX_SESSIONS && !s; i++) {
+        UploadSession* c = &sessions[i];
+        if (c->used && !c->committing && c->size == size && c->crc == crc && strcmp(c->sender, sender) == 0 &&
+            strcmp(c->receiver, receiver) == 0 && strcmp(c->filename, filename) == 0) {
+            s = c;
+        }
+    }
+
+    if (!s) {
+        time_t now = time(NULL);
+        UploadSession* idle = NULL;
+        for (int i = 0; i < XFER_MAX_SESSIONS && !s; i++) {
+            if (!sessions[i].used) s = &sessions[i];
+            else if (!sessions[i].committing && sessions[i].writers == 0 && (!idle || sessions[i].last_activity < idle->last_activity)) {
+                idle = &sessions[i];
+            }
+        }
+        if (!s && idle && now - idle->last_activity > SESSION_IDLE_EVICT) {
+            close_session(idle, 1);
+            s = idle;
+        }
+        if (!s) {
+            pthread_mutex_unlock(&xfer_mutex);
+            reply(fd, "[ERROR] Too many uploads in progress.\n");
+            return;
+        }
+
+        uint8_t rnd[TOKEN_LEN / 2];
+        if (getrandom(rnd, sizeof(rnd), 0) != sizeof(rnd)) {
+            pthread_mutex_unlock(&xfer_mutex);
+            reply(fd, "[ERROR] Cannot start upload.\n");
+            return;
+        }
+        for (int i = 0; i < TOKEN_LEN / 2; i++) {
+            sprintf(s->token + 2 * i, "%02x", rnd[i]);
+        }
+        strcpy(s->sender, sender);
+        strcpy(s->receiver, receiver);
+        strcpy(s->filename, filename);
+        s->size = size;
+        s->crc = crc;
+        s->nchunks = (size + XFER_CHUNK_SIZE - 1) / XFER_CHUNK_SIZE;
+
+        char path[256];
+        session_path(s->token, "meta", path, sizeof(path));
+        FILE* meta = fopen(path, "w");
+        int ok = meta && fprintf(meta, "%s %s %ld %08x %s\n", sender, receiver, size, crc, filename) > 0;
+        if (meta) fclose(meta);
+        if (!ok || open_session_files(s, 1) < 0) {
+            close_session(s, 1);
+            pthread_mutex_unlock(&xfer_mutex);
+            reply(fd, "[ERROR] Cannot start upload.\n");
+            return;
+        }
+        sha256_init(&s->sha);
+        s->used = 1;
+    }
+    s->last_activity = time(NULL);
+
+    char msg[128 + MAX_CHUNKS];
+    int len = snprintf(msg, sizeof(msg), "[UPLOAD] %s %d %u ", s->token, XFER_CHUNK_SIZE, s->nchunks);
+    for (uint32_t i = 0; i < s->nchunks; i++) {
+        msg[len++] = s->done[i] ? '1' : '0';
+    }
+    msg[len++] = '\n';
+    msg[len] = '\0';
+    pthread_mutex_unlock(&xfer_mutex);
+    reply(fd, msg);
+}
+
+// Run the session's hash over the stored chunks that now follow on from
+// it; buf holds chunk in_buf. One thread at a time does this, holding a
+// writer reference so commit waits for it. Caller holds xfer_mutex.
+static void hash_ready_chunks(UploadSession* s, char* buf, uint32_t in_buf) {
+    if (s->hashing) return;
+    s->hashing = 1;
+    s->writers++;
+    while (s->hashed < s->nchunks && s->done[s->hashed]) {
+        uint32_t index = s->hashed, len = chunk_len(s, index);
+        pthread_mutex_unlock(&xfer_mutex);
+        int ok = index == in_buf || pread(s->part_fd, buf, len, (off_t)index * XFER_CHUNK_SIZE) == (ssize_t)len;
+        if (ok) sha256_update(&s->sha, buf, len);
+        in_buf = index;
+        pthread_mutex_lock(&xfer_mutex);
+        if (!ok) break;
+        s->hashed++;
+    }
+    s->hashing = 0;
+    if (--s->writers == 0) pthread_cond_broadcast(&writers_cond);
+}
+
+// Only the session's sender may add chunks to it. Returns -1 when the
+// stream can't be trusted any more (bad framing)
+static int cmd_chunk(int fd, FILE* in, const char* key, const char* args, char* buf) {
+    char token[TOKEN_LEN + 1];
+    unsigned int index, len, crc;
+    if (sscanf(args, "%16s %u %u %x", token, &index, &len, &crc) != 4 || len > XFER_CHUNK_SIZE) {
+        reply(fd, "[ERROR] Bad chunk header.\n");
+        return -1;
+    }
+    // Consume the payload first so the stream stays in sync whatever happens
+    if (fread(buf, 1, len, in) != len) return -1;
+
+    char msg[96], user[MAX_USERNAME];
+    const char* reason = NULL;
+    int logged_in = session_user(key, user) == 0;
+    pthread_mutex_lock(&xfer_mutex);
+    UploadSession* s = find_session(token);
+    if (!logged_in) reason = "not logged in";
+    else if (!s || strcmp(s->sender, user) != 0) reason = "unknown upload";
+    else if (s->committing) reason = "upload is being committed";
+    else if (index >= s->nchunks || len != chunk_len(s, index)) reason = "bad chunk";
+    else if (crc32c(0, buf, len) != crc) reason = "checksum mismatch";
+    else {
+        // The session and its descriptors stay put while writers is up:
+        // eviction skips it and commit waits for it to drop
+        s->last_activity = time(NULL);
+        s->writers++;
+        pthread_mutex_unlock(&xfer_mutex);
+
+        // Data first, then the map byte, so a stored flag always means stored data
+        uint8_t one = 1;
+        if (pwrite(s->part_fd, buf, len, (off_t)index * XFER_CHUNK_SIZE) != (ssize_t)len ||
+            pwrite(s->map_fd, &one, 1, index) != 1) {
+            reason = "write failed";
+        }
+
+        pthread_mutex_lock(&xfer_mutex);
+        if (!reason && !s->done[index]) {
+            s->done[index] = 1;
+            s->ndone++;
+            hash_ready_chunks(s, buf, index);
+        }
+        if (--s->writers == 0) pthread_cond_broadcast(&writers_cond);
+    }
+    pthread_mutex_unlock(&xfer_mutex);
+
+    if (reason) snprintf(msg, sizeof(msg), "[NAK] %u %s\n", index, reason);
+    else snprintf(msg, sizeof(msg), "[ACK] %u\n", index);
+    reply(fd, msg);
+    return 0;
+}
+
+static void cmd_commit(int fd, const char* key, const char* args) {
+    char token[TOKEN_LEN + 1], user[MAX_USERNAME];
+    if (sscanf(args, "%16s", token) != 1) {
+        reply(fd, "[ERROR] Usage: /commit <token>\n");
+        return;
+    }
+    if (current_user(fd, key, user) < 0) return;
+
+    pthread_mutex_lock(&xfer_mutex);
+    UploadSession* s = find_session(token);
+    if (!s || s->committing || strcmp(s->sender, user) != 0) {
+        pthread_mutex_unlock(&xfer_mutex);
+        reply(fd, "[ERROR] Unknown upload.\n");
+        return;
+    }
+
+    // No new chunk starts from here on; let the ones in flight land
+    s->committing = 1;
+    while (s->writers > 0) {
+        pthread_cond_wait(&writers_cond, &xfer_mutex);
+    }
+    if (s->ndone < s->nchunks) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "[ERROR] %u chunk(s) missing.\n", s->nchunks - s->ndone);
+        s->committing = 0;
+        pthread_mutex_unlock(&xfer_mutex);
+        reply(fd, msg);
+        return;
+    }
+    pthread_mutex_unlock(&xfer_mutex);
+
+    // Hand the assembled file to the regular upload queue. Chunks from
+    // different attempts only make up the announced file if it checks out.
+    FileTransfer* ft = file_transfer_alloc();
+    char* data = malloc(s->size);
+    int ok = ft && data && pread(s->part_fd, data, s->size, 0) == s->size;
+    int corrupt = ok && crc32c(0, data, s->size) != s->crc;
+    ok = ok && !corrupt;
+    if (ok) {
+        strcpy(ft->sender, s->sender);
+        strcpy(ft->receiver, s->receiver);
+        strcpy(ft->filename, s->filename);
+        ft->filesize = s->size;
+        ft->filedata = data;
+        long hashed = s->hashed < s->nchunks ? (long)s->hashed * XFER_CHUNK_SIZE : s->size;
+        ft->sha = s->sha;
+        sha256_update(&ft->sha, data + hashed, s->size - hashed);
+        ft->enqueued_time = time(NULL);
+        ok = enqueue_upload(ft) == 0;
+    }
+
+    pthread_mutex_lock(&xfer_mutex);
+    if (ok || corrupt) {
+        close_session(s, 1);
+    } else {
+        s->committing = 0;  // Chunks are kept, the client may commit again
+    }
+    if (!ok) {
+        free(data);
+        file_transfer_free(ft);
+    }
+    pthread_mutex_unlock(&xfer_mutex);
+    if (corrupt) reply(fd, "[ERROR] File checksum mismatch, upload discarded.\n");
+    else reply(fd, ok ? "[DONE]\n" : "[ERROR] Upload queue full, try /commit again.\n");
+}
+
+// Only the receiver of a file, while logged in, may fetch it; a room
+// share goes to whoever is in the room at the time
+static int authorize_download(int fd, const char* key, long id, char* user, StoredFile* rec) {
+    if (current_user(fd, key, user) < 0) return -1;
+    if (filestore_lookup(id, rec) < 0 ||
+        (rec->receiver[0] == '#' ? !client_in_room(user, rec->receiver + 1) : strcmp(rec->receiver, user) != 0)) {
+        reply(fd, "[ERROR] No such file.\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void cmd_fileinfo(int fd, const char* key, const char* args) {
+    char user[MAX_USERNAME];
+    long id;
+    StoredFile rec;
+    if (sscanf(args, "%ld", &id) != 1) {
+        reply(fd, "[ERROR] Usage: /fileinfo <id>\n");
+        return;
+    }
+    if (authorize_download(fd, key, id, user, &rec) < 0) return;
+
+    char msg[160];
+    snprintf(msg, sizeof(msg), "[FILEINFO] %ld %ld %s %s\n", rec.id, rec.size, rec.sender, rec.filename);
+    reply(fd, msg);
+}
+
+// CRC of a stored file's first length bytes, so a client can check a
+// partial local copy before resuming it
+static void cmd_filecrc(int fd, const char* key, const char* args, char* buf) {
+    char user[MAX_USERNAME];
+    long id, length;
+    StoredFile rec;
+    if (sscanf(args, "%ld %ld", &id, &length) != 2) {
+        reply(fd, "[ERROR] Usage: /filecrc <id> <length>\n");
+        return;
+    }
+    if (authorize_download(fd, key, id, user, &rec) < 0) return;
+    if (length < 0 || length > rec.size) {
+        reply(fd, "[ERROR] Bad range.\n");
+        return;
+    }
+
+    int blob = filestore_open_blob(rec.digest);
+    if (blob < 0) {
+        reply(fd, "[ERROR] File is missing on server.\n");
+        return;
+    }
+    uint32_t crc = 0;
+    off_t pos = 0;
+    while (pos < length) {
+        size_t want = length - pos < XFER_CHUNK_SIZE ? (size_t)(length - pos) : XFER_CHUNK_SIZE;
+        ssize_t n = pread(blob, buf, want, pos);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        crc = crc32c(crc, buf, n);
+        pos += n;
+    }
+    filestore_release_blob(rec.digest);
+    if (pos < length) {
+        reply(fd, "[ERROR] File is missing on server.\n");
+        return;
+    }
+
+    char msg[96];
+    snprintf(msg, sizeof(msg), "[FILECRC] %ld %ld %08x\n", rec.id, length, crc);
+    reply(fd, msg);
+}
+
+// Stream [offset, offset + length) of a stored file with sendfile(), so the
+// data goes from the page cache to the socket without passing through here.
+// Returns -1 if the connection broke mid-body.
+static int cmd_getfile(int fd, const char* key, const char* args) {
+    char user[MAX_USERNAME];
+    long id, offset = 0, length = -1;
+    StoredFile rec;
+    if (sscanf(args, "%ld %ld %ld", &id, &offset, &length) < 1) {
+        reply(fd, "[ERROR] Usage: /getfile <id> [offset] [length]\n");
+        return 0;
+    }
+    if (authorize_download(fd, key, id, user, &rec) < 0) return 0;
+    if (offset < 0 || offset > rec.size) {
+        reply(fd, "[ERROR] Bad range.\n");
+        return 0;
+    }
+    if (length < 0 || offset + length > rec.size) length = rec.size - offset;
+
+    int blob = filestore_open_blob(rec.digest);
+    if (blob < 0) {
+        reply(fd, "[ERROR] File is missing on server.\n");
+        return 0;
+    }
+
+    char header[160];
+    snprintf(header, sizeof(header), "[FILE] %ld %ld %ld %ld %s\n", rec.id, rec.size, offset, length, rec.filename);
+    reply(fd, header);
+
+    off_t pos = offset;
+    long left = length;
+    while (left > 0) {
+        ssize_t n = sendfile(fd, blob, &pos, left);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        left -= n;
+    }
+    filestore_release_blob(rec.digest);
+
+    char logbuf[160];
+    snprintf(logbuf, sizeof(logbuf), "[DOWNLOAD] %s fetched #%ld bytes %ld-%ld%s",
+             user, rec.id, offset, offset + length, left > 0 ? " (aborted)" : "");
+    log_event(logbuf);
+    journal_event(JEV_DOWNLOAD, user, NULL, length - left);
+    return left > 0 ? -1 : 0;
+}
+
+static void release_connection(void) {
+    pthread_mutex_lock(&xfer_mutex);
+    connections--;
+    pthread_mutex_unlock(&xfer_mutex);
+}
+
+static void serve_transfer(int fd) {
+    FILE* in = fdopen(fd, "r");
+    char* buf = malloc(XFER_CHUNK_SIZE);
+    if (!in || !buf) {
+        if (in) fclose(in);
+        else close(fd);
+        free(buf);
+        return;
+    }
+
+    reply(fd, "[XFER] ready\n");
+
+    // The session key from the chat login comes first; nothing else is
+    // served without it
+    char line[512], key[SESSION_KEY_LEN + 1], user[MAX_USERNAME];
+    if (!fgets(line, sizeof(line), in) || sscanf(line, "/auth %32s", key) != 1 ||
+        session_user(key, user) < 0) {
+        reply(fd, "[ERROR] Bad session key.\n");
+        free(buf);
+        fclose(in);
+        return;
+    }
+    char msg[32 + MAX_USERNAME];
+    snprintf(msg, sizeof(msg), "[AUTH] %s\n", user);
+    reply(fd, msg);
+
+    while (fgets(line, sizeof(line), in)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (strncmp(line, "/upload ", 8) == 0) {
+            cmd_upload(fd, key, line + 8);
+        } else if (strncmp(line, "/chunk ", 7) == 0) {
+            if (cmd_chunk(fd, in, key, line + 7, buf) < 0) break;
+        } else if (strncmp(line, "/commit ", 8) == 0) {
+            cmd_commit(fd, key, line + 8);
+        } else if (strncmp(line, "/fileinfo ", 10) == 0) {
+            cmd_fileinfo(fd, key, line + 10);
+        } else if (strncmp(line, "/filecrc ", 9) == 0) {
+            cmd_filecrc(fd, key, line + 9, buf);
+        } else if (strncmp(line, "/getfile ", 9) == 0) {
+            if (cmd_getfile(fd, key, line + 9) < 0) break;
+        } else if (line[0] != '\0') {
+            reply(fd, "[ERROR] Unknown transfer command.\n");
+        }
+    }
+
+    free(buf);
+    fclose(in);
+}
+
+static void* handle_transfer(void* arg) {
+    serve_transfer((int)(intptr_t)arg);
+    release_connection();
+    return NULL;
+}
+
+void transfer_start(int fd) {
+    pthread_mutex_lock(&xfer_mutex);
+    int admitted = connections < XFER_MAX_CONNECTIONS;
+    if (admitted) connections++;
+    pthread_mutex_unlock(&xfer_mutex);
+    if (!admitted) {
+        reply(fd, "[ERROR] Too many transfer connections.\n");
+        close(fd);
+        return;
+    }
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, handle_transfer, (void*)(intptr_t)fd) != 0) {
+        release_connection();
+        close(fd);
+        return;
+    }
+    pthread_detach(tid);
+}
@@ -0,0 +1,35 @@
+// transfer.h
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include "chatserver.h"
+
+#define XFER_DIR "store/partial"        // Partial uploads survive restarts here
+#define XFER_CHUNK_SIZE (64 * 1024)
+#define XFER_MAX_SESSIONS 64
+#define XFER_MAX_CONNECTIONS (MAX_CLIENTS * 4)  // Open transfer connections, a thread each
+
+// Load unfinished uploads from XFER_DIR. Returns 0 or -1.
+int transfer_init(void);
+
+// Serve a transfer connection on a thread of its own. Past
+// XFER_MAX_CONNECTIONS the connection is refused and closed.
+// The first command proves the chat login the connection works for:
+//   /auth <session key from the login's [SESSION] line>
+//       -> [AUTH] <user> | [ERROR] ... and the connection closes
+//   /upload <receiver> <name> <size> <crc32c hex of the whole file>
+//       -> [UPLOAD] <token> <chunk_size> <nchunks> <bitmap of received chunks>
+//   /chunk <token> <index> <len> <crc32c hex>\n<len bytes>
+//       -> [ACK] <index> | [NAK] <index> <reason>
+//   /commit <token>
+//       -> [DONE] | [ERROR] ...
+//   /fileinfo <id>
+//       -> [FILEINFO] <id> <size> <sender> <name>
+//   /filecrc <id> <length>
+//       -> [FILECRC] <id> <length> <crc32c hex of the first length bytes>
+//   /getfile <id> [offset] [length]
+//       -> [FILE] <id> <size> <offset> <length> <name>\n<length bytes>
+// Any number of connections may send chunks of the same upload in parallel.
+void transfer_start(int fd);
+
+#endif /* TRANSFER_H */
@@ -4,7 +4,7 @@
 #include <stdio.h>
 
 int buffer_init(buffer_t *buffer, int capacity) {
-    buffer->items = (buffer_item_t *)malloc(capacity * sizeof(buffer_item_t));
+    buffer->items = (buffer_item_t *)calloc(capacity, sizeof(buffer_item_t));
     if (!buffer->items) {
         perror("Failed to allocate buffer memory");
         return -1;
@@ -59,7 +59,8 @@ void buffer_destroy(buffer_t *buffer) {
     pthread_cond_destroy(&buffer->not_empty);
 }
 
-int buffer_put(buffer_t *buffer, const char *line, bool eof_marker) {
+// Add a ready-made item to the buffer, waiting for space
+static void buffer_push(buffer_t *buffer, buffer_item_t item) {
     pthread_mutex_lock(&buffer->mutex);
 
     // Wait until there's space in the buffer
@@ -67,30 +68,45 @@ int buffer_put(buffer_t *buffer, const char *line, bool eof_marker) {
         pthread_cond_wait(&buffer->not_full, &buffer->mutex);
     }
 
+    // Add item to the buffer
+    buffer->items[buffer->in] = item;
+    buffer->in = (buffer->in + 1) % buffer->capacity;
+    buffer->count++;
+
+    // Signal that the buffer is not empty
+    pthread_cond_signal(&buffer->not_empty);
+    pthread_mutex_unlock(&buffer->mutex);
+}
+
+int buffer_put(buffer_t *buffer, const char *line, bool eof_marker) {
     // Create a new buffer item
     buffer_item_t item;
     item.eof_marker = eof_marker;
+    item.offset = 0;
+    item.length = 0;
 
     if (!eof_marker && line != NULL) {
         // Allocate memory for the line and copy it
         item.line = strdup(line);
         if (item.line == NULL) {
-            pthread_mutex_unlock(&buffer->mutex);
             return -1;
         }
     } else {
         item.line = NULL;  // EOF marker doesn't need a line
     }
 
-    // Add item to the buffer
-    buffer->items[buffer->in] = item;
-    buffer->in = (buffer->in + 1) % buffer->capacity;
-    buffer->count++;
+    buffer_push(buffer, item);
+    return 0;
+}
 
-    // Signal that the buffer is not empty
-    pthread_cond_signal(&buffer->not_empty);
-    pthread_mutex_unlock(&buffer->mutex);
+int buffer_put_view(buffer_t *buffer, size_t offset, size_t length) {
+    buffer_item_t item;
+    item.line = NULL;
+    item.offset = offset;
+    item.length = length;
+    item.eof_marker = false;
 
+    buffer_push(buffer, item);
     return 0;
 }
 
@@ -104,6 +120,7 @@ buffer_item_t buffer_get(buffer_t *buffer) {
 
     // Get the item from the buffer
     buffer_item_t item = buffer->items[buffer->out];
+    buffer->items[buffer->out].line = NULL;  // The consumer owns the copy now
     buffer->out = (buffer->out + 1) % buffer->capacity;
     buffer->count--;
 
@@ -3,13 +3,47 @@
 
 #include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 // Structure to hold a line from the log file
 typedef struct {
-    char *line;     // The content of the line
+    char *line;     // The content of the line (NULL for a view)
+    size_t offset;  // View into the mapped log file: where the line starts
+    size_t length;  // and how long it is, newline included
     bool eof_marker; // Flag to indicate end of file
 } buffer_item_t;
 
+#ifdef BUFFER_LOCKFREE
+
+#define BUFFER_CACHE_LINE 64
+
+// One ring slot. seq says whose turn the slot is: equal to a position, it
+// is free for the producer writing that position; one past it, it holds
+// that position's item for a consumer.
+typedef struct {
+    unsigned long seq;
+    buffer_item_t item;
+} buffer_slot_t;
+
+// Lock-free single-producer/multi-consumer ring (make LOCKFREE=1).
+// Consumers claim positions by compare-and-swap on head; the producer
+// alone advances tail. Threads only sleep, on a futex, when the ring is
+// empty or full. The EOF marker doesn't take a slot: it closes the ring,
+// and consumers get it once the items before it are gone.
+typedef struct {
+    buffer_slot_t *slots;    // Array of ring slots
+    int capacity;            // Maximum buffer size
+    _Alignas(BUFFER_CACHE_LINE) unsigned long head;     // Next position to consume
+    _Alignas(BUFFER_CACHE_LINE) unsigned long tail;     // Next position to fill (producer)
+    _Alignas(BUFFER_CACHE_LINE) unsigned int puts;      // Futex: bumped when an item lands
+    int empty_waiters;                                  // Consumers asleep on puts
+    _Alignas(BUFFER_CACHE_LINE) unsigned int gets;      // Futex: bumped when a slot frees up
+    int full_waiters;                                   // Producer asleep on gets
+    int closed;                                         // EOF marker seen
+} buffer_t;
+
+#else
+
 // Circular buffer structure
 typedef struct {
     buffer_item_t *items;    // Array of buffer items
@@ -22,6 +56,8 @@ typedef struct {
     pthread_cond_t not_empty; // Condition variable for not empty buffer
 } buffer_t;
 
+#endif /* BUFFER_LOCKFREE */
+
 // Initialize the buffer with given capacity
 int buffer_init(buffer_t *buffer, int capacity);
 
@@ -31,6 +67,9 @@ void buffer_destroy(buffer_t *buffer);
 // Add an item to the buffer (producer)
 int buffer_put(buffer_t *buffer, const char *line, bool eof_marker);
 
+// Add a view of a line in the mapped log file (producer); nothing is copied
+int buffer_put_view(buffer_t *buffer, size_t offset, size_t length);
+
 // Get an item from the buffer (consumer)
 buffer_item_t buffer_get(buffer_t *buffer);
 
@@ -0,0 +1,211 @@
+#include "buffer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// Spins before going to sleep on an empty or full ring
+#define BUFFER_SPINS 128
+
+static void futex_wait(unsigned int *word, unsigned int expected) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(unsigned int *word, int count) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+// Sleep on a futex word unless ready() turns true first. The waiter count
+// goes up before ready() looks, and the waker publishes its change before
+// it reads the count, with a full fence on each side, so either the waker
+// sees the sleeper or the sleeper sees the change and doesn't sleep. The
+// word is read before ready() and bumped by unpark(), so a wake between
+// the check and futex_wait() isn't lost either.
+static void park(unsigned int *word, int *waiters, bool (*ready)(buffer_t *), buffer_t *buffer) {
+    __atomic_fetch_add(waiters, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    unsigned int seen = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+    if (!ready(buffer)) {
+        futex_wait(word, seen);
+    }
+    __atomic_fetch_sub(waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+static void unpark(unsigned int *word, int *waiters, int count) {
+    __atomic_fetch_add(word, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiters, __ATOMIC_SEQ_CST) > 0) {
+        futex_wake(word, count);
+    }
+}
+
+// An item is waiting at head, or the ring is closed
+static bool can_get(buffer_t *buffer) {
+    unsigned long pos = __atomic_load_n(&buffer->head, __ATOMIC_SEQ_CST);
+    buffer_slot_t *slot = &buffer->slots[pos % buffer->capacity];
+    return __atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) == pos + 1 ||
+           __atomic_load_n(&buffer->closed, __ATOMIC_ACQUIRE);
+}
+
+// The slot at tail has been handed back by its consumer
+static bool can_put(buffer_t *buffer) {
+    unsigned long pos = buffer->tail;
+    buffer_slot_t *slot = &buffer->slots[pos % buffer->capacity];
+    return __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == pos;
+}
+
+int buffer_init(buffer_t *buffer, int capacity) {
+    // With one slot, "full for position p" and "free for p + 1" would be
+    // the same seq, so the ring holds at least two
+    if (capacity < 2) {
+        capacity = 2;
+    }
+
+    buffer->slots = (buffer_slot_t *)calloc(capacity, sizeof(buffer_slot_t));
+    if (!buffer->slots) {
+        perror("Failed to allocate buffer memory");
+        return -1;
+    }
+
+    buffer->capacity = capacity;
+    buffer->head = 0;
+    buffer->tail = 0;
+    buffer->puts = 0;
+    buffer->gets = 0;
+    buffer->empty_waiters = 0;
+    buffer->full_waiters = 0;
+    buffer->closed = 0;
+
+    // Slot i is free for position i
+    for (int i = 0; i < capacity; i++) {
+        buffer->slots[i].seq = i;
+    }
+
+    return 0;
+}
+
+void buffer_destroy(buffer_t *buffer) {
+    // Free the lines nobody took
+    for (int i = 0; i < buffer->capacity; i++) {
+        free(buffer->slots[i].item.line);
+    }
+
+    free(buffer->slots);
+    buffer->slots = NULL;
+}
+
+// Single producer: nobody else moves tail, so no compare-and-swap
+static void buffer_push(buffer_t *buffer, buffer_item_t item) {
+    unsigned long pos = buffer->tail;
+    buffer_slot_t *slot = &buffer->slots[pos % buffer->capacity];
+
+    // Wait until the consumer of the previous lap has freed the slot
+    for (int spin = 0; !can_put(buffer); spin++) {
+        if (spin >= BUFFER_SPINS) {
+            park(&buffer->gets, &buffer->full_waiters, can_put, buffer);
+        }
+    }
+
+    slot->item = item;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&buffer->tail, pos + 1, __ATOMIC_RELAXED);
+
+    // Consumers only sleep on an empty ring, so only the item that ends
+    // the emptiness wakes one, and it passes the wake on (see buffer_get).
+    // Publishing then reading head here, against claiming then reading the
+    // next seq there, means one side always sees the other.
+    if (__atomic_load_n(&buffer->head, __ATOMIC_SEQ_CST) == pos) {
+        unpark(&buffer->puts, &buffer->empty_waiters, 1);
+    }
+}
+
+int buffer_put(buffer_t *buffer, const char *line, bool eof_marker) {
+    // Close the ring; the workers putting the marker back just close it again
+    if (eof_marker) {
+        __atomic_store_n(&buffer->closed, 1, __ATOMIC_RELEASE);
+        unpark(&buffer->puts, &buffer->empty_waiters, INT_MAX);
+        return 0;
+    }
+
+    buffer_item_t item;
+    item.eof_marker = false;
+    item.offset = 0;
+    item.length = 0;
+    item.line = NULL;
+
+    if (line != NULL) {
+        // Allocate memory for the line and copy it
+        item.line = strdup(line);
+        if (item.line == NULL) {
+            return -1;
+        }
+    }
+
+    buffer_push(buffer, item);
+    return 0;
+}
+
+int buffer_put_view(buffer_t *buffer, size_t offset, size_t length) {
+    buffer_item_t item;
+    item.line = NULL;
+    item.offset = offset;
+    item.length = length;
+    item.eof_marker = false;
+
+    buffer_push(buffer, item);
+    return 0;
+}
+
+buffer_item_t buffer_get(buffer_t *buffer) {
+    int spin = 0;
+    unsigned long pos = __atomic_load_n(&buffer->head, __ATOMIC_RELAXED);
+
+    while (1) {
+        buffer_slot_t *slot = &buffer->slots[pos % buffer->capacity];
+        unsigned long seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        long diff = (long)(seq - (pos + 1));
+
+        if (diff == 0) {
+            // Claim the position; on failure pos holds the new head
+            if (__atomic_compare_exchange_n(&buffer->head, &pos, pos + 1, true,
+                                            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                buffer_item_t item = slot->item;
+                slot->item.line = NULL;  // The consumer owns the copy now
+
+                // Hand the slot to the producer's next lap. The producer
+                // is rarely asleep, so only touch the futex word if it is.
+                __atomic_store_n(&slot->seq, pos + buffer->capacity, __ATOMIC_RELEASE);
+                __atomic_thread_fence(__ATOMIC_SEQ_CST);
+                if (__atomic_load_n(&buffer->full_waiters, __ATOMIC_RELAXED) > 0) {
+                    unpark(&buffer->gets, &buffer->full_waiters, 1);
+                }
+
+                // More items behind this one: wake the next sleeper for them
+                if (can_get(buffer)) {
+                    unpark(&buffer->puts, &buffer->empty_waiters, 1);
+                }
+                return item;
+            }
+        } else if (diff < 0) {
+            // Empty. Items are published before the ring closes, so one
+            // more look after seeing it closed can't miss any.
+            if (__atomic_load_n(&buffer->closed, __ATOMIC_ACQUIRE)) {
+                seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+                if (seq != pos + 1) {
+                    buffer_item_t eof;
+                    memset(&eof, 0, sizeof(eof));
+                    eof.eof_marker = true;
+                    return eof;
+                }
+            } else if (++spin >= BUFFER_SPINS) {
+                park(&buffer->puts, &buffer->empty_waiters, can_get, buffer);
+            }
+            pos = __atomic_load_n(&buffer->head, __ATOMIC_RELAXED);
+        } else {
+            // Another consumer took it; catch up
+            pos = __atomic_load_n(&buffer->head, __ATOMIC_RELAXED);
+        }
+    }
+}
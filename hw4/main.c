@@ -9,12 +9,30 @@
 int main(int argc, char *argv[]) {
     int buffer_size, num_workers;
     char *log_file, *search_term;
+    bool use_mmap;
+    size_t chunk_size;
     
     // Parse command line arguments
-    if (parse_args(argc, argv, &buffer_size, &num_workers, &log_file, &search_term) != 0) {
+    if (parse_args(argc, argv, &buffer_size, &num_workers, &log_file, &search_term,
+                   &use_mmap, &chunk_size) != 0) {
         print_usage(argv[0]);
         return EXIT_FAILURE;
     }
+
+    // In mmap mode the file is mapped up front; workers read lines in place
+    const char *map = NULL;
+    size_t map_size = 0;
+    if (use_mmap && map_log_file(log_file, &map, &map_size) != 0) {
+        perror("Error mapping log file");
+        return EXIT_FAILURE;
+    }
+
+    // In chunk mode workers take their lines straight from the mapping
+    chunk_queue_t chunks;
+    chunks.map = map;
+    chunks.size = map_size;
+    chunks.chunk_size = chunk_size;
+    chunks.cursor = 0;
     
     // Set up signal handler for SIGINT
     setup_signal_handler();
@@ -23,6 +41,7 @@ int main(int argc, char *argv[]) {
     buffer_t buffer;
     if (buffer_init(&buffer, buffer_size) != 0) {
         fprintf(stderr, "Failed to initialize buffer\n");
+        unmap_log_file(map, map_size);
         return EXIT_FAILURE;
     }
     
@@ -31,6 +50,7 @@ int main(int argc, char *argv[]) {
     if (pthread_barrier_init(&barrier, NULL, num_workers) != 0) {
         perror("Failed to initialize barrier");
         buffer_destroy(&buffer);
+        unmap_log_file(map, map_size);
         return EXIT_FAILURE;
     }
     
@@ -40,6 +60,7 @@ int main(int argc, char *argv[]) {
         perror("Failed to allocate worker data");
         pthread_barrier_destroy(&barrier);
         buffer_destroy(&buffer);
+        unmap_log_file(map, map_size);
         return EXIT_FAILURE;
     }
     
@@ -48,6 +69,8 @@ int main(int argc, char *argv[]) {
         worker_data[i].thread_id = i;
         worker_data[i].search_term = search_term;
         worker_data[i].buffer = &buffer;
+        worker_data[i].map = map;
+        worker_data[i].chunks = chunk_size > 0 ? &chunks : NULL;
         worker_data[i].barrier = &barrier;
         worker_data[i].match_count = 0;
     }
@@ -57,6 +80,9 @@ int main(int argc, char *argv[]) {
     manager_data.filename = log_file;
     manager_data.buffer = &buffer;
     manager_data.num_workers = num_workers;
+    manager_data.map = map;
+    manager_data.map_size = map_size;
+    manager_data.chunked = chunk_size > 0;
     
     // Create worker threads
     pthread_t *worker_threads = malloc(num_workers * sizeof(pthread_t));
@@ -65,6 +91,7 @@ int main(int argc, char *argv[]) {
         free(worker_data);
         pthread_barrier_destroy(&barrier);
         buffer_destroy(&buffer);
+        unmap_log_file(map, map_size);
         return EXIT_FAILURE;
     }
     
@@ -81,6 +108,7 @@ int main(int argc, char *argv[]) {
             free(worker_data);
             pthread_barrier_destroy(&barrier);
             buffer_destroy(&buffer);
+            unmap_log_file(map, map_size);
             return EXIT_FAILURE;
         }
     }
@@ -98,6 +126,7 @@ int main(int argc, char *argv[]) {
         free(worker_data);
         pthread_barrier_destroy(&barrier);
         buffer_destroy(&buffer);
+        unmap_log_file(map, map_size);
         return EXIT_FAILURE;
     }
     
@@ -121,6 +150,7 @@ int main(int argc, char *argv[]) {
     free(worker_data);
     pthread_barrier_destroy(&barrier);
     buffer_destroy(&buffer);
+    unmap_log_file(map, map_size);
     
     return EXIT_SUCCESS;
 }
\ No newline at end of file
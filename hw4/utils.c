@@ -1,9 +1,13 @@
+#define _GNU_SOURCE  // memmem
 #include "utils.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 // Global flag for handling SIGINT
 volatile sig_atomic_t keep_running = 1;
@@ -24,7 +28,31 @@ void setup_signal_handler(void) {
 }
 
 int parse_args(int argc, char *argv[], int *buffer_size, int *num_workers, 
-               char **log_file, char **search_term) {
+               char **log_file, char **search_term, bool *use_mmap, size_t *chunk_size) {
+    // Options come first; "+" stops at the first positional argument so a
+    // search term starting with '-' is left alone
+    int opt;
+    *use_mmap = false;
+    *chunk_size = 0;
+    while ((opt = getopt(argc, argv, "+mc:")) != -1) {
+        if (opt == 'm') {
+            *use_mmap = true;
+        } else if (opt == 'c') {
+            long kb = atol(optarg);
+            if (kb <= 0) {
+                fprintf(stderr, "Error: Chunk size must be a positive number of KB\n");
+                return -1;
+            }
+            // Chunks are ranges of the mapping
+            *chunk_size = (size_t)kb * 1024;
+            *use_mmap = true;
+        } else {
+            return -1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
     // Check if we have the correct number of arguments
     if (argc != 5) {
         return -1;
@@ -52,14 +80,117 @@ int parse_args(int argc, char *argv[], int *buffer_size, int *num_workers,
 }
 
 void print_usage(const char *program_name) {
-    printf("Usage: %s <buffer_size> <num_workers> <log_file> <search_term>\n", program_name);
+    printf("Usage: %s [-m | -c <chunk_kb>] <buffer_size> <num_workers> <log_file> <search_term>\n", program_name);
+    printf("  -m  map the log file and pass lines as views into it instead of copies\n");
+    printf("  -c  map the log file and let workers claim chunk_kb KB of whole lines at a time\n");
+    printf("      instead of going through the buffer (buffer_size is then unused)\n");
+}
+
+int map_log_file(const char *filename, const char **map, size_t *size) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    *map = NULL;
+    *size = st.st_size;
+    if (*size > 0) {
+        void *p = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        // Read-ahead aggressively; pages behind the reader can be dropped
+        madvise(p, *size, MADV_SEQUENTIAL);
+        *map = p;
+    }
+
+    // The mapping stays valid without the descriptor
+    close(fd);
+    return 0;
+}
+
+void unmap_log_file(const char *map, size_t size) {
+    if (map != NULL) {
+        munmap((void *)map, size);
+    }
+}
+
+// Report a match on a line of the given length (newline included, if any)
+static void print_match(int thread_id, const char *line, size_t length) {
+    printf("Worker %d found match: %.*s", thread_id, (int)length, line);
+    // Add newline if not already present
+    if (length == 0 || line[length - 1] != '\n') {
+        printf("\n");
+    }
+}
+
+// First line start at or after pos: pos itself if a line starts there
+static size_t line_start_from(const chunk_queue_t *q, size_t pos) {
+    if (pos == 0 || pos >= q->size) {
+        return pos < q->size ? pos : q->size;
+    }
+    const char *nl = memchr(q->map + pos - 1, '\n', q->size - pos + 1);
+    return nl ? (size_t)(nl - q->map) + 1 : q->size;
+}
+
+// Search every line starting inside [start, start + chunk_size). The term
+// is looked for across the whole range at once; only a hit costs a look
+// for its line's ends, and the search resumes after that line.
+static void search_chunk(worker_data_t *data, size_t start, size_t term_len) {
+    const chunk_queue_t *q = data->chunks;
+    size_t end = start + q->chunk_size < q->size ? start + q->chunk_size : q->size;
+    const char *pos = q->map + line_start_from(q, start);
+    const char *limit = q->map + line_start_from(q, end);
+
+    while (pos < limit) {
+        const char *hit = memmem(pos, limit - pos, data->search_term, term_len);
+        if (hit == NULL) {
+            break;
+        }
+        const char *line = hit;
+        while (line > pos && line[-1] != '\n') {
+            line--;
+        }
+        const char *nl = memchr(hit, '\n', limit - hit);
+        const char *next = nl ? nl + 1 : limit;
+
+        data->match_count++;
+        print_match(data->thread_id, line, next - line);
+        pos = next;
+    }
+}
+
+// Chunk mode: claim chunks until the file is used up
+static void run_chunks(worker_data_t *data) {
+    chunk_queue_t *q = data->chunks;
+    size_t term_len = strlen(data->search_term);
+    while (keep_running) {
+        size_t start = __atomic_fetch_add(&q->cursor, q->chunk_size, __ATOMIC_RELAXED);
+        if (start >= q->size) {
+            break;
+        }
+        search_chunk(data, start, term_len);
+    }
 }
 
 void *worker_thread(void *arg) {
     worker_data_t *data = (worker_data_t *)arg;
     bool done = false;
+    size_t term_len = strlen(data->search_term);
     data->match_count = 0;
 
+    if (data->chunks != NULL) {
+        run_chunks(data);
+        done = true;
+    }
+
     while (!done && keep_running) {
         // Get an item from the buffer
         buffer_item_t item = buffer_get(data->buffer);
@@ -73,15 +204,18 @@ void *worker_thread(void *arg) {
             // Search for the term in the line
             if (strstr(item.line, data->search_term) != NULL) {
                 data->match_count++;
-                printf("Worker %d found match: %s", data->thread_id, item.line);
-                // Add newline if not already present
-                if (item.line[strlen(item.line) - 1] != '\n') {
-                    printf("\n");
-                }
+                print_match(data->thread_id, item.line, strlen(item.line));
             }
             
             // Free the line memory
             free(item.line);
+        } else if (data->map != NULL) {
+            // A view: search the mapping in place, it isn't NUL-terminated
+            const char *line = data->map + item.offset;
+            if (memmem(line, item.length, data->search_term, term_len) != NULL) {
+                data->match_count++;
+                print_match(data->thread_id, line, item.length);
+            }
         }
     }
 
@@ -99,8 +233,29 @@ void *worker_thread(void *arg) {
     return NULL;
 }
 
+// mmap mode: hand out each line as an (offset, length) view of the mapping
+static void put_views(manager_data_t *data) {
+    size_t offset = 0;
+    while (offset < data->map_size && keep_running) {
+        const char *start = data->map + offset;
+        const char *nl = memchr(start, '\n', data->map_size - offset);
+        size_t length = nl ? (size_t)(nl - start) + 1 : data->map_size - offset;
+        buffer_put_view(data->buffer, offset, length);
+        offset += length;
+    }
+    buffer_put(data->buffer, NULL, true);
+}
+
 void *manager_thread(void *arg) {
     manager_data_t *data = (manager_data_t *)arg;
+    if (data->chunked) {
+        return NULL;
+    }
+    if (data->map != NULL) {
+        put_views(data);
+        return NULL;
+    }
+
     FILE *file = fopen(data->filename, "r");
     
     if (file == NULL) {
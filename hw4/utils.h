@@ -7,11 +7,22 @@
 #include "buffer.h"
 
 
+// Chunk mode: workers claim chunk_size bytes of the mapping at a time by
+// advancing cursor atomically, then widen the claim to whole lines
+typedef struct {
+    const char *map;              // Mapped log file
+    size_t size;                  // Size of the mapping
+    size_t chunk_size;            // Bytes claimed per step
+    size_t cursor;                // Start of the next unclaimed chunk
+} chunk_queue_t;
+
 // Structure to hold worker thread data
 typedef struct {
     int thread_id;                // Worker ID
     const char *search_term;      // Term to search for
     buffer_t *buffer;             // Shared buffer
+    const char *map;              // Mapped log file in mmap mode, NULL otherwise
+    chunk_queue_t *chunks;        // Shared chunk queue in chunk mode, NULL otherwise
     int match_count;              // Number of matches found by this worker
     pthread_barrier_t *barrier;   // Barrier for synchronization
 } worker_data_t;
@@ -21,6 +32,9 @@ typedef struct {
     const char *filename;         // Log file path
     buffer_t *buffer;             // Shared buffer
     int num_workers;              // Number of worker threads
+    const char *map;              // Mapped log file in mmap mode, NULL otherwise
+    size_t map_size;              // Size of the mapping
+    bool chunked;                 // Workers claim chunks themselves; nothing to feed
 } manager_data_t;
 
 // Global flag for handling SIGINT
@@ -31,7 +45,14 @@ void setup_signal_handler(void);
 
 // Parse command line arguments
 int parse_args(int argc, char *argv[], int *buffer_size, int *num_workers, 
-               char **log_file, char **search_term);
+               char **log_file, char **search_term, bool *use_mmap, size_t *chunk_size);
+
+// Map the whole log file read-only for sequential reading.
+// An empty file gives a NULL map of size 0. Returns 0 or -1.
+int map_log_file(const char *filename, const char **map, size_t *size);
+
+// Release a mapping made by map_log_file
+void unmap_log_file(const char *map, size_t size);
 
 // Print usage information
 void print_usage(const char *program_name);